@@ -24,10 +24,38 @@ def getAnisetteServer():
     return config.get('Settings', 'anisette_url', fallback='http://anisette:6969')
 
 
+def getAnisetteTtl():
+    return int(config.get('Settings', 'anisette_ttl', fallback='30'))
+
+
+def getFetchUrl():
+    return config.get('Settings', 'fetch_url', fallback='https://gateway.icloud.com/acsnservice/fetch')
+
+
+def getFetchBatchSize():
+    return int(config.get('Settings', 'fetch_batch_size', fallback='64'))
+
+
+def getFetchTimeout():
+    return int(config.get('Settings', 'fetch_timeout', fallback='30'))
+
+
+def getCacheTtl():
+    return int(config.get('Settings', 'cache_ttl', fallback='60'))
+
+
 def getPort():
     return int(config.get('Settings', 'port', fallback='6176'))
 
 
+def getWorkers():
+    return int(config.get('Settings', 'workers', fallback='8'))
+
+
+def getKeepAliveTimeout():
+    return int(config.get('Settings', 'keepalive_timeout', fallback='15'))
+
+
 def getBindingAddress():
     return config.get('Settings', 'binding_address', fallback='0.0.0.0')
 
@@ -1,25 +1,139 @@
 #!/usr/bin/env python3
 
 import base64
+import heapq
+import itertools
 import json
 import logging
 import os
 import ssl
+import struct
 import sys
+import threading
 import time
+import zlib
 from collections import OrderedDict
+from concurrent.futures import Future, ThreadPoolExecutor
 from datetime import datetime,  timezone
 from http.server import BaseHTTPRequestHandler, HTTPServer
+from socketserver import ThreadingMixIn
 
 import requests
 
+try:
+    import zstandard
+except ImportError:
+    zstandard = None
+
 import mh_config
+import mh_metrics
 from register import apple_cryptography, pypush_gsa_icloud
 
 logger = logging.getLogger()
 
+# Persistent connections to the fetch service, shared by all workers
+fetchSession = pypush_gsa_icloud.createSession()
+
+
+def createCompressor(acceptEncoding):
+    """Returns the content encoding for the Accept-Encoding header and a compressor with compress() and flush(mode)
+    for it, or None and None. zstd is only offered if the zstandard module is installed."""
+    encodings = [part.split(';')[0].strip().lower() for part in acceptEncoding.split(',')]
+    if 'zstd' in encodings and zstandard is not None:
+        compressor = zstandard.ZstdCompressor().compressobj()
+        return 'zstd', ZstdFlushAdapter(compressor)
+    if 'gzip' in encodings:
+        return 'gzip', zlib.compressobj(wbits=31)
+    return None, None
+
+
+REPORTS_NDJSON = 'application/x-ndjson'
+REPORTS_BINARY = 'application/x-haystack-reports'
+
+# The binary format starts with the magic and the ids of the request: the number of ids (uint16) and each id as its
+# length (uint8) and ASCII bytes. It is followed by records of a fixed size: the index of the id (uint16), datePublished
+# in milliseconds (uint64), the length of the payload (uint8) and the payload padded with zeros to 89 bytes. All
+# numbers are big-endian.
+REPORTS_MAGIC = b'HSR1'
+REPORTS_PAYLOAD_BYTES = 89
+reportRecord = struct.Struct('>HQB%ds' % REPORTS_PAYLOAD_BYTES)
+
+
+def isInteger(value):
+    # bool is a subclass of int, but true is no time or count
+    return isinstance(value, int) and not isinstance(value, bool)
+
+
+def isValidSince(since):
+    """since is milliseconds since epoch, either for all ids or as a map of ids to their own since."""
+    if isinstance(since, dict):
+        return all(isInteger(value) for value in since.values())
+    return isInteger(since)
+
+
+def binaryReportsHeader(ids):
+    header = bytearray(REPORTS_MAGIC)
+    header += struct.pack('>H', len(ids))
+    for id in ids:
+        encoded = id.encode()
+        header += struct.pack('>B', len(encoded)) + encoded
+    return bytes(header)
+
+
+class BinaryReportsWriter:
+    """Formats the reports of an id as binary records, see REPORTS_MAGIC."""
+
+    def __init__(self, ids):
+        self.indices = {id: index for index, id in enumerate(ids)}
+
+    def __call__(self, id, entries):
+        records = bytearray()
+        for entry in entries:
+            payload = base64.b64decode(entry['payload'])
+            records += reportRecord.pack(self.indices[id], entry['datePublished'], len(payload), payload)
+        return bytes(records)
+
+
+def ndjsonReports(id, entries):
+    return ''.join(json.dumps(entry) + '\n' for entry in entries).encode()
+
+
+class ZstdFlushAdapter:
+    """Maps the zlib flush modes used for streaming onto a zstandard compressobj."""
+
+    def __init__(self, compressor):
+        self.compressor = compressor
+
+    def compress(self, data):
+        return self.compressor.compress(data)
+
+    def flush(self, mode=zlib.Z_FINISH):
+        if mode == zlib.Z_FINISH:
+            return self.compressor.flush()
+        return self.compressor.flush(zstandard.COMPRESSOBJ_FLUSH_BLOCK)
+
+
+class PooledHTTPServer(ThreadingMixIn, HTTPServer):
+    """Serves each connection on one of a fixed number of worker threads. Idle keep-alive connections are closed after
+    the keep-alive timeout, so that they do not hold a worker forever."""
+    daemon_threads = True
+
+    def __init__(self, server_address, handler, workers):
+        # Created first: server_close() shuts it down if binding the socket fails.
+        self.executor = ThreadPoolExecutor(max_workers=workers, thread_name_prefix='worker')
+        super().__init__(server_address, handler)
+
+    def process_request(self, request, client_address):
+        self.executor.submit(self.process_request_thread, request, client_address)
+
+    def server_close(self):
+        super().server_close()
+        self.executor.shutdown(wait=False)
+
 
 class ServerHandler(BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+    timeout = mh_config.getKeepAliveTimeout()
 
     def addCORSHeaders(self):
         self.send_header('Access-Control-Allow-Origin', '*')
@@ -46,37 +160,62 @@ class ServerHandler(BaseHTTPRequestHandler):
 
         return False
 
+    def send_response(self, code, message=None):
+        mh_metrics.responses.inc(str(code))
+        super().send_response(code, message)
+
+    def sendUnauthorized(self):
+        mh_metrics.errors.inc('unauthorized')
+        self.send_response(401)
+        self.addCORSHeaders()
+        self.send_header('WWW-Authenticate', 'Basic realm="Auth Realm"')
+        self.send_header('Content-Length', '0')
+        self.end_headers()
+
+    def sendBody(self, code, body, contentType='application/json'):
+        # Every response needs a length, so that the connection can be kept alive
+        self.send_response(code)
+        self.addCORSHeaders()
+        self.send_header('Content-Type', contentType)
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+        mh_metrics.responseBytes.inc(amount=len(body))
+
     def do_OPTIONS(self):
         self.send_response(200, "ok")
         self.addCORSHeaders()
+        self.send_header('Content-Length', '0')
         self.end_headers()
 
     def do_GET(self):
         if not self.authenticate():
-            self.send_response(401)
-            self.addCORSHeaders()
-            self.send_header('WWW-Authenticate', 'Basic realm="Auth Realm"')
-            self.end_headers()
+            self.sendUnauthorized()
             return
-        self.send_response(200)
-        self.addCORSHeaders()
-        self.send_header('Content-type', 'text/plain')
-        self.end_headers()
-        self.wfile.write(b"Nothing to see here")
+        if self.path == '/stats':
+            self.sendBody(200, json.dumps(getStats()).encode())
+            return
+        if self.path == '/metrics':
+            self.sendBody(200, mh_metrics.render().encode(), 'text/plain; version=0.0.4')
+            return
+        self.sendBody(200, b"Nothing to see here", 'text/plain')
 
     def do_POST(self):
-        if not self.authenticate():
-            self.send_response(401)
-            self.addCORSHeaders()
-            self.send_header('WWW-Authenticate', 'Basic realm="Auth Realm"')
-            self.end_headers()
-            return
+        with mh_metrics.requestsInFlight.track(), mh_metrics.requestSeconds.time():
+            self.postReports()
+
+    def postReports(self):
         if hasattr(self.headers, 'getheader'):
             content_len = int(self.headers.getheader('content-length', 0))
         else:
-            content_len = int(self.headers.get('content-length'))
+            content_len = int(self.headers.get('content-length', 0))
 
+        # The body is read in any case to keep the connection usable
         post_body = self.rfile.read(content_len)
+        mh_metrics.requestBytes.inc(amount=content_len)
+        if not self.authenticate():
+            self.sendUnauthorized()
+            return
 
         logger.debug('Getting with post: ' + str(post_body))
         body = json.loads(post_body)
@@ -90,47 +229,113 @@ class ServerHandler(BaseHTTPRequestHandler):
 
         datetime.fromtimestamp(startdate)
 
-        # Date is always 1, because it has no effect
-        data = {"search": [
-            {"startDate": 1, "ids": list(body['ids'])}]}
+        # Only reports published after since are returned. It is given in milliseconds like datePublished, either for
+        # all ids or as a map of ids to their own since.
+        since = body.get('since') or 0
+        # Only the newest limit reports by seen time are returned per id, mode latest is a limit of 1
+        limit = 1 if body.get('mode') == 'latest' else body.get('limit')
+        if not isValidSince(since) or not (limit is None or isInteger(limit) and limit > 0):
+            mh_metrics.errors.inc('bad_request')
+            logger.warning(f"Invalid since {since!r} or limit {limit!r}")
+            self.sendBody(400, b'')
+            return
 
         try:
-            with requests.post("https://gateway.icloud.com/acsnservice/fetch",  auth=getAuth(regenerate=False, second_factor='sms'),
-                              headers=pypush_gsa_icloud.generate_anisette_headers(),
-                              json=data) as r:
-                r.raise_for_status()
-
-            logger.debug('Return from fetch service:')
-            logger.debug(r.content.decode())
-            result = json.loads(r.content.decode())
-            results = result['results']
+            ids = list(dict.fromkeys(body['ids']))
+            mh_metrics.idsPerRequest.observe(len(ids))
+            reports = self.filterReports(ids, startdate, since, limit)
+
+            accept = self.headers.get('Accept', '')
+            if REPORTS_BINARY in accept:
+                self.streamReports(reports, REPORTS_BINARY, binaryReportsHeader(ids), BinaryReportsWriter(ids))
+                return
+            if REPORTS_NDJSON in accept:
+                self.streamReports(reports, REPORTS_NDJSON, b'', ndjsonReports)
+                return
 
             newResults = OrderedDict()
-
-            for idx, entry in enumerate(results):
-                data = base64.b64decode(entry['payload'])
-                timestamp = int.from_bytes(data[0:4], 'big') + 978307200
-                if (timestamp > startdate):
-                    newResults[timestamp] = entry
-
-            sorted_map = OrderedDict(sorted(newResults.items(), reverse=True))
-
-            result["results"] = list(sorted_map.values())
-            self.send_response(200)
-            # send response headers
-            self.addCORSHeaders()
-            self.end_headers()
-
-            # send the body of the response
-            responseBody = json.dumps(result)
-            self.wfile.write(responseBody.encode())
-        except requests.exceptions.ConnectTimeout:
-            logger.error("Timeout to " + mh_config.getAnisetteServer() +
-                         ", is your anisette running and accepting Connections?")
-            self.send_response(504)
+            for id, entries in reports:
+                for timestamp, entry in entries.items():
+                    newResults[(timestamp, id)] = entry
+
+            with mh_metrics.serializeSeconds.time():
+                sorted_map = OrderedDict(sorted(newResults.items(), reverse=True))
+
+                result = {"results": list(sorted_map.values()), "statusCode": "200"}
+                response = json.dumps(result).encode()
+            mh_metrics.reportsPerRequest.observe(len(newResults))
+            self.sendBody(200, response)
+        except requests.exceptions.Timeout as e:
+            # Counted where it happened in fetchReports
+            logger.error(f"Timeout: {e}, are your anisette and the fetch service reachable?")
+            self.sendBody(504, b'')
         except Exception as e:
+            mh_metrics.errors.inc('internal')
             logger.error(f"Unknown error occurred {e}", exc_info=True)
-            self.send_response(501)
+            self.sendBody(501, b'')
+
+    def filterReports(self, ids, startdate, since, limit=None):
+        """Yields each id with its reports seen after startdate and published after since, by seen time. With a
+        limit only the newest reports of each id are kept, without sorting all of them."""
+        for id, results in reportCache.items(ids):
+            published = since.get(id, 0) if isinstance(since, dict) else since
+            entries = {}
+            # Duplicates are dropped per id, so that the reports of several accessories can be fetched at once
+            for timestamp, entry in results:
+                if (timestamp > startdate) and entry['datePublished'] > published:
+                    entries[timestamp] = entry
+            if limit is not None and len(entries) > limit:
+                entries = dict(heapq.nlargest(limit, entries.items(), key=lambda item: item[0]))
+            yield id, entries
+
+    def streamReports(self, reports, contentType, header, formatReports):
+        """Sends the header and then the reports of each id formatted by formatReports as soon as they are available,
+        compressed according to Accept-Encoding. Only the reports of one id are sorted, newest first. The response is
+        sent chunked, so that the connection can be kept alive."""
+        # Errors before the first reports still get a status code
+        first = next(reports, None)
+        encoding, compressor = createCompressor(self.headers.get('Accept-Encoding', ''))
+        self.send_response(200)
+        self.addCORSHeaders()
+        self.send_header('Content-Type', contentType)
+        if encoding is not None:
+            self.send_header('Content-Encoding', encoding)
+        self.send_header('Transfer-Encoding', 'chunked')
+        self.end_headers()
+        count = 0
+        serializing = 0
+        try:
+            self.sendCompressed(compressor, header)
+            if first is not None:
+                for id, entries in itertools.chain([first], reports):
+                    start = time.monotonic()
+                    formatted = formatReports(id, [entries[timestamp] for timestamp in sorted(entries, reverse=True)])
+                    serializing += time.monotonic() - start
+                    count += len(entries)
+                    self.sendCompressed(compressor, formatted)
+            if compressor is not None:
+                self.sendChunk(compressor.flush())
+            self.wfile.write(b'0\r\n\r\n')
+            mh_metrics.serializeSeconds.observe(serializing)
+            mh_metrics.reportsPerRequest.observe(count)
+        except Exception as e:
+            mh_metrics.errors.inc('internal')
+            # The status is already sent. Closing without the last chunk tells the client that the response is
+            # incomplete.
+            logger.error(f"Streaming the reports failed: {e}", exc_info=True)
+            self.close_connection = True
+        finally:
+            reports.close()
+
+    def sendCompressed(self, compressor, data):
+        # Flushed, so that the client can use every chunk at once
+        self.sendChunk(compressor.compress(data) + compressor.flush(zlib.Z_SYNC_FLUSH)
+                       if compressor is not None else data)
+
+    def sendChunk(self, data):
+        if data:
+            self.wfile.write(b'%x\r\n%s\r\n' % (len(data), data))
+            mh_metrics.responseBytes.inc(amount=len(data))
 
     def getCurrentTimes(self):
         clientTime = datetime.now(timezone.utc).replace(microsecond=0).isoformat() + 'Z'
@@ -138,18 +343,170 @@ class ServerHandler(BaseHTTPRequestHandler):
         return clientTime, time.tzname[1], clientTimestamp
 
 
-def getAuth(regenerate=False, second_factor='sms'):
-    if os.path.exists(mh_config.getConfigFile()) and not regenerate:
-        with open(mh_config.getConfigFile(), "r") as f:
-            j = json.load(f)
-    else:
-        mobileme = pypush_gsa_icloud.icloud_login_mobileme(username=mh_config.USER, password=mh_config.PASS)
-        logger.debug('Mobileme result: ' + mobileme)
-        j = {'dsid': mobileme['dsid'], 'searchPartyToken': mobileme['delegates']
-             ['com.apple.mobileme']['service-data']['tokens']['searchPartyToken']}
-        with open(mh_config.getConfigFile(), "w") as f:
-            json.dump(j, f)
-    return j['dsid'], j['searchPartyToken']
+def fetchReports(data):
+    """Posts the search to the fetch service. If the auth token is rejected, it is renewed and the search is repeated
+    once."""
+    with mh_metrics.authSeconds.time():
+        auth, generation = apple_cryptography.authState.get()
+    for attempt in range(2):
+        try:
+            with mh_metrics.anisetteSeconds.time():
+                headers = pypush_gsa_icloud.generate_anisette_headers(cached=True)
+        except requests.exceptions.Timeout:
+            mh_metrics.errors.inc('timeout')
+            raise
+        try:
+            with mh_metrics.upstreamInFlight.track(), mh_metrics.upstreamSeconds.time():
+                with fetchSession.post(mh_config.getFetchUrl(), auth=auth, headers=headers, json=data,
+                                       timeout=mh_config.getFetchTimeout()) as r:
+                    pass
+        except requests.exceptions.Timeout:
+            mh_metrics.errors.inc('upstream_timeout')
+            raise
+        if r.status_code in (401, 403):
+            mh_metrics.errors.inc('upstream_401')
+        elif r.status_code >= 500:
+            mh_metrics.errors.inc('upstream_5xx')
+        if r.status_code not in (401, 403) or attempt > 0:
+            break
+        with mh_metrics.authSeconds.time():
+            renewed = apple_cryptography.authState.renew(generation)
+        if renewed is None:
+            break
+        auth, generation = renewed
+    r.raise_for_status()
+    return r
+
+
+# Fetches the batches of requests with many ids in parallel
+upstreamExecutor = ThreadPoolExecutor(max_workers=mh_config.getWorkers(), thread_name_prefix='upstream')
+
+
+def fetchDecodedReports(ids):
+    """The results of the fetch service for |ids| with their seen time. Many ids are fetched in batches of
+    fetch_batch_size in parallel."""
+    size = mh_config.getFetchBatchSize()
+    if len(ids) <= size:
+        return fetchDecodedBatch(ids)
+    results = []
+    for batch in upstreamExecutor.map(fetchDecodedBatch, [ids[i:i + size] for i in range(0, len(ids), size)]):
+        results.extend(batch)
+    return results
+
+
+def fetchDecodedBatch(ids):
+    # Date is always 1, because it has no effect
+    data = {"search": [
+        {"startDate": 1, "ids": ids}]}
+    r = fetchReports(data)
+
+    logger.debug('Return from fetch service:')
+    logger.debug(r.content.decode())
+    results = []
+    for entry in json.loads(r.content.decode())['results']:
+        payload = base64.b64decode(entry['payload'])
+        results.append((int.from_bytes(payload[0:4], 'big') + 978307200, entry))
+    return results
+
+
+class ReportCache:
+    """The decoded results of the fetch service by id, kept for ttl seconds. Ids which are already being fetched are
+    not requested again, the request waits for the running fetch instead (single flight). So clients asking for the
+    same ids at once cause one fetch."""
+
+    def __init__(self, ttl, fetch):
+        self.ttl = ttl
+        self.fetch = fetch
+        # id -> (time of the fetch, results)
+        self.entries = {}
+        # id -> Future of the results of a running fetch
+        self.pending = {}
+        self.lock = threading.Lock()
+        self.stats = {'hits': 0, 'misses': 0, 'coalesced': 0, 'fetches': 0}
+
+    def get(self, ids):
+        """Returns the results of |ids| only."""
+        return [entry for id, results in self.items(ids) for entry in results]
+
+    def items(self, ids):
+        """Yields each of |ids| with its results as soon as they are available, cached ones first."""
+        ids = list(dict.fromkeys(ids))
+        results = {}
+        waiting = {}
+        missing = []
+        with self.lock:
+            now = time.monotonic()
+            for id in ids:
+                entry = self.entries.get(id)
+                if entry is not None and now - entry[0] < self.ttl:
+                    self.stats['hits'] += 1
+                    results[id] = entry[1]
+                elif id in self.pending:
+                    self.stats['coalesced'] += 1
+                    waiting[id] = self.pending[id]
+                else:
+                    self.stats['misses'] += 1
+                    self.pending[id] = Future()
+                    missing.append(id)
+            if missing:
+                self.stats['fetches'] += 1
+        fetched = not missing
+        try:
+            yield from results.items()
+            # Fetch the own ids before waiting for others, so that requests never wait for each other in a circle
+            if missing:
+                fetched = True
+                yield from self.fetchMissing(missing).items()
+            for id, future in waiting.items():
+                yield id, future.result()
+        finally:
+            # Requests waiting for the own ids must not wait forever if this one is given up before the fetch
+            if not fetched:
+                with self.lock:
+                    for id in missing:
+                        self.pending.pop(id).set_exception(Exception('Fetch abandoned'))
+
+    def fetchMissing(self, ids):
+        try:
+            fetched = {id: [] for id in ids}
+            for entry in self.fetch(ids):
+                if entry[1]['id'] in fetched:
+                    fetched[entry[1]['id']].append(entry)
+        except Exception as e:
+            with self.lock:
+                for id in ids:
+                    self.pending.pop(id).set_exception(e)
+            raise
+        with self.lock:
+            now = time.monotonic()
+            for id in [id for id, entry in self.entries.items() if now - entry[0] >= self.ttl]:
+                del self.entries[id]
+            for id, results in fetched.items():
+                if self.ttl > 0:
+                    self.entries[id] = (now, results)
+                self.pending.pop(id).set_result(results)
+        return fetched
+
+
+reportCache = ReportCache(mh_config.getCacheTtl(), fetchDecodedReports)
+
+
+def getStats():
+    stats = {}
+    for name, state in [('anisette', pypush_gsa_icloud.anisetteCache), ('auth', apple_cryptography.authState),
+                        ('reports', reportCache)]:
+        with state.lock:
+            stats[name] = dict(state.stats)
+    return stats
+
+
+def getStatsMetrics():
+    """The counters of /stats as metrics, e.g. haystack_reports_hits_total."""
+    return {f'haystack_{name}_{key}_total': ('counter', f'{key} of the {name} in /stats', value)
+            for name, stats in getStats().items() for key, value in stats.items()}
+
+
+mh_metrics.addCollector(getStatsMetrics)
 
 
 
@@ -178,7 +535,7 @@ if __name__ == "__main__":
 
     Handler = ServerHandler
 
-    httpd = HTTPServer((mh_config.getBindingAddress(), mh_config.getPort()), Handler)
+    httpd = PooledHTTPServer((mh_config.getBindingAddress(), mh_config.getPort()), Handler, mh_config.getWorkers())
     httpd.timeout = 30
     address = mh_config.getBindingAddress() + ":" + str(mh_config.getPort())
     if os.path.isfile(mh_config.getCertFile()):
@@ -201,6 +558,7 @@ if __name__ == "__main__":
         logger.warning("Endpoint is not protected by authentication")
     else:
         logger.info("Endpoint is protected by authentication")
+    logger.info(f'Serving with {mh_config.getWorkers()} workers')
     try:
         httpd.serve_forever()
     except KeyboardInterrupt:
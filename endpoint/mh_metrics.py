@@ -0,0 +1,139 @@
+"""Metrics of the endpoint in the Prometheus text format, served on /metrics."""
+
+import threading
+import time
+from contextlib import contextmanager
+
+# Upper bounds of the buckets of durations in seconds and of counts
+SECONDS_BUCKETS = (0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30)
+COUNT_BUCKETS = (0, 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000)
+
+lock = threading.Lock()
+metrics = []
+collectors = []
+
+
+def formatLabels(labelNames, labelValues, extra=''):
+    labels = [f'{name}="{value}"' for name, value in zip(labelNames, labelValues)]
+    if extra:
+        labels.append(extra)
+    return '{' + ','.join(labels) + '}' if labels else ''
+
+
+def formatValue(value):
+    if value == float('inf'):
+        return '+Inf'
+    return repr(float(value)) if isinstance(value, float) else str(value)
+
+
+class Counter:
+    type = 'counter'
+
+    def __init__(self, name, help, labelNames=()):
+        self.name = name
+        self.help = help
+        self.labelNames = labelNames
+        # label values -> value
+        self.values = {} if labelNames else {(): 0}
+        metrics.append(self)
+
+    def inc(self, *labelValues, amount=1):
+        with lock:
+            self.values[labelValues] = self.values.get(labelValues, 0) + amount
+
+    def samples(self):
+        return [f'{self.name}{formatLabels(self.labelNames, labels)} {formatValue(value)}'
+                for labels, value in sorted(self.values.items())]
+
+
+class Gauge(Counter):
+    type = 'gauge'
+
+    def dec(self, *labelValues, amount=1):
+        self.inc(*labelValues, amount=-amount)
+
+    @contextmanager
+    def track(self):
+        """Counts the block as in progress while it runs."""
+        self.inc()
+        try:
+            yield
+        finally:
+            self.dec()
+
+
+class Histogram:
+    type = 'histogram'
+
+    def __init__(self, name, help, buckets=SECONDS_BUCKETS):
+        self.name = name
+        self.help = help
+        self.buckets = tuple(buckets) + (float('inf'),)
+        self.counts = [0] * len(self.buckets)
+        self.sum = 0
+        metrics.append(self)
+
+    def observe(self, value):
+        with lock:
+            for i, bound in enumerate(self.buckets):
+                if value <= bound:
+                    self.counts[i] += 1
+                    break
+            self.sum += value
+
+    @contextmanager
+    def time(self):
+        """Observes the duration of the block, also if it raises."""
+        start = time.monotonic()
+        try:
+            yield
+        finally:
+            self.observe(time.monotonic() - start)
+
+    def samples(self):
+        lines = []
+        total = 0
+        for bound, count in zip(self.buckets, self.counts):
+            total += count
+            lines.append(f'{self.name}_bucket{{le="{formatValue(bound)}"}} {total}')
+        lines.append(f'{self.name}_sum {formatValue(self.sum)}')
+        lines.append(f'{self.name}_count {total}')
+        return lines
+
+
+def addCollector(collect):
+    """Adds a function returning more metrics at the time of the scrape, as {name: (type, help, value)}."""
+    collectors.append(collect)
+
+
+def render():
+    lines = []
+    with lock:
+        for metric in metrics:
+            lines.append(f'# HELP {metric.name} {metric.help}')
+            lines.append(f'# TYPE {metric.name} {metric.type}')
+            lines.extend(metric.samples())
+    for collect in collectors:
+        for name, (type, help, value) in collect().items():
+            lines.append(f'# HELP {name} {help}')
+            lines.append(f'# TYPE {name} {type}')
+            lines.append(f'{name} {formatValue(value)}')
+    return '\n'.join(lines) + '\n'
+
+
+upstreamSeconds = Histogram('haystack_upstream_fetch_seconds', 'Duration of the requests to the fetch service')
+anisetteSeconds = Histogram('haystack_anisette_seconds', 'Time spent getting the anisette headers of a fetch')
+authSeconds = Histogram('haystack_auth_seconds', 'Time spent getting or renewing the auth token of a fetch')
+serializeSeconds = Histogram('haystack_serialize_seconds', 'Time spent formatting the reports of a response')
+requestSeconds = Histogram('haystack_request_seconds', 'Duration of the report requests')
+reportsPerRequest = Histogram('haystack_reports_per_request', 'Reports returned per request', COUNT_BUCKETS)
+idsPerRequest = Histogram('haystack_ids_per_request', 'Ids asked for per request', COUNT_BUCKETS)
+requestBytes = Counter('haystack_request_bytes_total', 'Bytes of the request bodies')
+responseBytes = Counter('haystack_response_bytes_total', 'Bytes of the response bodies, after compression')
+responses = Counter('haystack_responses_total', 'Responses by status code', ('code',))
+errors = Counter('haystack_errors_total',
+                 'Errors by class: unauthorized, bad_request, timeout (anisette), internal, upstream_401, '
+                 'upstream_5xx, upstream_timeout',
+                 ('class',))
+requestsInFlight = Gauge('haystack_requests_in_flight', 'Report requests being served')
+upstreamInFlight = Gauge('haystack_upstream_fetches_in_flight', 'Requests to the fetch service in progress')
@@ -0,0 +1,338 @@
+#!/usr/bin/env python3
+"""
+Local stand-in for Apple's fetch service and an Anisette server.
+
+Serves
+  GET  /                    Anisette headers like anisette-v3-server
+  POST /acsnservice/fetch   encrypted reports of the requested ids
+so that the endpoint and the app can be run and load-tested without an Apple account.
+
+Reports are encrypted on the fly for the keys of the given devices files (as written by generate_keys.py or
+make_corpus), so the app decrypts them like real ones. Every key reports in a fixed interval and a report becomes
+visible once it is published, so repeated fetches return the same reports plus new ones. Reports of a make_corpus
+_reports.json can be served as well.
+
+Point the endpoint to it in data/config.ini:
+  anisette_url=http://localhost:6969
+  fetch_url=http://localhost:6969/acsnservice/fetch
+and create a data/auth.json with any dsid and searchPartyToken.
+"""
+
+import argparse
+import base64
+import hashlib
+import json
+import logging
+import math
+import random
+import struct
+import threading
+import time
+import uuid
+from datetime import datetime, timezone
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+from cryptography.hazmat.primitives.asymmetric import ec
+from cryptography.hazmat.primitives.ciphers.aead import AESGCM
+from cryptography.hazmat.primitives.serialization import Encoding, PublicFormat
+
+logger = logging.getLogger()
+
+FETCH_PATH = '/acsnservice/fetch'
+# Seconds between the Unix epoch and 2001-01-01, the epoch of seen times
+APPLE_EPOCH_OFFSET = 978307200
+# Center of the generated locations, in units of 1e-7 degrees
+LATITUDE = 525200000
+LONGITUDE = 134050000
+
+
+def sha256(data):
+    digest = hashlib.new("sha256")
+    digest.update(data)
+    return digest.digest()
+
+
+class Latency:
+    """A latency distribution given as kind:params in milliseconds, i.e. const:50, uniform:20:200, normal:100:30,
+    lognormal:100:0.5 (median and sigma) or exp:100 (mean)."""
+
+    KINDS = {'const': 1, 'uniform': 2, 'normal': 2, 'lognormal': 2, 'exp': 1}
+
+    def __init__(self, spec):
+        kind, *params = spec.split(':')
+        if kind not in self.KINDS or len(params) != self.KINDS[kind]:
+            raise argparse.ArgumentTypeError('Invalid latency ' + spec)
+        self.kind = kind
+        self.params = [float(p) for p in params]
+
+    def sample(self, rng):
+        a = self.params[0]
+        b = self.params[1] if len(self.params) > 1 else 0
+        if self.kind == 'const':
+            ms = a
+        elif self.kind == 'uniform':
+            ms = rng.uniform(a, b)
+        elif self.kind == 'normal':
+            ms = rng.gauss(a, b)
+        elif self.kind == 'lognormal':
+            ms = rng.lognormvariate(math.log(a), b) if a > 0 else 0
+        else:
+            ms = rng.expovariate(1 / a) if a > 0 else 0
+        return max(ms, 0) / 1000
+
+
+class RateLimit:
+    """Token bucket of |rate| requests per second with |burst| tokens."""
+
+    def __init__(self, rate, burst):
+        self.rate = rate
+        self.burst = burst
+        self.tokens = burst
+        self.updated = time.monotonic()
+        self.lock = threading.Lock()
+
+    def acquire(self):
+        """Returns 0 if the request may pass, otherwise the seconds until it would."""
+        if self.rate <= 0:
+            return 0
+        with self.lock:
+            now = time.monotonic()
+            self.tokens = min(self.burst, self.tokens + (now - self.updated) * self.rate)
+            self.updated = now
+            if self.tokens >= 1:
+                self.tokens -= 1
+                return 0
+            return (1 - self.tokens) / self.rate
+
+
+class Key:
+    def __init__(self, privateKey):
+        self.publicKey = ec.derive_private_key(int.from_bytes(privateKey, 'big'), ec.SECP224R1()).public_key()
+        advertisementKey = self.publicKey.public_bytes(Encoding.X962, PublicFormat.UncompressedPoint)[1:29]
+        self.id = base64.b64encode(sha256(advertisementKey)).decode()
+        # Reports of the key by seen time, encrypted when first requested
+        self.reports = {}
+
+
+def encryptReport(publicKey, seenTime, confidence, location, extended):
+    ephemeral = ec.generate_private_key(ec.SECP224R1())
+    ephemeralKey = ephemeral.public_key().public_bytes(Encoding.X962, PublicFormat.UncompressedPoint)
+    shared = ephemeral.exchange(ec.ECDH(), publicKey)
+    derived = sha256(shared + b'\x00\x00\x00\x01' + ephemeralKey)
+    encrypted = AESGCM(derived[0:16]).encrypt(derived[16:32], struct.pack('>IIBB', *location), None)
+    return (struct.pack('>I', seenTime - APPLE_EPOCH_OFFSET) + (b'\x00' if extended else b'') +
+            bytes([confidence]) + ephemeralKey + encrypted)
+
+
+class StandIn:
+    def __init__(self, args):
+        self.args = args
+        self.keys = {}
+        self.corpus = {}
+        self.lock = threading.Lock()
+        self.rateLimit = RateLimit(args.rate_limit, args.burst or max(args.rate_limit, 1))
+        self.stats = {'anisette': 0, 'fetch': 0, 'ids': 0, 'results': 0, 'errors': 0, 'limited': 0}
+
+    def loadDevices(self, path):
+        with open(path, 'r') as f:
+            devices = json.load(f)
+        for device in devices:
+            for privateKey in [device['privateKey']] + device.get('additionalKeys', []):
+                key = Key(base64.b64decode(privateKey))
+                self.keys[key.id] = key
+
+    def loadCorpus(self, path):
+        with open(path, 'r') as f:
+            for entry in json.load(f)['results']:
+                self.corpus.setdefault(entry['id'], []).append(entry)
+
+    def reportsOf(self, id, now):
+        """Returns the published reports of |id| seen in the last days, at most --max-results of the newest."""
+        results = list(self.corpus.get(id, []))
+        key = self.keys.get(id)
+        if key is not None:
+            interval = 86400 / self.args.reports_per_day
+            # Each key has its own phase, so that not all keys report at once
+            phase = int.from_bytes(sha256(id.encode())[0:4], 'big') % int(interval)
+            oldest = now - self.args.days * 86400
+            first = math.ceil((oldest - phase) / interval)
+            last = math.floor((now - phase) / interval)
+            with self.lock:
+                for seenTime in [s for s in key.reports if s < oldest]:
+                    del key.reports[seenTime]
+            for n in range(first, last + 1):
+                seenTime = int(n * interval + phase)
+                entry = key.reports.get(seenTime)
+                if entry is None:
+                    entry = self.generateReport(key, seenTime)
+                    with self.lock:
+                        key.reports[seenTime] = entry
+                if entry['datePublished'] <= now * 1000:
+                    results.append(entry)
+        if self.args.max_results and len(results) > self.args.max_results:
+            results = sorted(results, key=lambda e: e['datePublished'])[-self.args.max_results:]
+        return results
+
+    def generateReport(self, key, seenTime):
+        rng = random.Random(key.id + str(seenTime))
+        location = (LATITUDE + rng.randint(-500000, 500000), LONGITUDE + rng.randint(-500000, 500000),
+                    rng.randint(5, 100), 0)
+        extended = rng.randrange(100) < self.args.extended_percent
+        payload = encryptReport(key.publicKey, seenTime, rng.randint(1, 3), location, extended)
+        return {'datePublished': (seenTime + rng.randint(60, 1800)) * 1000,
+                'payload': base64.b64encode(payload).decode(), 'description': 'found', 'id': key.id,
+                'statusCode': 0}
+
+    def anisetteHeaders(self):
+        return {'X-Apple-I-MD': base64.b64encode(random.randbytes(24)).decode(),
+                'X-Apple-I-MD-M': base64.b64encode(random.randbytes(60)).decode(),
+                'X-Apple-I-MD-RINFO': '17106176',
+                'X-Apple-I-MD-LU': base64.b64encode(str(uuid.uuid4()).upper().encode()).decode(),
+                'X-Apple-I-SRL-NO': '0',
+                'X-Apple-I-Client-Time': datetime.now(timezone.utc).replace(microsecond=0).isoformat() + 'Z',
+                'X-Apple-I-TimeZone': 'UTC',
+                'X-Apple-Locale': 'en_US',
+                'X-Mme-Client-Info': '<MacBookPro13,2> <macOS;13.1;22C65> <com.apple.AuthKit/1 (com.apple.dt.Xcode/3594.4.19)>',
+                'X-Mme-Device-Id': str(uuid.uuid4()).upper()}
+
+    def count(self, name, n=1):
+        with self.lock:
+            self.stats[name] += n
+
+
+class StandInHandler(BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+
+    def log_message(self, format, *args):
+        logger.debug(format % args)
+
+    def sendJson(self, status, body, headers=None):
+        data = json.dumps(body).encode()
+        self.send_response(status)
+        self.send_header('Content-Type', 'application/json')
+        self.send_header('Content-Length', str(len(data)))
+        for name, value in (headers or {}).items():
+            self.send_header(name, value)
+        self.end_headers()
+        self.wfile.write(data)
+
+    def searchPartyToken(self):
+        try:
+            auth_type, auth_encoded = self.headers.get('authorization').split(None, 1)
+            return base64.b64decode(auth_encoded).decode().split(':', 1)[1]
+        except (ValueError, IndexError):
+            return None
+
+    def injectFaults(self, latency):
+        """Sleeps for the injected latency and sends an injected error. Returns False if the request is done."""
+        standIn = self.server.standIn
+        rng = random.Random()
+        time.sleep(latency.sample(rng))
+        wait = standIn.rateLimit.acquire()
+        if wait > 0:
+            standIn.count('limited')
+            self.sendJson(429, {'statusCode': '429'}, {'Retry-After': str(math.ceil(wait))})
+            return False
+        if rng.random() < standIn.args.error_rate:
+            standIn.count('errors')
+            status = rng.choice(standIn.args.error_codes)
+            self.sendJson(status, {'statusCode': str(status)})
+            return False
+        return True
+
+    def do_GET(self):
+        standIn = self.server.standIn
+        if self.path.rstrip('/') != '':
+            self.sendJson(404, {})
+            return
+        time.sleep(standIn.args.anisette_latency.sample(random))
+        standIn.count('anisette')
+        self.sendJson(200, standIn.anisetteHeaders())
+
+    def do_POST(self):
+        standIn = self.server.standIn
+        body = self.rfile.read(int(self.headers.get('content-length', 0)))
+        if self.path != FETCH_PATH:
+            self.sendJson(404, {})
+            return
+        if not self.headers.get('authorization') or not self.headers.get('X-Apple-I-MD'):
+            self.sendJson(401, {'statusCode': '401'})
+            return
+        if self.searchPartyToken() in standIn.args.reject_token:
+            self.sendJson(401, {'statusCode': '401'})
+            return
+        if not self.injectFaults(standIn.args.fetch_latency):
+            return
+        try:
+            ids = [id for search in json.loads(body)['search'] for id in search['ids']]
+        except (ValueError, KeyError, TypeError):
+            self.sendJson(400, {'statusCode': '400'})
+            return
+        now = int(time.time())
+        results = [entry for id in ids for entry in standIn.reportsOf(id, now)]
+        standIn.count('fetch')
+        standIn.count('ids', len(ids))
+        standIn.count('results', len(results))
+        self.sendJson(200, {'results': results, 'statusCode': '200'})
+
+
+def statusCodes(value):
+    return [int(code) for code in value.split(',')]
+
+
+def parseArgs():
+    parser = argparse.ArgumentParser(description='Local stand-in for the Apple fetch service and Anisette')
+    parser.add_argument('-d', '--devices', action='append', default=[],
+                        help='devices file whose keys are served (may be repeated)')
+    parser.add_argument('-c', '--corpus', action='append', default=[],
+                        help='_reports.json of make_corpus whose reports are served as well (may be repeated)')
+    parser.add_argument('-b', '--binding-address', default='0.0.0.0')
+    parser.add_argument('-p', '--port', type=int, default=6969)
+    parser.add_argument('--days', type=int, default=7, help='days of reports returned per key (default 7)')
+    parser.add_argument('--reports-per-day', type=float, default=96,
+                        help='reports of each key per day (default 96)')
+    parser.add_argument('--max-results', type=int, default=0,
+                        help='maximum number of results per id, newest first (default unlimited)')
+    parser.add_argument('--extended-percent', type=int, default=50,
+                        help='percentage of 89 byte payloads (default 50)')
+    parser.add_argument('--fetch-latency', type=Latency, default=Latency('const:0'),
+                        help='latency of fetches in ms: const:A, uniform:A:B, normal:MEAN:SD, '
+                             'lognormal:MEDIAN:SIGMA or exp:MEAN (default const:0)')
+    parser.add_argument('--anisette-latency', type=Latency, default=Latency('const:0'),
+                        help='latency of Anisette requests, see --fetch-latency')
+    parser.add_argument('--error-rate', type=float, default=0,
+                        help='fraction of fetches answered with an error (default 0)')
+    parser.add_argument('--error-codes', type=statusCodes, default=[500, 503],
+                        help='comma separated status codes of injected errors (default 500,503)')
+    parser.add_argument('--rate-limit', type=float, default=0,
+                        help='fetches per second before answering with 429 (default unlimited)')
+    parser.add_argument('--burst', type=int, default=0, help='burst size of the rate limit (default its rate)')
+    parser.add_argument('--reject-token', action='append', default=[],
+                        help='searchPartyToken answered with 401, to test its renewal (may be repeated)')
+    parser.add_argument('--loglevel', default='INFO')
+    return parser.parse_args()
+
+
+if __name__ == "__main__":
+    args = parseArgs()
+    logging.basicConfig(level=logging.getLevelName(args.loglevel),
+                        format='%(asctime)s - %(levelname)s - %(message)s')
+    standIn = StandIn(args)
+    for path in args.devices:
+        standIn.loadDevices(path)
+    for path in args.corpus:
+        standIn.loadCorpus(path)
+    logger.info(f'Serving {len(standIn.keys)} keys and {len(standIn.corpus)} corpus ids')
+
+    httpd = ThreadingHTTPServer((args.binding_address, args.port), StandInHandler)
+    httpd.daemon_threads = True
+    httpd.standIn = standIn
+    logger.info(f'Anisette at http://{args.binding_address}:{args.port}/, '
+                f'fetch at http://{args.binding_address}:{args.port}{FETCH_PATH}')
+    try:
+        httpd.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        httpd.server_close()
+        logger.info(f'Server stopped: {standIn.stats}')
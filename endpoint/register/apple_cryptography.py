@@ -6,6 +6,8 @@ import logging
 import os
 import struct
 import sys
+import threading
+import time
 
 from cryptography.hazmat.backends import default_backend
 from cryptography.hazmat.primitives.ciphers import Cipher
@@ -35,34 +37,120 @@ def decode_tag(data):
     return {'lat': latitude, 'lon': longitude, 'conf': confidence, 'status': status}
 
 
+def login(interactive=True):
+    """Logs in with the configured Apple ID and stores the new dsid and searchPartyToken. Raises if it fails. Unless
+    |interactive|, the user is never prompted: missing credentials or a required 2FA code fail the login."""
+    logger.info('Trying to login')
+    mobileme = icloud_login_mobileme(
+        username=mh_config.getUser(), password=mh_config.getPass(), interactive=interactive)
+
+    logger.debug('Answer from icloud login')
+    logger.debug(mobileme)
+    status = mobileme['delegates']['com.apple.mobileme']['status']
+    if status != 0:
+        msg = mobileme['delegates']['com.apple.mobileme']['status-message']
+        logger.error('Invalid status: ' + str(status))
+        logger.error('Error message: ' + msg)
+        if 'blocking' in msg:
+            logger.error(
+                'It seems your account score is not high enough. Log in to https://appleid.apple.com/ and add your credit card (nothing will be charged) or additional data to increase it.')
+        raise Exception('Login failed with status ' + str(status))
+    j = {'dsid': mobileme['dsid'], 'searchPartyToken': mobileme['delegates']
+         ['com.apple.mobileme']['service-data']['tokens']['searchPartyToken']}
+    with open(mh_config.getConfigFile(), "w") as f:
+        json.dump(j, f)
+    return (j['dsid'], j['searchPartyToken'])
+
+
 def getAuth(regenerate=False):
     if os.path.exists(mh_config.getConfigFile()) and not regenerate:
         with open(mh_config.getConfigFile(), "r") as f:
             j = json.load(f)
-    else:
-        logger.info('Trying to login')
-        mobileme = icloud_login_mobileme(
-            username=mh_config.getUser(), password=mh_config.getPass())
-
-        logger.debug('Answer from icloud login')
-        logger.debug(mobileme)
-        status = mobileme['delegates']['com.apple.mobileme']['status']
-        if status == 0:
-            j = {'dsid': mobileme['dsid'], 'searchPartyToken': mobileme['delegates']
-                 ['com.apple.mobileme']['service-data']['tokens']['searchPartyToken']}
-            with open(mh_config.getConfigFile(), "w") as f:
-                json.dump(j, f)
+        return (j['dsid'], j['searchPartyToken'])
+    try:
+        return login()
+    except Exception:
+        logger.error('Unable to proceed, program will be terminated.')
+        sys.exit()
+
+
+class AuthState:
+    """The dsid and searchPartyToken, read once and kept in memory. If the fetch service rejects them, renew() logs in
+    again in the background. All requests rejected with the same token wait for this one renewal."""
+    # Seconds requests wait for a renewal, which may take long if Apple is slow
+    RENEWAL_TIMEOUT = 60
+    # Seconds a renewal may take before it counts as failed, shorter than RENEWAL_TIMEOUT so that waiting requests
+    # learn about the failure
+    LOGIN_TIMEOUT = 45
+    # Seconds until a failed renewal is tried again, so that the account is not locked by repeated logins
+    RETRY_AFTER = 600
+
+    def __init__(self):
+        self.auth = None
+        # Incremented with each renewal, so that a token is only renewed once
+        self.generation = 0
+        self.renewing = False
+        self.failed = None
+        self.lock = threading.Lock()
+        self.changed = threading.Condition(self.lock)
+        self.stats = {'renewals': 0, 'failures': 0}
+
+    def get(self):
+        """Returns the auth and its generation."""
+        with self.lock:
+            if self.auth is None:
+                self.auth = getAuth()
+            return self.auth, self.generation
+
+    def renew(self, generation):
+        """Renews the auth of |generation| after it was rejected. Returns the new auth and generation, or None if it
+        could not be renewed."""
+        with self.lock:
+            if generation == self.generation and not self.renewing and (
+                    self.failed is None or time.monotonic() - self.failed > self.RETRY_AFTER):
+                logger.warning('The auth token was rejected, renewing it')
+                self.renewing = True
+                threading.Thread(target=self.login, daemon=True).start()
+            self.changed.wait_for(lambda: self.generation != generation or not self.renewing,
+                                  timeout=self.RENEWAL_TIMEOUT)
+            if self.generation == generation:
+                return None
+            return self.auth, self.generation
+
+    def login(self):
+        """Logs in without prompts. A login that hangs is abandoned after LOGIN_TIMEOUT and counts as failed."""
+        result = {}
+
+        def run():
+            try:
+                result['auth'] = login(interactive=False)
+            except Exception as e:
+                result['error'] = e
+
+        worker = threading.Thread(target=run, daemon=True)
+        worker.start()
+        worker.join(self.LOGIN_TIMEOUT)
+        auth = None
+        if worker.is_alive():
+            logger.error(f'Renewing the auth token timed out after {self.LOGIN_TIMEOUT} seconds')
+        elif 'error' in result:
+            logger.error(f'Renewing the auth token failed: {result["error"]}')
         else:
-            msg = mobileme['delegates']['com.apple.mobileme']['status-message']
-            logger.error('Invalid status: ' + str(status))
-            logger.error('Error message: ' + msg)
-            if 'blocking' in msg:
-                logger.error(
-                    'It seems your account score is not high enough. Log in to https://appleid.apple.com/ and add your credit card (nothing will be charged) or additional data to increase it.')
-            logger.error('Unable to proceed, program will be terminated.')
-
-            sys.exit()
-    return (j['dsid'], j['searchPartyToken'])
+            auth = result['auth']
+        with self.lock:
+            if auth is None:
+                self.stats['failures'] += 1
+                self.failed = time.monotonic()
+            else:
+                self.stats['renewals'] += 1
+                self.failed = None
+                self.auth = auth
+                self.generation += 1
+            self.renewing = False
+            self.changed.notify_all()
+
+
+authState = AuthState()
 
 
 def registerDevice():
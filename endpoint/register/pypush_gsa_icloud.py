@@ -13,6 +13,7 @@ import base64
 import locale
 import logging
 import re
+import threading
 from datetime import datetime, timezone
 import srp._pysrp as srp
 from cryptography.hazmat.primitives import padding
@@ -32,17 +33,23 @@ srp.no_username_in_x()
 # Disable SSL Warning
 urllib3.disable_warnings()
 
+
+class InteractionRequired(Exception):
+    """Raised by a login without prompts, if it needs the Apple ID, the password or a 2FA code from the user."""
+
 logger = logging.getLogger()
 
 
-def icloud_login_mobileme(username='', password=''):
+def icloud_login_mobileme(username='', password='', interactive=True):
     print("")  # Sometimes no output
+    if not interactive and not (username and password):
+        raise InteractionRequired('The Apple ID and password are not configured')
     if not username:
         username = input('Apple ID: ')
     if not password:
         password = getpass('Password: ')
 
-    g = gsa_authenticate(username, password)
+    g = gsa_authenticate(username, password, interactive)
     pet = g["t"]["com.apple.gs.idms.pet"]["token"]
     adsid = g["adsid"]
 
@@ -74,7 +81,7 @@ def icloud_login_mobileme(username='', password=''):
     return plist.loads(resp.content)
 
 
-def gsa_authenticate(username, password):
+def gsa_authenticate(username, password, interactive=True):
     # Password is None as we'll provide it later
     usr = srp.User(username, bytes(), hash_alg=srp.SHA256, ng_type=srp.NG_2048)
     _, a = usr.start_authentication()
@@ -118,6 +125,8 @@ def gsa_authenticate(username, password):
     spd = plist.loads(PLISTHEADER + spd)
 
     if "au" in resp["Status"] and resp["Status"]["au"] in ["trustedDeviceSecondaryAuth", "secondaryAuth"]:
+        if not interactive:
+            raise InteractionRequired('The login requires a 2FA code')
         logger.info("2FA required, requesting SMS code. (No other 2FA-code will work!)")
         # Replace bytes with strings
         for k, v in spd.items():
@@ -125,7 +134,7 @@ def gsa_authenticate(username, password):
                 spd[k] = base64.b64encode(v).decode()
         sms_second_factor(spd["adsid"], spd["GsIdmsToken"])
 
-        return gsa_authenticate(username, password)
+        return gsa_authenticate(username, password, interactive)
     elif "au" in resp["Status"]:
         logger.error(f"Unknown auth value {r['Status']['au']}")
         return
@@ -176,13 +185,99 @@ def generate_cpd():
     return cpd
 
 
-def generate_anisette_headers():
-    with requests.get(mh_config.getAnisetteServer(), timeout=5) as response:
+def createSession():
+    """A session keeping up to one connection per endpoint worker alive."""
+    session = requests.Session()
+    adapter = requests.adapters.HTTPAdapter(pool_connections=4, pool_maxsize=mh_config.getWorkers())
+    session.mount('http://', adapter)
+    session.mount('https://', adapter)
+    return session
+
+
+# Persistent connections to the Anisette server
+anisetteSession = createSession()
+
+
+def fetch_anisette_headers():
+    with anisetteSession.get(mh_config.getAnisetteServer(), timeout=5) as response:
         response.raise_for_status()  # Hebt Fehler hervor (z. B. 404 oder 500)
         jsonResponse = response.json()
-        a = {"X-Apple-I-MD": jsonResponse["X-Apple-I-MD"],
-             "X-Apple-I-MD-M": jsonResponse["X-Apple-I-MD-M"]}
-        a.update(generate_meta_headers(user_id=USER_ID, device_id=DEVICE_ID))
+        return {"X-Apple-I-MD": jsonResponse["X-Apple-I-MD"],
+                "X-Apple-I-MD-M": jsonResponse["X-Apple-I-MD-M"]}
+
+
+class AnisetteCache:
+    """Keeps the Anisette headers for ttl seconds. After REFRESH_AFTER of the ttl they are refreshed in the background,
+    so that requests do not wait for the Anisette server. If it fails, the last good headers are used."""
+    REFRESH_AFTER = 0.8
+
+    def __init__(self, ttl):
+        self.ttl = ttl
+        self.headers = None
+        self.fetched = 0
+        self.refreshing = False
+        self.lock = threading.Lock()
+        # Only one request fetches on a miss, the others wait for its headers
+        self.fetchLock = threading.Lock()
+        self.stats = {'hits': 0, 'misses': 0, 'refreshes': 0, 'failures': 0, 'fallbacks': 0}
+
+    def isFresh(self):
+        return self.headers is not None and time.monotonic() - self.fetched < self.ttl
+
+    def store(self, headers):
+        with self.lock:
+            self.headers = headers
+            self.fetched = time.monotonic()
+
+    def get(self):
+        with self.lock:
+            if self.isFresh():
+                self.stats['hits'] += 1
+                if time.monotonic() - self.fetched >= self.ttl * self.REFRESH_AFTER and not self.refreshing:
+                    self.refreshing = True
+                    threading.Thread(target=self.refresh, daemon=True).start()
+                return self.headers
+            self.stats['misses'] += 1
+        with self.fetchLock:
+            with self.lock:
+                if self.isFresh():
+                    return self.headers
+            try:
+                headers = fetch_anisette_headers()
+            except Exception as e:
+                with self.lock:
+                    self.stats['failures'] += 1
+                    if self.headers is None:
+                        raise
+                    self.stats['fallbacks'] += 1
+                    # Retry in the background, so that requests do not wait for the server until it is back
+                    self.fetched = time.monotonic() - self.ttl * self.REFRESH_AFTER
+                    logger.warning(f'Anisette server failed ({e}), using the last headers')
+                    return self.headers
+            self.store(headers)
+            return headers
+
+    def refresh(self):
+        try:
+            self.store(fetch_anisette_headers())
+            with self.lock:
+                self.stats['refreshes'] += 1
+        except Exception as e:
+            with self.lock:
+                self.stats['failures'] += 1
+            logger.warning(f'Refreshing the Anisette headers failed: {e}')
+        finally:
+            with self.lock:
+                self.refreshing = False
+
+
+anisetteCache = AnisetteCache(mh_config.getAnisetteTtl())
+
+
+def generate_anisette_headers(cached=False):
+    """The Anisette and meta headers of a request. The login always uses new ones, fetches may use cached ones."""
+    a = dict(anisetteCache.get() if cached else fetch_anisette_headers())
+    a.update(generate_meta_headers(user_id=USER_ID, device_id=DEVICE_ID))
     return a
 
 
@@ -0,0 +1,387 @@
+import 'dart:async';
+import 'dart:ffi';
+import 'dart:io';
+import 'dart:isolate';
+import 'dart:math';
+import 'dart:typed_data';
+
+import 'package:ffi/ffi.dart';
+
+/// Size of one result record, see `HAYSTACK_RECORD_SIZE` in haystack_native.h.
+const int recordSize = 16;
+
+/// Size of a (left padded) private key, see `HAYSTACK_PRIVATE_KEY_SIZE`.
+const int privateKeySize = 28;
+
+/// Size of an uncompressed public key, see `HAYSTACK_PUBLIC_KEY_SIZE`.
+const int publicKeySize = 57;
+
+/// Size of a SHA-256 digest, see `HAYSTACK_SHA256_DIGEST_SIZE`.
+const int sha256DigestSize = 32;
+
+typedef _DecryptReportsNative = Int32 Function(
+    Pointer<Uint8> payloads,
+    Pointer<Uint32> payloadOffsets,
+    Pointer<Uint32> keyIndices,
+    Uint32 reportCount,
+    Pointer<Uint8> privateKeys,
+    Uint32 keyCount,
+    Pointer<Uint8> records);
+typedef _DecryptReportsDart = int Function(
+    Pointer<Uint8> payloads,
+    Pointer<Uint32> payloadOffsets,
+    Pointer<Uint32> keyIndices,
+    int reportCount,
+    Pointer<Uint8> privateKeys,
+    int keyCount,
+    Pointer<Uint8> records);
+typedef _DerivePublicKeysNative = Int32 Function(
+    Pointer<Uint8> privateKeys, Uint32 keyCount, Pointer<Uint8> publicKeys);
+typedef _DerivePublicKeysDart = int Function(
+    Pointer<Uint8> privateKeys, int keyCount, Pointer<Uint8> publicKeys);
+typedef _PoolCreateNative = Pointer<Void> Function(
+    Uint32 workers, Uint32 queueCapacity);
+typedef _PoolCreateDart = Pointer<Void> Function(
+    int workers, int queueCapacity);
+typedef _PoolWorkerCountNative = Uint32 Function(Pointer<Void> pool);
+typedef _PoolWorkerCountDart = int Function(Pointer<Void> pool);
+typedef _DestroyNative = Void Function(Pointer<Void> handle);
+typedef _DestroyDart = void Function(Pointer<Void> handle);
+typedef _JobStartNative = Pointer<Void> Function(
+    Pointer<Void> pool,
+    Pointer<Uint8> payloads,
+    Pointer<Uint32> payloadOffsets,
+    Pointer<Uint32> keyIndices,
+    Uint32 reportCount,
+    Pointer<Uint8> privateKeys,
+    Uint32 keyCount);
+typedef _JobStartDart = Pointer<Void> Function(
+    Pointer<Void> pool,
+    Pointer<Uint8> payloads,
+    Pointer<Uint32> payloadOffsets,
+    Pointer<Uint32> keyIndices,
+    int reportCount,
+    Pointer<Uint8> privateKeys,
+    int keyCount);
+typedef _JobPollNative = Int32 Function(Pointer<Void> job,
+    Pointer<Uint32> indices, Pointer<Uint8> records, Uint32 capacity);
+typedef _JobPollDart = int Function(Pointer<Void> job,
+    Pointer<Uint32> indices, Pointer<Uint8> records, int capacity);
+typedef _JobWaitNative = Void Function(Pointer<Void> job, Uint32 timeoutMs);
+typedef _JobWaitDart = void Function(Pointer<Void> job, int timeoutMs);
+typedef _Sha256Native = Void Function(Pointer<Uint8> data,
+    Pointer<Uint32> offsets, Uint32 count, Pointer<Uint8> digests);
+typedef _Sha256Dart = void Function(Pointer<Uint8> data,
+    Pointer<Uint32> offsets, int count, Pointer<Uint8> digests);
+
+/// Records of reports decrypted by [HaystackNative.decryptReportsStream].
+/// `records[i * recordSize ..]` belongs to report `indices[i]`.
+class DecryptedRecords {
+  final Uint32List indices;
+  final Uint8List records;
+
+  DecryptedRecords(this.indices, this.records);
+}
+
+/// Bindings to the native haystack library.
+class HaystackNative {
+  static const String _libName = 'haystack_native';
+  static HaystackNative? _instance;
+  static bool _unavailable = false;
+
+  final _DecryptReportsDart _decryptReports;
+  final _DerivePublicKeysDart _derivePublicKeys;
+  final _Sha256Dart _sha256;
+  final _PoolCreateDart _poolCreate;
+  final _PoolWorkerCountDart _poolWorkerCount;
+  final _DestroyDart _poolDestroy;
+  final _JobStartDart _jobStart;
+  final _JobPollDart _jobPoll;
+  final _JobWaitDart _jobWait;
+  final _DestroyDart _jobCancel;
+  final _DestroyDart _jobDestroy;
+
+  /// The worker pool of [decryptReportsStream], created on first use.
+  Pointer<Void> _pool = nullptr;
+  int _poolWorkers = 0;
+  int _runningJobs = 0;
+
+  /// Number of records fetched from a running job at once.
+  static const _pollCapacity = 1024;
+
+  /// How long the poll isolate waits for records at a time.
+  static const _waitTimeoutMs = 100;
+
+  HaystackNative._(DynamicLibrary library)
+      : _decryptReports =
+            library.lookupFunction<_DecryptReportsNative, _DecryptReportsDart>(
+                'haystack_decrypt_reports'),
+        _derivePublicKeys = library.lookupFunction<_DerivePublicKeysNative,
+            _DerivePublicKeysDart>('haystack_derive_public_keys'),
+        _sha256 = library.lookupFunction<_Sha256Native, _Sha256Dart>(
+            'haystack_sha256'),
+        _poolCreate = library.lookupFunction<_PoolCreateNative,
+            _PoolCreateDart>('haystack_pool_create'),
+        _poolWorkerCount = library.lookupFunction<_PoolWorkerCountNative,
+            _PoolWorkerCountDart>('haystack_pool_worker_count'),
+        _poolDestroy = library.lookupFunction<_DestroyNative, _DestroyDart>(
+            'haystack_pool_destroy'),
+        _jobStart = library.lookupFunction<_JobStartNative, _JobStartDart>(
+            'haystack_job_start'),
+        _jobPoll = library.lookupFunction<_JobPollNative, _JobPollDart>(
+            'haystack_job_poll'),
+        _jobWait = library.lookupFunction<_JobWaitNative, _JobWaitDart>(
+            'haystack_job_wait'),
+        _jobCancel = library.lookupFunction<_DestroyNative, _DestroyDart>(
+            'haystack_job_cancel'),
+        _jobDestroy = library.lookupFunction<_DestroyNative, _DestroyDart>(
+            'haystack_job_destroy');
+
+  /// Returns the bindings or null, if the native library is not available
+  /// on this platform.
+  static HaystackNative? get instance {
+    if (_instance == null && !_unavailable) {
+      try {
+        _instance = HaystackNative._(_open());
+      } catch (_) {
+        _unavailable = true;
+      }
+    }
+    return _instance;
+  }
+
+  static DynamicLibrary _open() {
+    if (Platform.isLinux || Platform.isAndroid) {
+      return DynamicLibrary.open('lib$_libName.so');
+    }
+    if (Platform.isWindows) {
+      return DynamicLibrary.open('$_libName.dll');
+    }
+    if (Platform.isMacOS || Platform.isIOS) {
+      return DynamicLibrary.open('$_libName.framework/$_libName');
+    }
+    throw UnsupportedError('Unknown platform: ${Platform.operatingSystem}');
+  }
+
+  /// Decrypts all [payloads] in one native call. Payload i is decrypted with
+  /// the raw big-endian private key `privateKeys[keyIndices[i]]`.
+  /// Returns [recordSize] bytes per report.
+  Uint8List decryptReports(List<Uint8List> payloads,
+      List<Uint8List> privateKeys, List<int> keyIndices) {
+    final count = payloads.length;
+    final recordsPtr = malloc<Uint8>(max(count * recordSize, 1));
+    try {
+      _withReportBuffers(payloads, privateKeys, keyIndices,
+          (payloadsPtr, offsetsPtr, indicesPtr, keysPtr) {
+        _decryptReports(payloadsPtr, offsetsPtr, indicesPtr, count, keysPtr,
+            privateKeys.length, recordsPtr);
+      });
+      return Uint8List.fromList(recordsPtr.asTypedList(count * recordSize));
+    } finally {
+      malloc.free(recordsPtr);
+    }
+  }
+
+  /// Decrypts all [payloads] like [decryptReports], but on a pool of
+  /// [workers] native threads (0: one per core). The reports are sharded by
+  /// key and the records are emitted as soon as a shard is done, so callers
+  /// can process them while the rest is still being decrypted. The job is
+  /// waited for in a separate isolate, so this one never blocks. Cancelling
+  /// the subscription stops the decryption, the shards still running finish
+  /// in the background.
+  Stream<DecryptedRecords> decryptReportsStream(List<Uint8List> payloads,
+      List<Uint8List> privateKeys, List<int> keyIndices,
+      {int workers = 0}) async* {
+    final pool = _acquirePool(workers);
+    final Pointer<Void> job;
+    try {
+      job = _withReportBuffers(payloads, privateKeys, keyIndices,
+          (payloadsPtr, offsetsPtr, indicesPtr, keysPtr) {
+        return _jobStart(pool, payloadsPtr, offsetsPtr, indicesPtr,
+            payloads.length, keysPtr, privateKeys.length);
+      });
+    } catch (_) {
+      _runningJobs--;
+      rethrow;
+    }
+    final records = ReceivePort();
+    final exited = ReceivePort();
+    var spawned = false;
+    try {
+      await Isolate.spawn(_pollJob, (job.address, records.sendPort),
+          onError: records.sendPort, onExit: exited.sendPort);
+      spawned = true;
+      await for (final message in records) {
+        if (message == null) {
+          break;
+        }
+        if (message is List) {
+          throw StateError('Polling the decryption failed: ${message[0]}');
+        }
+        yield message as DecryptedRecords;
+      }
+    } finally {
+      _jobCancel(job);
+      if (spawned) {
+        // The job must outlive the isolate polling it.
+        await exited.first;
+      }
+      _jobDestroy(job);
+      _runningJobs--;
+      records.close();
+      exited.close();
+    }
+  }
+
+  /// Polls the records of the job at [args].$1 in a separate isolate and
+  /// sends them to [args].$2, followed by null once all were sent.
+  static void _pollJob((int, SendPort) args) {
+    final (address, port) = args;
+    final native = instance!;
+    final job = Pointer<Void>.fromAddress(address);
+    final indicesPtr = malloc<Uint32>(_pollCapacity);
+    final recordsPtr = malloc<Uint8>(_pollCapacity * recordSize);
+    try {
+      while (true) {
+        final count =
+            native._jobPoll(job, indicesPtr, recordsPtr, _pollCapacity);
+        if (count < 0) {
+          break;
+        }
+        if (count == 0) {
+          native._jobWait(job, _waitTimeoutMs);
+          continue;
+        }
+        port.send(DecryptedRecords(
+            Uint32List.fromList(indicesPtr.asTypedList(count)),
+            Uint8List.fromList(recordsPtr.asTypedList(count * recordSize))));
+      }
+    } finally {
+      malloc.free(indicesPtr);
+      malloc.free(recordsPtr);
+    }
+    port.send(null);
+  }
+
+  /// Number of worker threads of the pool, 0 if it was not started yet.
+  int get workerCount => _pool == nullptr ? 0 : _poolWorkerCount(_pool);
+
+  /// Returns the pool for a new job, recreating it if a different number of
+  /// [workers] was requested and no job is running on it.
+  Pointer<Void> _acquirePool(int workers) {
+    if (_pool != nullptr && _poolWorkers != workers && _runningJobs == 0) {
+      _poolDestroy(_pool);
+      _pool = nullptr;
+    }
+    if (_pool == nullptr) {
+      // Queue a few shards per worker, so none of them runs dry.
+      final threads = workers > 0 ? workers : Platform.numberOfProcessors;
+      _pool = _poolCreate(workers, 4 * threads);
+      _poolWorkers = workers;
+    }
+    _runningJobs++;
+    return _pool;
+  }
+
+  /// Copies the reports into native buffers for the duration of [callback].
+  static T _withReportBuffers<T>(
+      List<Uint8List> payloads,
+      List<Uint8List> privateKeys,
+      List<int> keyIndices,
+      T Function(Pointer<Uint8> payloads, Pointer<Uint32> payloadOffsets,
+              Pointer<Uint32> keyIndices, Pointer<Uint8> privateKeys)
+          callback) {
+    final count = payloads.length;
+    final payloadBytes = payloads.fold<int>(0, (sum, p) => sum + p.length);
+    final keyBytes = privateKeys.length * privateKeySize;
+
+    final payloadsPtr = malloc<Uint8>(max(payloadBytes, 1));
+    final offsetsPtr = malloc<Uint32>(count + 1);
+    final indicesPtr = malloc<Uint32>(max(count, 1));
+    final keysPtr = malloc<Uint8>(max(keyBytes, 1));
+    try {
+      final payloadView = payloadsPtr.asTypedList(payloadBytes);
+      var offset = 0;
+      offsetsPtr[0] = 0;
+      for (var i = 0; i < count; i++) {
+        payloadView.setAll(offset, payloads[i]);
+        offset += payloads[i].length;
+        offsetsPtr[i + 1] = offset;
+        indicesPtr[i] = keyIndices[i];
+      }
+      _copyPrivateKeys(privateKeys, keysPtr);
+      return callback(payloadsPtr, offsetsPtr, indicesPtr, keysPtr);
+    } finally {
+      malloc.free(payloadsPtr);
+      malloc.free(offsetsPtr);
+      malloc.free(indicesPtr);
+      malloc.free(keysPtr);
+    }
+  }
+
+  /// Derives the uncompressed public keys ([publicKeySize] bytes) of the raw
+  /// big-endian [privateKeys] in one native call. Returns null for keys
+  /// without a public key.
+  List<Uint8List?> derivePublicKeys(List<Uint8List> privateKeys) {
+    final count = privateKeys.length;
+    final keysPtr = malloc<Uint8>(max(count * privateKeySize, 1));
+    final publicKeysPtr = malloc<Uint8>(max(count * publicKeySize, 1));
+    try {
+      _copyPrivateKeys(privateKeys, keysPtr);
+      _derivePublicKeys(keysPtr, count, publicKeysPtr);
+      final publicKeys = publicKeysPtr.asTypedList(count * publicKeySize);
+      return List.generate(count, (i) {
+        final key = Uint8List.fromList(
+            publicKeys.sublist(i * publicKeySize, (i + 1) * publicKeySize));
+        // A valid key always starts with the uncompressed point marker.
+        return key[0] == 0x04 ? key : null;
+      });
+    } finally {
+      malloc.free(keysPtr);
+      malloc.free(publicKeysPtr);
+    }
+  }
+
+  /// Computes the SHA-256 digests of all [messages] in one native call.
+  List<Uint8List> sha256(List<Uint8List> messages) {
+    final count = messages.length;
+    final dataBytes = messages.fold<int>(0, (sum, m) => sum + m.length);
+    final dataPtr = malloc<Uint8>(max(dataBytes, 1));
+    final offsetsPtr = malloc<Uint32>(count + 1);
+    final digestsPtr = malloc<Uint8>(max(count * sha256DigestSize, 1));
+    try {
+      final dataView = dataPtr.asTypedList(dataBytes);
+      var offset = 0;
+      offsetsPtr[0] = 0;
+      for (var i = 0; i < count; i++) {
+        dataView.setAll(offset, messages[i]);
+        offset += messages[i].length;
+        offsetsPtr[i + 1] = offset;
+      }
+      _sha256(dataPtr, offsetsPtr, count, digestsPtr);
+      final digests = digestsPtr.asTypedList(count * sha256DigestSize);
+      return List.generate(
+          count,
+          (i) => Uint8List.fromList(digests.sublist(
+              i * sha256DigestSize, (i + 1) * sha256DigestSize)));
+    } finally {
+      malloc.free(dataPtr);
+      malloc.free(offsetsPtr);
+      malloc.free(digestsPtr);
+    }
+  }
+
+  /// Writes [privateKeys] left padded to [privateKeySize] bytes each.
+  static void _copyPrivateKeys(List<Uint8List> privateKeys, Pointer<Uint8> to) {
+    final keyBytes = privateKeys.length * privateKeySize;
+    final keysView = to.asTypedList(keyBytes)..fillRange(0, keyBytes, 0);
+    for (var k = 0; k < privateKeys.length; k++) {
+      final key = privateKeys[k];
+      if (key.length > privateKeySize) {
+        throw ArgumentError(
+            'Private key $k is longer than $privateKeySize bytes');
+      }
+      keysView.setAll((k + 1) * privateKeySize - key.length, key);
+    }
+  }
+}
@@ -0,0 +1,276 @@
+#include "aes_gcm.h"
+
+#include <cstring>
+
+namespace haystack {
+
+namespace {
+
+constexpr uint8_t kSbox[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b,
+    0xfe, 0xd7, 0xab, 0x76, 0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0,
+    0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0, 0xb7, 0xfd, 0x93, 0x26,
+    0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2,
+    0xeb, 0x27, 0xb2, 0x75, 0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0,
+    0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84, 0x53, 0xd1, 0x00, 0xed,
+    0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f,
+    0x50, 0x3c, 0x9f, 0xa8, 0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5,
+    0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2, 0xcd, 0x0c, 0x13, 0xec,
+    0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14,
+    0xde, 0x5e, 0x0b, 0xdb, 0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c,
+    0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79, 0xe7, 0xc8, 0x37, 0x6d,
+    0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f,
+    0x4b, 0xbd, 0x8b, 0x8a, 0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e,
+    0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e, 0xe1, 0xf8, 0x98, 0x11,
+    0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f,
+    0xb0, 0x54, 0xbb, 0x16};
+
+inline uint8_t XTime(uint8_t x) {
+  return (uint8_t)((x << 1) ^ ((x >> 7) * 0x1b));
+}
+
+// A GF(2^128) element in GCM bit order: hi holds bytes 0..7 big-endian.
+struct Block128 {
+  uint64_t hi;
+  uint64_t lo;
+};
+
+Block128 LoadBlock(const uint8_t in[kAesBlockBytes]) {
+  Block128 b = {0, 0};
+  for (int i = 0; i < 8; i++) {
+    b.hi = (b.hi << 8) | in[i];
+    b.lo = (b.lo << 8) | in[8 + i];
+  }
+  return b;
+}
+
+void StoreBlock(const Block128& b, uint8_t out[kAesBlockBytes]) {
+  for (int i = 0; i < 8; i++) {
+    out[i] = (uint8_t)(b.hi >> (56 - 8 * i));
+    out[8 + i] = (uint8_t)(b.lo >> (56 - 8 * i));
+  }
+}
+
+// X * Y in GF(2^128) as specified in NIST SP 800-38D, algorithm 1.
+Block128 GfMul(const Block128& x, const Block128& y) {
+  Block128 z = {0, 0};
+  Block128 v = y;
+  for (int i = 0; i < 128; i++) {
+    uint64_t word = i < 64 ? x.hi : x.lo;
+    uint64_t mask = (uint64_t)0 - ((word >> (63 - (i % 64))) & 1);
+    z.hi ^= v.hi & mask;
+    z.lo ^= v.lo & mask;
+    uint64_t carry = (uint64_t)0 - (v.lo & 1);
+    v.lo = (v.lo >> 1) | (v.hi << 63);
+    v.hi = (v.hi >> 1) ^ (0xe100000000000000ULL & carry);
+  }
+  return z;
+}
+
+// Absorbs |len| bytes into the GHASH accumulator, zero padding the last
+// partial block.
+void GhashUpdate(const Block128& h, const uint8_t* data, size_t len,
+                 Block128* acc) {
+  while (len > 0) {
+    uint8_t block[kAesBlockBytes] = {0};
+    size_t take = len < kAesBlockBytes ? len : kAesBlockBytes;
+    std::memcpy(block, data, take);
+    Block128 b = LoadBlock(block);
+    acc->hi ^= b.hi;
+    acc->lo ^= b.lo;
+    *acc = GfMul(*acc, h);
+    data += take;
+    len -= take;
+  }
+}
+
+void Increment32(uint8_t counter[kAesBlockBytes]) {
+  for (int i = kAesBlockBytes - 1; i >= 12; i--) {
+    if (++counter[i] != 0) {
+      break;
+    }
+  }
+}
+
+}  // namespace
+
+bool TagsEqual(const uint8_t expected[kAesBlockBytes], const uint8_t* tag,
+               size_t tag_len) {
+  // GCM tags may be truncated, but not below 32 bits.
+  if (tag_len < 4 || tag_len > kAesBlockBytes) {
+    return false;
+  }
+  uint8_t diff = 0;
+  for (size_t i = 0; i < tag_len; i++) {
+    diff |= expected[i] ^ tag[i];
+  }
+  return diff == 0;
+}
+
+Aes128::Aes128(const uint8_t key[kAesKeyBytes]) {
+  std::memcpy(round_keys_[0], key, kAesKeyBytes);
+  uint8_t rcon = 0x01;
+  for (int round = 1; round <= 10; round++) {
+    const uint8_t* prev = round_keys_[round - 1];
+    uint8_t* next = round_keys_[round];
+    uint8_t t[4] = {kSbox[prev[13]], kSbox[prev[14]], kSbox[prev[15]],
+                    kSbox[prev[12]]};
+    t[0] ^= rcon;
+    rcon = XTime(rcon);
+    for (int i = 0; i < 4; i++) {
+      next[i] = prev[i] ^ t[i];
+    }
+    for (int i = 4; i < 16; i++) {
+      next[i] = prev[i] ^ next[i - 4];
+    }
+  }
+}
+
+void Aes128::EncryptBlock(const uint8_t in[kAesBlockBytes],
+                          uint8_t out[kAesBlockBytes]) const {
+  uint8_t s[16];
+  for (int i = 0; i < 16; i++) {
+    s[i] = in[i] ^ round_keys_[0][i];
+  }
+  for (int round = 1; round <= 10; round++) {
+    // SubBytes and ShiftRows. The state is column major.
+    uint8_t t[16];
+    for (int c = 0; c < 4; c++) {
+      for (int r = 0; r < 4; r++) {
+        t[4 * c + r] = kSbox[s[4 * ((c + r) % 4) + r]];
+      }
+    }
+    if (round != 10) {
+      for (int c = 0; c < 4; c++) {
+        uint8_t* col = &t[4 * c];
+        uint8_t all = col[0] ^ col[1] ^ col[2] ^ col[3];
+        uint8_t first = col[0];
+        col[0] ^= all ^ XTime(col[0] ^ col[1]);
+        col[1] ^= all ^ XTime(col[1] ^ col[2]);
+        col[2] ^= all ^ XTime(col[2] ^ col[3]);
+        col[3] ^= all ^ XTime(col[3] ^ first);
+      }
+    }
+    for (int i = 0; i < 16; i++) {
+      s[i] = t[i] ^ round_keys_[round][i];
+    }
+  }
+  std::memcpy(out, s, sizeof(s));
+}
+
+namespace {
+
+// Sets up GCM with |iv|: the hash key H and the pre-counter block J0.
+void GcmInit(const Aes128& aes, const uint8_t* iv, size_t iv_len, Block128* h,
+             uint8_t j0[kAesBlockBytes]) {
+  uint8_t zero[kAesBlockBytes] = {0};
+  uint8_t h_bytes[kAesBlockBytes];
+  aes.EncryptBlock(zero, h_bytes);
+  *h = LoadBlock(h_bytes);
+
+  // J0 = IV || 0^31 || 1 for 96 bit IVs, GHASH(IV || len(IV)) otherwise.
+  if (iv_len == 12) {
+    std::memcpy(j0, iv, 12);
+    j0[12] = j0[13] = j0[14] = 0;
+    j0[15] = 1;
+  } else {
+    Block128 acc = {0, 0};
+    GhashUpdate(*h, iv, iv_len, &acc);
+    acc.lo ^= (uint64_t)iv_len * 8;
+    acc = GfMul(acc, *h);
+    StoreBlock(acc, j0);
+  }
+}
+
+// XORs |len| bytes of |in| with the key stream following J0.
+void GcmCtr(const Aes128& aes, const uint8_t j0[kAesBlockBytes],
+            const uint8_t* in, size_t len, uint8_t* out) {
+  uint8_t counter[kAesBlockBytes];
+  uint8_t keystream[kAesBlockBytes];
+  std::memcpy(counter, j0, sizeof(counter));
+  for (size_t offset = 0; offset < len; offset += kAesBlockBytes) {
+    Increment32(counter);
+    aes.EncryptBlock(counter, keystream);
+    size_t n = len - offset < kAesBlockBytes ? len - offset : kAesBlockBytes;
+    for (size_t i = 0; i < n; i++) {
+      out[offset + i] = in[offset + i] ^ keystream[i];
+    }
+  }
+}
+
+// T = E(K, J0) ^ GHASH(C || len(A) || len(C)), without additional data.
+void GcmTag(const Aes128& aes, const Block128& h,
+            const uint8_t j0[kAesBlockBytes], const uint8_t* ciphertext,
+            size_t len, uint8_t tag[kAesBlockBytes]) {
+  Block128 s = {0, 0};
+  GhashUpdate(h, ciphertext, len, &s);
+  s.lo ^= (uint64_t)len * 8;
+  s = GfMul(s, h);
+  aes.EncryptBlock(j0, tag);
+  Block128 mask = LoadBlock(tag);
+  s.hi ^= mask.hi;
+  s.lo ^= mask.lo;
+  StoreBlock(s, tag);
+}
+
+}  // namespace
+
+bool Aes128GcmDecrypt(const uint8_t key[kAesKeyBytes], const uint8_t* iv,
+                      size_t iv_len, const uint8_t* ciphertext, size_t len,
+                      const uint8_t* tag, size_t tag_len, uint8_t* plaintext) {
+  Aes128 aes(key);
+  Block128 h;
+  uint8_t j0[kAesBlockBytes];
+  GcmInit(aes, iv, iv_len, &h, j0);
+  GcmCtr(aes, j0, ciphertext, len, plaintext);
+  uint8_t expected[kAesBlockBytes];
+  GcmTag(aes, h, j0, ciphertext, len, expected);
+  return TagsEqual(expected, tag, tag_len);
+}
+
+void Aes128GcmEncrypt(const uint8_t key[kAesKeyBytes], const uint8_t* iv,
+                      size_t iv_len, const uint8_t* plaintext, size_t len,
+                      uint8_t* ciphertext, uint8_t tag[kAesBlockBytes]) {
+  Aes128 aes(key);
+  Block128 h;
+  uint8_t j0[kAesBlockBytes];
+  GcmInit(aes, iv, iv_len, &h, j0);
+  GcmCtr(aes, j0, plaintext, len, ciphertext);
+  GcmTag(aes, h, j0, ciphertext, len, tag);
+}
+
+void Aes128GcmDecryptLanesPortable(GcmLane* lanes, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    lanes[i].authentic = Aes128GcmDecrypt(
+        lanes[i].key, lanes[i].iv, kGcmLaneIvBytes, lanes[i].ciphertext,
+        lanes[i].len, lanes[i].tag, lanes[i].tag_len, lanes[i].plaintext);
+  }
+}
+
+bool AesNiAvailable() {
+#if defined(HAYSTACK_HAVE_AESNI)
+  static const bool available = __builtin_cpu_supports("aes") &&
+                                 __builtin_cpu_supports("pclmul") &&
+                                 __builtin_cpu_supports("ssse3");
+  return available;
+#else
+  return false;
+#endif
+}
+
+void Aes128GcmDecryptLanes(GcmLane* lanes, size_t count) {
+#if defined(HAYSTACK_HAVE_AESNI)
+  if (AesNiAvailable()) {
+    Aes128GcmDecryptLanesAesNi(lanes, count);
+    return;
+  }
+#endif
+  Aes128GcmDecryptLanesPortable(lanes, count);
+}
+
+}  // namespace haystack
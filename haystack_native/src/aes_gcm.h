@@ -0,0 +1,74 @@
+#ifndef HAYSTACK_NATIVE_AES_GCM_H_
+#define HAYSTACK_NATIVE_AES_GCM_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace haystack {
+
+constexpr size_t kAesKeyBytes = 16;
+constexpr size_t kAesBlockBytes = 16;
+
+// AES-128 block encryption, the only direction GCM needs.
+class Aes128 {
+ public:
+  explicit Aes128(const uint8_t key[kAesKeyBytes]);
+
+  void EncryptBlock(const uint8_t in[kAesBlockBytes],
+                    uint8_t out[kAesBlockBytes]) const;
+
+ private:
+  uint8_t round_keys_[11][kAesBlockBytes];
+};
+
+// Decrypts |len| bytes of AES-128-GCM ciphertext with an IV of any length,
+// without additional data, and verifies the (possibly truncated) tag.
+// Returns false if the tag does not match; |plaintext| is written anyway.
+bool Aes128GcmDecrypt(const uint8_t key[kAesKeyBytes], const uint8_t* iv,
+                      size_t iv_len, const uint8_t* ciphertext, size_t len,
+                      const uint8_t* tag, size_t tag_len, uint8_t* plaintext);
+
+// Encrypts |len| bytes with AES-128-GCM, without additional data, and writes
+// the full 16 byte tag. Used to create test and benchmark reports; the app
+// only ever decrypts.
+void Aes128GcmEncrypt(const uint8_t key[kAesKeyBytes], const uint8_t* iv,
+                      size_t iv_len, const uint8_t* plaintext, size_t len,
+                      uint8_t* ciphertext, uint8_t tag[kAesBlockBytes]);
+
+// One independent GCM decryption in the shape used by Find My reports: a 16
+// byte IV and at most one block of ciphertext. |authentic| is set by the
+// kernels to whether the tag matched.
+struct GcmLane {
+  const uint8_t* key;
+  const uint8_t* iv;
+  const uint8_t* ciphertext;
+  size_t len;
+  const uint8_t* tag;
+  size_t tag_len;
+  uint8_t* plaintext;
+  bool authentic;
+};
+
+constexpr size_t kGcmLaneIvBytes = 16;
+
+// Decrypts and verifies |count| lanes with the fastest kernel the CPU
+// supports.
+void Aes128GcmDecryptLanes(GcmLane* lanes, size_t count);
+
+// The kernels behind Aes128GcmDecryptLanes, exposed for tests and benchmarks.
+void Aes128GcmDecryptLanesPortable(GcmLane* lanes, size_t count);
+#if defined(HAYSTACK_HAVE_AESNI)
+// Runs 8 lanes side by side with AES-NI and PCLMULQDQ. Must only be called if
+// AesNiAvailable() returns true.
+void Aes128GcmDecryptLanesAesNi(GcmLane* lanes, size_t count);
+#endif
+bool AesNiAvailable();
+
+// Compares the first |tag_len| bytes of a computed and a received tag without
+// an early exit. Lengths outside 4..16 never match.
+bool TagsEqual(const uint8_t expected[kAesBlockBytes], const uint8_t* tag,
+               size_t tag_len);
+
+}  // namespace haystack
+
+#endif  // HAYSTACK_NATIVE_AES_GCM_H_
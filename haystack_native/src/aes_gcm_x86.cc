@@ -0,0 +1,195 @@
+// AES-128-GCM decryption of many independent reports at once. Each report has
+// its own key, so key expansion, the hash key H, the pre-counter block J0, the
+// counter encryption and the tag are all per lane. Running kLanes of them
+// round by round keeps the AES and carry-less multiply units busy instead of
+// waiting on the latency of a single dependency chain.
+//
+// Compiled with -maes -mpclmul -mssse3, see CMakeLists.txt.
+
+#include "aes_gcm.h"
+
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <wmmintrin.h>
+
+#include <cstring>
+
+namespace haystack {
+
+namespace {
+
+constexpr size_t kLanes = 8;
+
+inline __m128i ByteSwap(__m128i x) {
+  const __m128i mask =
+      _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  return _mm_shuffle_epi8(x, mask);
+}
+
+inline __m128i ExpandStep(__m128i key, __m128i assist) {
+  assist = _mm_shuffle_epi32(assist, 0xff);
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  return _mm_xor_si128(key, assist);
+}
+
+// The round constant has to be an immediate, hence the macro.
+#define EXPAND_ROUND(rk, round, rcon, n)                                 \
+  for (size_t l = 0; l < (n); l++) {                                     \
+    rk[round][l] = ExpandStep(                                           \
+        rk[round - 1][l], _mm_aeskeygenassist_si128(rk[round - 1][l], rcon)); \
+  }
+
+// Multiplication in GF(2^128) on byte swapped operands, following the Intel
+// carry-less multiplication white paper (Gueron, Kounavis).
+inline __m128i GfMul(__m128i a, __m128i b) {
+  __m128i lo = _mm_clmulepi64_si128(a, b, 0x00);
+  __m128i mid = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x10),
+                              _mm_clmulepi64_si128(a, b, 0x01));
+  __m128i hi = _mm_clmulepi64_si128(a, b, 0x11);
+  lo = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+  hi = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+
+  // Shift the 256 bit product left by one, GCM uses reflected bits.
+  __m128i lo_carry = _mm_srli_epi32(lo, 31);
+  __m128i hi_carry = _mm_srli_epi32(hi, 31);
+  lo = _mm_slli_epi32(lo, 1);
+  hi = _mm_slli_epi32(hi, 1);
+  __m128i cross = _mm_srli_si128(lo_carry, 12);
+  hi_carry = _mm_slli_si128(hi_carry, 4);
+  lo_carry = _mm_slli_si128(lo_carry, 4);
+  lo = _mm_or_si128(lo, lo_carry);
+  hi = _mm_or_si128(hi, hi_carry);
+  hi = _mm_or_si128(hi, cross);
+
+  // Reduce modulo x^128 + x^7 + x^2 + x + 1.
+  __m128i t = _mm_xor_si128(
+      _mm_xor_si128(_mm_slli_epi32(lo, 31), _mm_slli_epi32(lo, 30)),
+      _mm_slli_epi32(lo, 25));
+  __m128i t_hi = _mm_srli_si128(t, 4);
+  lo = _mm_xor_si128(lo, _mm_slli_si128(t, 12));
+  __m128i u = _mm_xor_si128(
+      _mm_xor_si128(_mm_srli_epi32(lo, 1), _mm_srli_epi32(lo, 2)),
+      _mm_srli_epi32(lo, 7));
+  u = _mm_xor_si128(u, t_hi);
+  lo = _mm_xor_si128(lo, u);
+  return _mm_xor_si128(hi, lo);
+}
+
+// Encrypts one block per lane with the lanes' expanded keys.
+inline void EncryptLanes(const __m128i rk[11][kLanes], __m128i* blocks,
+                         size_t n) {
+  for (size_t l = 0; l < n; l++) {
+    blocks[l] = _mm_xor_si128(blocks[l], rk[0][l]);
+  }
+  for (int round = 1; round < 10; round++) {
+    for (size_t l = 0; l < n; l++) {
+      blocks[l] = _mm_aesenc_si128(blocks[l], rk[round][l]);
+    }
+  }
+  for (size_t l = 0; l < n; l++) {
+    blocks[l] = _mm_aesenclast_si128(blocks[l], rk[10][l]);
+  }
+}
+
+// Encrypts two blocks per lane, |a| and |b|, with the lanes' expanded keys.
+inline void EncryptLanes2(const __m128i rk[11][kLanes], __m128i* a,
+                          __m128i* b, size_t n) {
+  for (size_t l = 0; l < n; l++) {
+    a[l] = _mm_xor_si128(a[l], rk[0][l]);
+    b[l] = _mm_xor_si128(b[l], rk[0][l]);
+  }
+  for (int round = 1; round < 10; round++) {
+    for (size_t l = 0; l < n; l++) {
+      a[l] = _mm_aesenc_si128(a[l], rk[round][l]);
+      b[l] = _mm_aesenc_si128(b[l], rk[round][l]);
+    }
+  }
+  for (size_t l = 0; l < n; l++) {
+    a[l] = _mm_aesenclast_si128(a[l], rk[10][l]);
+    b[l] = _mm_aesenclast_si128(b[l], rk[10][l]);
+  }
+}
+
+}  // namespace
+
+void Aes128GcmDecryptLanesAesNi(GcmLane* lanes, size_t count) {
+  // len(IV) = 128 bits as the final GHASH block for J0, byte swapped.
+  const __m128i iv_length = _mm_set_epi64x(0, 128);
+
+  for (size_t base = 0; base < count; base += kLanes) {
+    GcmLane* lane = lanes + base;
+    size_t n = count - base < kLanes ? count - base : kLanes;
+
+    __m128i rk[11][kLanes];
+    for (size_t l = 0; l < n; l++) {
+      rk[0][l] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lane[l].key));
+    }
+    EXPAND_ROUND(rk, 1, 0x01, n)
+    EXPAND_ROUND(rk, 2, 0x02, n)
+    EXPAND_ROUND(rk, 3, 0x04, n)
+    EXPAND_ROUND(rk, 4, 0x08, n)
+    EXPAND_ROUND(rk, 5, 0x10, n)
+    EXPAND_ROUND(rk, 6, 0x20, n)
+    EXPAND_ROUND(rk, 7, 0x40, n)
+    EXPAND_ROUND(rk, 8, 0x80, n)
+    EXPAND_ROUND(rk, 9, 0x1b, n)
+    EXPAND_ROUND(rk, 10, 0x36, n)
+
+    // H = E(K, 0^128)
+    __m128i h[kLanes];
+    for (size_t l = 0; l < n; l++) {
+      h[l] = _mm_setzero_si128();
+    }
+    EncryptLanes(rk, h, n);
+
+    // J0 = GHASH_H(IV || len(IV)) = ((IV * H) ^ len) * H. In the byte swapped
+    // domain the 32 bit counter of inc32(J0) is the lowest dword.
+    __m128i j0[kLanes];
+    for (size_t l = 0; l < n; l++) {
+      h[l] = ByteSwap(h[l]);
+      __m128i iv = ByteSwap(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(lane[l].iv)));
+      j0[l] = GfMul(iv, h[l]);
+    }
+    __m128i counter[kLanes];
+    for (size_t l = 0; l < n; l++) {
+      j0[l] = GfMul(_mm_xor_si128(j0[l], iv_length), h[l]);
+      counter[l] = ByteSwap(_mm_add_epi32(j0[l], _mm_set_epi32(0, 0, 0, 1)));
+      j0[l] = ByteSwap(j0[l]);
+    }
+
+    // S = GHASH_H(C || len(A) || len(C)) while the AES units work on
+    // E(K, J0) and E(K, inc32(J0)).
+    alignas(16) uint8_t blocks[kLanes][kAesBlockBytes];
+    __m128i s[kLanes];
+    for (size_t l = 0; l < n; l++) {
+      std::memset(blocks[l], 0, kAesBlockBytes);
+      std::memcpy(blocks[l], lane[l].ciphertext, lane[l].len);
+      __m128i c =
+          ByteSwap(_mm_load_si128(reinterpret_cast<const __m128i*>(blocks[l])));
+      s[l] = GfMul(c, h[l]);
+    }
+    for (size_t l = 0; l < n; l++) {
+      __m128i lengths = _mm_set_epi64x(0, (long long)lane[l].len * 8);
+      s[l] = ByteSwap(GfMul(_mm_xor_si128(s[l], lengths), h[l]));
+    }
+    EncryptLanes2(rk, j0, counter, n);
+
+    for (size_t l = 0; l < n; l++) {
+      __m128i plain = _mm_xor_si128(
+          _mm_load_si128(reinterpret_cast<const __m128i*>(blocks[l])),
+          counter[l]);
+      _mm_store_si128(reinterpret_cast<__m128i*>(blocks[l]), plain);
+      std::memcpy(lane[l].plaintext, blocks[l], lane[l].len);
+
+      alignas(16) uint8_t tag[kAesBlockBytes];
+      _mm_store_si128(reinterpret_cast<__m128i*>(tag),
+                      _mm_xor_si128(s[l], j0[l]));
+      lane[l].authentic = TagsEqual(tag, lane[l].tag, lane[l].tag_len);
+    }
+  }
+}
+
+}  // namespace haystack
@@ -0,0 +1,303 @@
+// Measures every stage of report decryption on a synthetic corpus (see
+// report_encryptor.h) in the manner of Google Benchmark: each benchmark runs
+// until it has taken at least the minimum time and reports the CPU time per
+// report and the reports per second and core.
+//
+//   decrypt_benchmark [--benchmark_filter=<regex>]
+//                     [--benchmark_min_time=<seconds>] [--reports=<n>]
+//
+// Stages:
+//   Ecdh            decoding the ephemeral key and the P-224 multiplication,
+//                   with batched conversion to affine coordinates
+//   Kdf/<kernel>    the SHA-256 of the KDF inputs
+//   Gcm/<kernel>    authenticating and decrypting the 10 byte location
+//   DecryptReports  all of the above in one thread, for 88 and 89 byte
+//                   payloads
+//   DecryptJob      all of the above on the thread pool with all cores
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <functional>
+#include <random>
+#include <regex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "aes_gcm.h"
+#include "decrypt_job.h"
+#include "report_encryptor.h"
+#include "sha256.h"
+#include "thread_pool.h"
+
+namespace {
+
+// The same chunk size as DecryptReports.
+constexpr size_t kChunkSize = 64;
+constexpr size_t kKeys = 50;
+
+// Encrypted reports for kKeys keys, with the 89 byte variant for odd reports
+// if |extended|.
+struct Corpus {
+  std::vector<uint8_t> private_keys;
+  std::vector<uint8_t> payloads;
+  std::vector<uint32_t> offsets;
+  std::vector<uint32_t> key_indices;
+
+  haystack::ReportBatch batch() const {
+    haystack::ReportBatch batch;
+    batch.payloads = payloads.data();
+    batch.payload_offsets = offsets.data();
+    batch.key_indices = key_indices.data();
+    batch.report_count = key_indices.size();
+    batch.private_keys = private_keys.data();
+    batch.key_count = kKeys;
+    return batch;
+  }
+};
+
+Corpus MakeCorpus(size_t reports, bool extended) {
+  std::mt19937 rng(88);
+  Corpus corpus;
+  corpus.private_keys.resize(kKeys * haystack::kPrivateKeyBytes);
+  for (auto& b : corpus.private_keys) b = (uint8_t)rng();
+  std::vector<uint8_t> public_keys(kKeys * haystack::kPublicKeyBytes);
+  haystack::DerivePublicKeys(corpus.private_keys.data(), kKeys,
+                             public_keys.data());
+
+  corpus.offsets.push_back(0);
+  for (size_t i = 0; i < reports; i++) {
+    uint8_t scalar[haystack::p224::kScalarBytes];
+    for (auto& b : scalar) b = (uint8_t)rng();
+    haystack::Location location = {525200000, 134050000, 20, 0};
+    bool extended_payload = extended && i % 2 == 1;
+    uint8_t payload[haystack::kExtendedPayloadBytes];
+    size_t key = i % kKeys;
+    haystack::EncryptReport(
+        public_keys.data() + key * haystack::kPublicKeyBytes, scalar,
+        (uint32_t)(700000000 + i), 2, location, extended_payload, payload);
+    corpus.payloads.insert(corpus.payloads.end(), payload,
+                           payload + (extended_payload
+                                          ? haystack::kExtendedPayloadBytes
+                                          : haystack::kPayloadBytes));
+    corpus.offsets.push_back((uint32_t)corpus.payloads.size());
+    corpus.key_indices.push_back((uint32_t)key);
+  }
+  return corpus;
+}
+
+// Intermediate results of the corpus, so every stage can be run on its own.
+struct Stages {
+  std::vector<uint8_t> kdf_inputs;
+  std::vector<uint8_t> derived_keys;
+};
+
+Stages MakeStages(const Corpus& corpus) {
+  haystack::ReportBatch batch = corpus.batch();
+  size_t n = batch.report_count;
+  Stages stages;
+  stages.kdf_inputs.resize(n * haystack::kKdfInputBytes);
+  stages.derived_keys.resize(n * haystack::kSha256DigestBytes);
+  for (size_t i = 0; i < n; i++) {
+    const uint8_t* payload = batch.payloads + batch.payload_offsets[i];
+    haystack::p224::AffinePoint ephemeral;
+    haystack::p224::DecodePoint(payload + haystack::kEphemeralKeyOffset,
+                                &ephemeral);
+    haystack::p224::JacobianPoint shared;
+    haystack::p224::ScalarMult(
+        batch.private_keys + batch.key_indices[i] * haystack::kPrivateKeyBytes,
+        ephemeral, &shared);
+    haystack::p224::AffinePoint affine;
+    bool ok;
+    haystack::p224::BatchToAffine(&shared, 1, &affine, &ok);
+    uint8_t* input = stages.kdf_inputs.data() + i * haystack::kKdfInputBytes;
+    haystack::BuildKdfInput(affine, payload + haystack::kEphemeralKeyOffset,
+                            input);
+    haystack::Sha256Digest(
+        input, haystack::kKdfInputBytes,
+        stages.derived_keys.data() + i * haystack::kSha256DigestBytes);
+  }
+  return stages;
+}
+
+struct Benchmark {
+  std::string name;
+  // Processes all reports of the corpus once, returns the number of reports.
+  std::function<size_t()> run;
+};
+
+double CpuSeconds() { return (double)std::clock() / CLOCKS_PER_SEC; }
+
+void RunBenchmark(const Benchmark& benchmark, double min_time) {
+  benchmark.run();  // Warm up.
+  size_t iterations = 0;
+  size_t reports = 0;
+  double cpu_start = CpuSeconds();
+  auto wall_start = std::chrono::steady_clock::now();
+  double wall = 0;
+  while (wall < min_time) {
+    reports += benchmark.run();
+    iterations++;
+    wall = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         wall_start)
+               .count();
+  }
+  double cpu = CpuSeconds() - cpu_start;
+  std::printf("%-32s %10.0f ns %10.0f ns %10zu %14.0f %14.0f\n",
+              benchmark.name.c_str(), wall * 1e9 / reports,
+              cpu * 1e9 / reports, iterations, reports / wall, reports / cpu);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::regex filter(".*");
+  double min_time = 0.5;
+  size_t report_count = 4096;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg.compare(0, 19, "--benchmark_filter=") == 0) {
+      filter = std::regex(arg.substr(19));
+    } else if (arg.compare(0, 21, "--benchmark_min_time=") == 0) {
+      min_time = std::atof(arg.c_str() + 21);
+    } else if (arg.compare(0, 10, "--reports=") == 0) {
+      report_count = std::strtoul(arg.c_str() + 10, nullptr, 10);
+    } else {
+      std::fprintf(stderr,
+                   "usage: decrypt_benchmark [--benchmark_filter=<regex>] "
+                   "[--benchmark_min_time=<seconds>] [--reports=<n>]\n");
+      return 2;
+    }
+  }
+
+  const Corpus corpus = MakeCorpus(report_count, false);
+  const Corpus extended_corpus = MakeCorpus(report_count, true);
+  const Stages stages = MakeStages(corpus);
+  const size_t n = report_count;
+  std::vector<uint8_t> records(n * haystack::kRecordBytes);
+
+  std::vector<Benchmark> benchmarks;
+  benchmarks.push_back({"Ecdh", [&] {
+    haystack::ReportBatch batch = corpus.batch();
+    haystack::p224::JacobianPoint shared[kChunkSize];
+    haystack::p224::AffinePoint affine[kChunkSize];
+    bool valid[kChunkSize];
+    for (size_t chunk = 0; chunk < n; chunk += kChunkSize) {
+      size_t count = n - chunk < kChunkSize ? n - chunk : kChunkSize;
+      for (size_t j = 0; j < count; j++) {
+        size_t i = chunk + j;
+        haystack::p224::AffinePoint ephemeral;
+        haystack::p224::DecodePoint(batch.payloads + batch.payload_offsets[i] +
+                                        haystack::kEphemeralKeyOffset,
+                                    &ephemeral);
+        haystack::p224::ScalarMult(batch.private_keys +
+                                       batch.key_indices[i] *
+                                           haystack::kPrivateKeyBytes,
+                                   ephemeral, &shared[j]);
+      }
+      haystack::p224::BatchToAffine(shared, count, affine, valid);
+    }
+    return n;
+  }});
+
+  using ShaKernel = void (*)(const haystack::Sha256Lane*, size_t);
+  std::vector<std::pair<std::string, ShaKernel>> sha_kernels = {
+      {"Portable", haystack::Sha256DigestLanesPortable},
+      {"Dispatch", haystack::Sha256DigestLanes}};
+#if defined(HAYSTACK_HAVE_SHA_X86)
+  if (haystack::Avx2Available()) {
+    sha_kernels.push_back({"Avx2", haystack::Sha256DigestLanesAvx2});
+  }
+  if (haystack::ShaNiAvailable()) {
+    sha_kernels.push_back({"ShaNi", haystack::Sha256DigestLanesShaNi});
+  }
+#endif
+  for (const auto& kernel : sha_kernels) {
+    ShaKernel run = kernel.second;
+    benchmarks.push_back({"Kdf/" + kernel.first, [&, run] {
+      uint8_t digests[kChunkSize][haystack::kSha256DigestBytes];
+      haystack::Sha256Lane lanes[kChunkSize];
+      for (size_t chunk = 0; chunk < n; chunk += kChunkSize) {
+        size_t count = n - chunk < kChunkSize ? n - chunk : kChunkSize;
+        for (size_t j = 0; j < count; j++) {
+          lanes[j] = {stages.kdf_inputs.data() +
+                          (chunk + j) * haystack::kKdfInputBytes,
+                      haystack::kKdfInputBytes, digests[j]};
+        }
+        run(lanes, count);
+      }
+      return n;
+    }});
+  }
+
+  using GcmKernel = void (*)(haystack::GcmLane*, size_t);
+  std::vector<std::pair<std::string, GcmKernel>> gcm_kernels = {
+      {"Portable", haystack::Aes128GcmDecryptLanesPortable},
+      {"Dispatch", haystack::Aes128GcmDecryptLanes}};
+#if defined(HAYSTACK_HAVE_AESNI)
+  if (haystack::AesNiAvailable()) {
+    gcm_kernels.push_back({"AesNi", haystack::Aes128GcmDecryptLanesAesNi});
+  }
+#endif
+  for (const auto& kernel : gcm_kernels) {
+    GcmKernel run = kernel.second;
+    benchmarks.push_back({"Gcm/" + kernel.first, [&, run] {
+      haystack::ReportBatch batch = corpus.batch();
+      uint8_t plaintexts[kChunkSize][haystack::kCiphertextBytes];
+      haystack::GcmLane lanes[kChunkSize];
+      for (size_t chunk = 0; chunk < n; chunk += kChunkSize) {
+        size_t count = n - chunk < kChunkSize ? n - chunk : kChunkSize;
+        for (size_t j = 0; j < count; j++) {
+          size_t i = chunk + j;
+          const uint8_t* payload = batch.payloads + batch.payload_offsets[i];
+          const uint8_t* derived =
+              stages.derived_keys.data() + i * haystack::kSha256DigestBytes;
+          lanes[j] = {derived,
+                      derived + haystack::kAesKeyBytes,
+                      payload + haystack::kCiphertextOffset,
+                      haystack::kCiphertextBytes,
+                      payload + haystack::kTagOffset,
+                      haystack::kPayloadBytes - haystack::kTagOffset,
+                      plaintexts[j],
+                      false};
+        }
+        run(lanes, count);
+      }
+      return n;
+    }});
+  }
+
+  benchmarks.push_back({"DecryptReports/88", [&] {
+    return haystack::DecryptReports(corpus.batch(), 0, n, records.data());
+  }});
+  benchmarks.push_back({"DecryptReports/88+89", [&] {
+    return haystack::DecryptReports(extended_corpus.batch(), 0, n,
+                                    records.data());
+  }});
+
+  haystack::ThreadPool pool(0, 64);
+  std::vector<uint32_t> indices(1024);
+  std::vector<uint8_t> polled(1024 * haystack::kRecordBytes);
+  benchmarks.push_back(
+      {"DecryptJob/" + std::to_string(pool.worker_count()) + "threads", [&] {
+         haystack::DecryptJob job(&pool, extended_corpus.batch());
+         while (job.Poll(indices.data(), polled.data(), indices.size()) !=
+                -1) {
+           std::this_thread::sleep_for(std::chrono::microseconds(100));
+         }
+         return n;
+       }});
+
+  std::printf("%zu reports over %zu keys, %u hardware threads\n", n, kKeys,
+              std::thread::hardware_concurrency());
+  std::printf("%-32s %13s %13s %10s %14s %14s\n", "Benchmark", "Time/report",
+              "CPU/report", "Iterations", "reports/s", "reports/s/core");
+  for (const Benchmark& benchmark : benchmarks) {
+    if (std::regex_search(benchmark.name, filter)) {
+      RunBenchmark(benchmark, min_time);
+    }
+  }
+  return 0;
+}
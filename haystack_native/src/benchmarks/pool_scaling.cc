@@ -0,0 +1,90 @@
+// Measures how report decryption on the thread pool scales with the number of
+// workers: decrypts the same batch with 1, 2, ... N workers and prints the
+// throughput of each run.
+//
+//   pool_scaling [reports] [max workers]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "decrypt_job.h"
+#include "thread_pool.h"
+
+namespace {
+
+// A valid report and its key (see tests/report_decryptor_test.cc).
+const uint8_t kKey[28] = {
+    0x41, 0x4c, 0x34, 0x3c, 0x10, 0x27, 0xc4, 0xd1, 0xc3, 0x86, 0xbb,
+    0xc4, 0xcd, 0x61, 0x3e, 0x30, 0xd8, 0xf1, 0x6a, 0xdf, 0x91, 0xb7,
+    0x58, 0x4a, 0x22, 0x65, 0xb1, 0xf6};
+const uint8_t kPayload[88] = {
+    0x61, 0x92, 0x64, 0xc2, 0xc4, 0x04, 0xdf, 0x97, 0x70, 0x09, 0x86,
+    0xc8, 0x74, 0xce, 0x6f, 0x6b, 0xd4, 0x6b, 0xe4, 0x30, 0xe4, 0x97,
+    0x30, 0xc2, 0xaa, 0x9a, 0x0c, 0x74, 0x1a, 0x7a, 0x74, 0xe8, 0x7e,
+    0x1f, 0x00, 0x01, 0x9f, 0x42, 0xae, 0x09, 0x1a, 0x62, 0x15, 0x40,
+    0xdb, 0xc2, 0x5e, 0x3c, 0xf6, 0x15, 0x2d, 0x57, 0x18, 0xb6, 0xb0,
+    0x94, 0x25, 0x89, 0x1b, 0xe5, 0x54, 0x22, 0xdb, 0x9d, 0x0f, 0x64,
+    0xeb, 0xce, 0xce, 0x2a, 0xb0, 0x5b, 0x1b, 0xdd, 0xe6, 0x7c, 0x5d,
+    0xb5, 0xf6, 0xbe, 0xa4, 0xc9, 0x48, 0x01, 0xce, 0x5d, 0x9a, 0x70};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  size_t reports = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20000;
+  size_t max_workers = argc > 2 ? std::strtoul(argv[2], nullptr, 10)
+                                : std::thread::hardware_concurrency();
+  if (max_workers == 0) {
+    max_workers = 1;
+  }
+
+  // Spread the reports over 50 keys like a fleet of accessories would.
+  const size_t kKeys = 50;
+  std::vector<uint8_t> keys;
+  for (size_t k = 0; k < kKeys; k++) {
+    keys.insert(keys.end(), kKey, kKey + sizeof(kKey));
+  }
+  std::vector<uint8_t> payloads;
+  std::vector<uint32_t> offsets = {0};
+  std::vector<uint32_t> key_indices;
+  for (size_t i = 0; i < reports; i++) {
+    payloads.insert(payloads.end(), kPayload, kPayload + sizeof(kPayload));
+    offsets.push_back((uint32_t)payloads.size());
+    key_indices.push_back((uint32_t)(i % kKeys));
+  }
+  haystack::ReportBatch batch;
+  batch.payloads = payloads.data();
+  batch.payload_offsets = offsets.data();
+  batch.key_indices = key_indices.data();
+  batch.report_count = reports;
+  batch.private_keys = keys.data();
+  batch.key_count = kKeys;
+
+  std::printf("%zu reports, %u hardware threads\n", reports,
+              std::thread::hardware_concurrency());
+  std::printf("workers  reports/s  speedup\n");
+  double single = 0;
+  std::vector<uint32_t> indices(1024);
+  std::vector<uint8_t> records(1024 * haystack::kRecordBytes);
+  for (size_t workers = 1; workers <= max_workers; workers++) {
+    haystack::ThreadPool pool(workers, 4 * workers);
+    auto start = std::chrono::steady_clock::now();
+    {
+      haystack::DecryptJob job(&pool, batch);
+      while (job.Poll(indices.data(), records.data(), indices.size()) != -1) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+      }
+    }
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    double rate = reports / seconds;
+    if (workers == 1) {
+      single = rate;
+    }
+    std::printf("%7zu  %9.0f  %7.2f\n", workers, rate, rate / single);
+  }
+  return 0;
+}
@@ -0,0 +1,205 @@
+#include "decrypt_job.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace haystack {
+
+namespace {
+
+// The unencrypted seen time of a payload, for ordering only.
+uint32_t SeenTime(const uint8_t* payload, size_t len) {
+  if (len < 4) {
+    return 0;
+  }
+  return (uint32_t)payload[0] << 24 | (uint32_t)payload[1] << 16 |
+         (uint32_t)payload[2] << 8 | (uint32_t)payload[3];
+}
+
+}  // namespace
+
+constexpr size_t DecryptJob::kShardSize;
+
+DecryptJob::DecryptJob(ThreadPool* pool, const ReportBatch& batch,
+                       std::function<void()> on_deleted)
+    : pool_(pool), on_deleted_(std::move(on_deleted)) {
+  size_t count = batch.report_count;
+  order_.resize(count);
+  std::vector<uint32_t> seen_times(count);
+  for (size_t i = 0; i < count; i++) {
+    order_[i] = (uint32_t)i;
+    seen_times[i] = SeenTime(batch.payloads + batch.payload_offsets[i],
+                             batch.payload_offsets[i + 1] -
+                                 batch.payload_offsets[i]);
+  }
+  std::stable_sort(order_.begin(), order_.end(),
+                   [&](uint32_t a, uint32_t b) {
+                     if (batch.key_indices[a] != batch.key_indices[b]) {
+                       return batch.key_indices[a] < batch.key_indices[b];
+                     }
+                     return seen_times[a] < seen_times[b];
+                   });
+
+  payload_offsets_.reserve(count + 1);
+  payload_offsets_.push_back(0);
+  key_indices_.reserve(count);
+  for (uint32_t i : order_) {
+    const uint8_t* payload = batch.payloads + batch.payload_offsets[i];
+    payloads_.insert(payloads_.end(), payload,
+                     payload + (batch.payload_offsets[i + 1] -
+                                batch.payload_offsets[i]));
+    payload_offsets_.push_back((uint32_t)payloads_.size());
+    key_indices_.push_back(batch.key_indices[i]);
+  }
+  private_keys_.assign(batch.private_keys,
+                       batch.private_keys + batch.key_count * kPrivateKeyBytes);
+  records_.resize(count * kRecordBytes);
+  // Overwritten by the shards which run.
+  for (size_t i = 0; i < count; i++) {
+    records_[i * kRecordBytes + kRecordStatusOffset] = kReportCancelled;
+  }
+
+  batch_.payloads = payloads_.data();
+  batch_.payload_offsets = payload_offsets_.data();
+  batch_.key_indices = key_indices_.data();
+  batch_.report_count = count;
+  batch_.private_keys = private_keys_.data();
+  batch_.key_count = batch.key_count;
+
+  for (size_t begin = 0; begin < count;) {
+    size_t end = begin + 1;
+    while (end < count && end - begin < kShardSize &&
+           key_indices_[end] == key_indices_[begin]) {
+      end++;
+    }
+    shards_.emplace_back(begin, end);
+    shard_keys_.push_back(key_indices_[begin]);
+    begin = end;
+  }
+  feeder_ = std::thread(&DecryptJob::Feed, this);
+}
+
+DecryptJob::~DecryptJob() {
+  Cancel();
+  // A released job is deleted by the feeder or a worker once it is idle.
+  if (feeder_.joinable()) {
+    feeder_.join();
+  }
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    shard_done_.wait(lock, [this] { return finished_ == submitted_; });
+  }
+  if (on_deleted_) {
+    on_deleted_();
+  }
+}
+
+void DecryptJob::Cancel() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  cancelled_ = true;
+  shard_done_.notify_all();
+}
+
+void DecryptJob::Release(DecryptJob* job) {
+  job->feeder_.detach();
+  bool idle;
+  {
+    std::lock_guard<std::mutex> lock(job->mutex_);
+    job->cancelled_ = true;
+    job->released_ = true;
+    idle = job->Idle();
+    job->shard_done_.notify_all();
+  }
+  if (idle) {
+    delete job;
+  }
+}
+
+void DecryptJob::Wait(uint32_t timeout_ms) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  shard_done_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] {
+    return !ready_.empty() || handed_out_ == order_.size() ||
+           (cancelled_ && Idle());
+  });
+}
+
+void DecryptJob::Feed() {
+  for (size_t shard = 0; shard < shards_.size(); shard++) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (cancelled_) {
+        break;
+      }
+      submitted_++;
+    }
+    pool_->Submit(shard_keys_[shard], [this, shard] { RunShard(shard); });
+  }
+  bool release;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    feeding_ = false;
+    release = released_ && Idle();
+    shard_done_.notify_all();
+  }
+  if (release) {
+    delete this;
+  }
+}
+
+void DecryptJob::RunShard(size_t shard) {
+  bool cancelled;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cancelled = cancelled_;
+  }
+  if (!cancelled) {
+    DecryptReports(batch_, shards_[shard].first, shards_[shard].second,
+                   records_.data());
+  }
+  bool release;
+  {
+    // Notify under the lock, the destructor may run as soon as it is
+    // released.
+    std::lock_guard<std::mutex> lock(mutex_);
+    ready_.push_back(shard);
+    finished_++;
+    shard_done_.notify_all();
+    release = released_ && Idle();
+  }
+  if (release) {
+    delete this;
+  }
+}
+
+int32_t DecryptJob::Poll(uint32_t* indices, uint8_t* records,
+                         size_t capacity) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t copied = 0;
+  size_t consumed = 0;
+  while (consumed < ready_.size() && copied < capacity) {
+    const auto& range = shards_[ready_[consumed]];
+    size_t begin = range.first + ready_offset_;
+    size_t n = std::min(range.second - begin, capacity - copied);
+    for (size_t i = 0; i < n; i++) {
+      indices[copied + i] = order_[begin + i];
+    }
+    std::memcpy(records + copied * kRecordBytes,
+                records_.data() + begin * kRecordBytes, n * kRecordBytes);
+    copied += n;
+    ready_offset_ += n;
+    if (begin + n == range.second) {
+      consumed++;
+      ready_offset_ = 0;
+    }
+  }
+  ready_.erase(ready_.begin(), ready_.begin() + consumed);
+  handed_out_ += copied;
+  if (copied == 0 &&
+      (handed_out_ == order_.size() || (cancelled_ && Idle()))) {
+    return -1;
+  }
+  return (int32_t)copied;
+}
+
+}  // namespace haystack
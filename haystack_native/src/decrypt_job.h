@@ -0,0 +1,100 @@
+#ifndef HAYSTACK_NATIVE_DECRYPT_JOB_H_
+#define HAYSTACK_NATIVE_DECRYPT_JOB_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "report_decryptor.h"
+#include "thread_pool.h"
+
+namespace haystack {
+
+// Decrypts a batch of reports on a ThreadPool and hands out the records shard
+// by shard as they complete, so the caller can process results while the
+// remaining reports are still being decrypted.
+//
+// The reports are grouped by key, in order of their seen time within a key,
+// and split into shards of at most kShardSize reports. Shards are queued by
+// a feeder thread, so a full pool queue never blocks the caller.
+//
+// Records of reports which were not decrypted because the job was cancelled
+// have the status kReportCancelled.
+class DecryptJob {
+ public:
+  static constexpr size_t kShardSize = 256;
+
+  // Copies |batch|, the caller's buffers may be released right away.
+  // |on_deleted|, if set, is called at the end of the destructor.
+  DecryptJob(ThreadPool* pool, const ReportBatch& batch,
+             std::function<void()> on_deleted = nullptr);
+  // Waits for the shards already running.
+  ~DecryptJob();
+
+  DecryptJob(const DecryptJob&) = delete;
+  DecryptJob& operator=(const DecryptJob&) = delete;
+
+  // Skips the shards which did not start yet and wakes up Wait. Does not
+  // block.
+  void Cancel();
+
+  // Cancels |job| and deletes it once its running shards and the feeder are
+  // done, on the thread finishing last. Does not block. |job| must have been
+  // created with new and must not be used afterwards.
+  static void Release(DecryptJob* job);
+
+  // Blocks until records are ready to be polled, the job is done or
+  // cancelled, or |timeout_ms| passed.
+  void Wait(uint32_t timeout_ms);
+
+  // Copies up to |capacity| completed records (kRecordBytes each) and the
+  // batch indices of their reports. Returns the number of records copied,
+  // 0 if none are ready yet and -1 once all records were handed out. After
+  // Cancel, -1 is returned once the records of all shards which were queued
+  // were handed out.
+  int32_t Poll(uint32_t* indices, uint8_t* records, size_t capacity);
+
+ private:
+  void Feed();
+  void RunShard(size_t shard);
+  // Whether no thread uses the job anymore. Requires |mutex_|.
+  bool Idle() const { return !feeding_ && finished_ == submitted_; }
+
+  ThreadPool* pool_;
+  std::vector<uint8_t> payloads_;
+  std::vector<uint32_t> payload_offsets_;
+  std::vector<uint32_t> key_indices_;
+  std::vector<uint8_t> private_keys_;
+  ReportBatch batch_;
+  // order_[i] is the caller's index of report i of |batch_|.
+  std::vector<uint32_t> order_;
+  std::vector<uint8_t> records_;
+  // [begin, end) report ranges of |batch_| and the key they belong to.
+  std::vector<std::pair<size_t, size_t>> shards_;
+  std::vector<uint32_t> shard_keys_;
+
+  std::mutex mutex_;
+  std::condition_variable shard_done_;
+  bool cancelled_ = false;
+  bool released_ = false;
+  bool feeding_ = true;
+  size_t submitted_ = 0;
+  size_t finished_ = 0;
+  // Finished shards not yet handed out completely, and how much of the first
+  // one was handed out.
+  std::vector<size_t> ready_;
+  size_t ready_offset_ = 0;
+  size_t handed_out_ = 0;
+
+  std::function<void()> on_deleted_;
+  std::thread feeder_;
+};
+
+}  // namespace haystack
+
+#endif  // HAYSTACK_NATIVE_DECRYPT_JOB_H_
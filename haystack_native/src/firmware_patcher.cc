@@ -0,0 +1,49 @@
+#include "firmware_patcher.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace haystack {
+
+size_t KeyfileKeyCount(const uint8_t* keyfile, size_t len) {
+  if (len == 0 || keyfile[0] == 0 ||
+      len != 1 + keyfile[0] * kAdvertisementKeyBytes) {
+    return 0;
+  }
+  return keyfile[0];
+}
+
+bool FindKeyMarker(const uint8_t* firmware, size_t len, size_t* offset) {
+  const uint8_t* end = firmware + len;
+  const uint8_t* marker = reinterpret_cast<const uint8_t*>(kKeyMarker);
+  const uint8_t* found =
+      std::search(firmware, end, marker, marker + kKeyMarkerBytes);
+  if (found == end ||
+      std::search(found + 1, end, marker, marker + kKeyMarkerBytes) != end) {
+    return false;
+  }
+  *offset = (size_t)(found - firmware);
+  return true;
+}
+
+bool KeysFit(const uint8_t* firmware, size_t len, size_t offset,
+             size_t key_count) {
+  size_t keys_end = offset + key_count * kAdvertisementKeyBytes;
+  if (key_count == 0 || keys_end > len) {
+    return false;
+  }
+  for (size_t i = offset + kKeyMarkerBytes; i < keys_end; i++) {
+    if (firmware[i] != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+size_t Esp32KeyPartitionImageBytes(size_t keyfile_len) {
+  size_t sectors = (keyfile_len + kFlashSectorBytes - 1) / kFlashSectorBytes;
+  size_t bytes = sectors * kFlashSectorBytes;
+  return bytes <= kEsp32KeyPartitionBytes ? bytes : 0;
+}
+
+}  // namespace haystack
@@ -0,0 +1,44 @@
+#ifndef HAYSTACK_NATIVE_FIRMWARE_PATCHER_H_
+#define HAYSTACK_NATIVE_FIRMWARE_PATCHER_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace haystack {
+
+// The nrf5x firmware reserves its key array with this placeholder. The
+// advertisement keys of a keyfile (without the count byte) are written over it.
+constexpr char kKeyMarker[] = "OFFLINEFINDINGPUBLICKEYHERE!";
+constexpr size_t kKeyMarkerBytes = sizeof(kKeyMarker) - 1;
+
+// Size of an advertisement key in a keyfile.
+constexpr size_t kAdvertisementKeyBytes = 28;
+
+// The ESP32 firmware reads the keyfile as is from the "key" partition of
+// with_key.csv.
+constexpr size_t kEsp32KeyPartitionOffset = 0x110000;
+constexpr size_t kEsp32KeyPartitionBytes = 0x100000;
+constexpr size_t kFlashSectorBytes = 0x1000;
+
+// Returns the number of keys of a keyfile (a count byte followed by that many
+// advertisement keys), or 0 if it is malformed.
+size_t KeyfileKeyCount(const uint8_t* keyfile, size_t len);
+
+// Finds the key marker in |firmware|. Returns false if it is missing or not
+// unique.
+bool FindKeyMarker(const uint8_t* firmware, size_t len, size_t* offset);
+
+// Returns true if |key_count| keys fit into the key array at |offset|: the
+// array must not end past the image, and everything after the marker must
+// still be zero as in the unpatched firmware.
+bool KeysFit(const uint8_t* firmware, size_t len, size_t offset,
+             size_t key_count);
+
+// Size of the ESP32 key partition image of a |keyfile_len| byte keyfile: the
+// keyfile padded with 0xff (erased flash) to whole sectors. Returns 0 if it
+// does not fit into the partition.
+size_t Esp32KeyPartitionImageBytes(size_t keyfile_len);
+
+}  // namespace haystack
+
+#endif  // HAYSTACK_NATIVE_FIRMWARE_PATCHER_H_
@@ -0,0 +1,139 @@
+#include "haystack_native.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "decrypt_job.h"
+#include "public_keys.h"
+#include "report_decryptor.h"
+#include "sha256.h"
+#include "thread_pool.h"
+
+static_assert(HAYSTACK_RECORD_SIZE == haystack::kRecordBytes,
+              "record size mismatch");
+static_assert(HAYSTACK_PRIVATE_KEY_SIZE == haystack::kPrivateKeyBytes,
+              "private key size mismatch");
+static_assert(HAYSTACK_PUBLIC_KEY_SIZE == haystack::kPublicKeyBytes,
+              "public key size mismatch");
+static_assert(HAYSTACK_SHA256_DIGEST_SIZE == haystack::kSha256DigestBytes,
+              "digest size mismatch");
+static_assert(HAYSTACK_REPORT_TAG_MISMATCH == haystack::kReportTagMismatch,
+              "status code mismatch");
+static_assert(HAYSTACK_REPORT_CANCELLED == haystack::kReportCancelled,
+              "status code mismatch");
+
+struct haystack_pool {
+  haystack_pool(size_t workers, size_t capacity) : pool(workers, capacity) {}
+  // Destroyed jobs may still run on the pool until their shards are done.
+  ~haystack_pool() {
+    std::unique_lock<std::mutex> lock(mutex);
+    jobs_deleted.wait(lock, [this] { return jobs == 0; });
+  }
+  haystack::ThreadPool pool;
+  std::mutex mutex;
+  std::condition_variable jobs_deleted;
+  size_t jobs = 0;
+};
+
+namespace {
+
+// A haystack_job is a haystack::DecryptJob, which deletes itself once it was
+// released.
+haystack::DecryptJob* AsDecryptJob(haystack_job* job) {
+  return reinterpret_cast<haystack::DecryptJob*>(job);
+}
+
+haystack::ReportBatch MakeBatch(const uint8_t* payloads,
+                                const uint32_t* payload_offsets,
+                                const uint32_t* key_indices,
+                                uint32_t report_count,
+                                const uint8_t* private_keys,
+                                uint32_t key_count) {
+  haystack::ReportBatch batch;
+  batch.payloads = payloads;
+  batch.payload_offsets = payload_offsets;
+  batch.key_indices = key_indices;
+  batch.report_count = report_count;
+  batch.private_keys = private_keys;
+  batch.key_count = key_count;
+  return batch;
+}
+
+}  // namespace
+
+int32_t haystack_decrypt_reports(const uint8_t* payloads,
+                                 const uint32_t* payload_offsets,
+                                 const uint32_t* key_indices,
+                                 uint32_t report_count,
+                                 const uint8_t* private_keys,
+                                 uint32_t key_count, uint8_t* records) {
+  haystack::ReportBatch batch = MakeBatch(payloads, payload_offsets,
+                                          key_indices, report_count,
+                                          private_keys, key_count);
+  return (int32_t)haystack::DecryptReports(batch, 0, report_count, records);
+}
+
+int32_t haystack_derive_public_keys(const uint8_t* private_keys,
+                                    uint32_t key_count,
+                                    uint8_t* public_keys) {
+  return (int32_t)haystack::DerivePublicKeys(private_keys, key_count,
+                                             public_keys);
+}
+
+void haystack_sha256(const uint8_t* data, const uint32_t* offsets,
+                     uint32_t count, uint8_t* digests) {
+  std::vector<haystack::Sha256Lane> lanes(count);
+  for (uint32_t i = 0; i < count; i++) {
+    lanes[i] = {data + offsets[i], offsets[i + 1] - offsets[i],
+                digests + i * haystack::kSha256DigestBytes};
+  }
+  haystack::Sha256DigestLanes(lanes.data(), lanes.size());
+}
+
+haystack_pool* haystack_pool_create(uint32_t workers, uint32_t queue_capacity) {
+  return new haystack_pool(workers, queue_capacity);
+}
+
+uint32_t haystack_pool_worker_count(haystack_pool* pool) {
+  return (uint32_t)pool->pool.worker_count();
+}
+
+void haystack_pool_destroy(haystack_pool* pool) { delete pool; }
+
+haystack_job* haystack_job_start(haystack_pool* pool, const uint8_t* payloads,
+                                 const uint32_t* payload_offsets,
+                                 const uint32_t* key_indices,
+                                 uint32_t report_count,
+                                 const uint8_t* private_keys,
+                                 uint32_t key_count) {
+  {
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    pool->jobs++;
+  }
+  auto* job = new haystack::DecryptJob(
+      &pool->pool,
+      MakeBatch(payloads, payload_offsets, key_indices, report_count,
+                private_keys, key_count),
+      [pool] {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        pool->jobs--;
+        pool->jobs_deleted.notify_all();
+      });
+  return reinterpret_cast<haystack_job*>(job);
+}
+
+int32_t haystack_job_poll(haystack_job* job, uint32_t* indices,
+                          uint8_t* records, uint32_t capacity) {
+  return AsDecryptJob(job)->Poll(indices, records, capacity);
+}
+
+void haystack_job_wait(haystack_job* job, uint32_t timeout_ms) {
+  AsDecryptJob(job)->Wait(timeout_ms);
+}
+
+void haystack_job_cancel(haystack_job* job) { AsDecryptJob(job)->Cancel(); }
+
+void haystack_job_destroy(haystack_job* job) {
+  haystack::DecryptJob::Release(AsDecryptJob(job));
+}
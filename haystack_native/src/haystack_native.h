@@ -0,0 +1,124 @@
+#ifndef HAYSTACK_NATIVE_H_
+#define HAYSTACK_NATIVE_H_
+
+#include <stdint.h>
+
+#if _WIN32
+#define FFI_PLUGIN_EXPORT __declspec(dllexport)
+#else
+#define FFI_PLUGIN_EXPORT __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Size of one result record written by haystack_decrypt_reports:
+//   bytes 0..3   seen time, big-endian seconds since 2001-01-01 (as sent)
+//   byte  4      confidence
+//   bytes 5..14  decrypted location: latitude (4), longitude (4),
+//                accuracy (1), status (1)
+//   byte  15     one of the HAYSTACK_REPORT_* status codes below
+// Only records with HAYSTACK_REPORT_OK carry a location, the location bytes
+// of all others are zeroed.
+#define HAYSTACK_RECORD_SIZE 16
+
+#define HAYSTACK_REPORT_OK 0
+#define HAYSTACK_REPORT_MALFORMED 1
+#define HAYSTACK_REPORT_INVALID_KEY 2
+#define HAYSTACK_REPORT_INVALID_POINT 3
+#define HAYSTACK_REPORT_TAG_MISMATCH 4
+// The job of the report was cancelled before it was decrypted.
+#define HAYSTACK_REPORT_CANCELLED 5
+
+// Size of a private key as expected by haystack_decrypt_reports (big-endian,
+// left padded with zeros).
+#define HAYSTACK_PRIVATE_KEY_SIZE 28
+
+// Size of an uncompressed SEC1 public key (0x04 || X || Y) as written by
+// haystack_derive_public_keys.
+#define HAYSTACK_PUBLIC_KEY_SIZE 57
+
+// Size of a digest written by haystack_sha256.
+#define HAYSTACK_SHA256_DIGEST_SIZE 32
+
+// Decrypts |report_count| Find My location reports in one call.
+//
+// Payload i is payloads[payload_offsets[i] .. payload_offsets[i + 1]), so
+// |payload_offsets| holds report_count + 1 entries. It is decrypted with the
+// private key private_keys[key_indices[i] * HAYSTACK_PRIVATE_KEY_SIZE].
+// |records| receives HAYSTACK_RECORD_SIZE bytes per report.
+//
+// Every report is authenticated with its GCM tag before it is decrypted.
+// Returns the number of reports decrypted successfully.
+FFI_PLUGIN_EXPORT int32_t haystack_decrypt_reports(
+    const uint8_t* payloads, const uint32_t* payload_offsets,
+    const uint32_t* key_indices, uint32_t report_count,
+    const uint8_t* private_keys, uint32_t key_count, uint8_t* records);
+
+// Derives the public keys of |key_count| private keys
+// (HAYSTACK_PRIVATE_KEY_SIZE bytes each) into |public_keys|
+// (HAYSTACK_PUBLIC_KEY_SIZE bytes each). Uses precomputed tables for the
+// secp224r1 base point. Keys without a public key yield zeros.
+// Returns the number of keys derived.
+FFI_PLUGIN_EXPORT int32_t haystack_derive_public_keys(
+    const uint8_t* private_keys, uint32_t key_count, uint8_t* public_keys);
+
+// Computes the SHA-256 digests of |count| messages in one call, e.g. of
+// advertisement keys. Message i is data[offsets[i] .. offsets[i + 1]), so
+// |offsets| holds count + 1 entries. |digests| receives
+// HAYSTACK_SHA256_DIGEST_SIZE bytes per message.
+FFI_PLUGIN_EXPORT void haystack_sha256(const uint8_t* data,
+                                       const uint32_t* offsets,
+                                       uint32_t count, uint8_t* digests);
+
+// A pool of worker threads for haystack_job_start. |workers| == 0 starts one
+// worker per hardware thread. At most |queue_capacity| shards of reports are
+// queued at a time. Destroy all jobs of a pool before the pool itself, which
+// waits until the shards they were still running are done.
+typedef struct haystack_pool haystack_pool;
+FFI_PLUGIN_EXPORT haystack_pool* haystack_pool_create(uint32_t workers,
+                                                      uint32_t queue_capacity);
+FFI_PLUGIN_EXPORT uint32_t haystack_pool_worker_count(haystack_pool* pool);
+FFI_PLUGIN_EXPORT void haystack_pool_destroy(haystack_pool* pool);
+
+// Starts decrypting reports on |pool| and returns at once. The arguments are
+// the same as for haystack_decrypt_reports and are copied, so they can be
+// freed right after the call. Reports are sharded by key.
+typedef struct haystack_job haystack_job;
+FFI_PLUGIN_EXPORT haystack_job* haystack_job_start(
+    haystack_pool* pool, const uint8_t* payloads,
+    const uint32_t* payload_offsets, const uint32_t* key_indices,
+    uint32_t report_count, const uint8_t* private_keys, uint32_t key_count);
+
+// Copies up to |capacity| records of completed reports into |records|
+// (HAYSTACK_RECORD_SIZE bytes each) and their report indices into |indices|.
+// Returns the number of records copied, 0 if none are ready yet and -1 once
+// the records of all reports were returned. After haystack_job_cancel, -1 is
+// returned once the records of the reports which were queued were returned,
+// the reports skipped have the status HAYSTACK_REPORT_CANCELLED.
+FFI_PLUGIN_EXPORT int32_t haystack_job_poll(haystack_job* job,
+                                            uint32_t* indices,
+                                            uint8_t* records,
+                                            uint32_t capacity);
+
+// Blocks until records can be polled, |job| is done or cancelled, or
+// |timeout_ms| passed. Meant for a thread other than the UI thread.
+FFI_PLUGIN_EXPORT void haystack_job_wait(haystack_job* job,
+                                         uint32_t timeout_ms);
+
+// Skips the reports of |job| which were not started yet and wakes up
+// haystack_job_wait. Returns at once, |job| stays valid. May be called from
+// any thread while another one waits for or polls |job|.
+FFI_PLUGIN_EXPORT void haystack_job_cancel(haystack_job* job);
+
+// Cancels |job| and returns at once. It is freed in the background once the
+// reports it was still decrypting are done. |job| must not be used
+// afterwards.
+FFI_PLUGIN_EXPORT void haystack_job_destroy(haystack_job* job);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // HAYSTACK_NATIVE_H_
@@ -0,0 +1,129 @@
+#include "key_generator.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "public_keys.h"
+
+namespace haystack {
+
+namespace {
+
+// Order of the secp224r1 group, big-endian. Private keys must lie in
+// [1, n - 1].
+const uint8_t kGroupOrder[kPrivateKeyBytes] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0x16, 0xa2, 0xe0, 0xb8, 0xf0, 0x3e,
+    0x13, 0xdd, 0x29, 0x45, 0x5c, 0x5c, 0x2a, 0x3d};
+
+const char kBase64Alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Number of leading base64 characters of a hashed key which must not be '/'.
+constexpr size_t kCheckedIdChars = 7;
+
+}  // namespace
+
+bool FillRandom(uint8_t* out, size_t len) {
+#if defined(__APPLE__)
+  arc4random_buf(out, len);
+  return true;
+#else
+  FILE* urandom = std::fopen("/dev/urandom", "rb");
+  if (urandom == nullptr) {
+    return false;
+  }
+  bool ok = std::fread(out, 1, len, urandom) == len;
+  std::fclose(urandom);
+  return ok;
+#endif
+}
+
+std::string Base64Encode(const uint8_t* data, size_t len) {
+  std::string out;
+  out.reserve((len + 2) / 3 * 4);
+  for (size_t i = 0; i < len; i += 3) {
+    uint32_t group = (uint32_t)data[i] << 16;
+    if (i + 1 < len) group |= (uint32_t)data[i + 1] << 8;
+    if (i + 2 < len) group |= data[i + 2];
+    out += kBase64Alphabet[group >> 18];
+    out += kBase64Alphabet[(group >> 12) & 63];
+    out += i + 1 < len ? kBase64Alphabet[(group >> 6) & 63] : '=';
+    out += i + 2 < len ? kBase64Alphabet[group & 63] : '=';
+  }
+  return out;
+}
+
+bool IsUsableHashedKey(const uint8_t hashed_key[kSha256DigestBytes]) {
+  // 7 characters are encoded by the first 6 bytes.
+  std::string id = Base64Encode(hashed_key, 6);
+  return id.find('/') >= kCheckedIdChars;
+}
+
+std::string DeviceJson(const std::string& name, uint32_t id,
+                       const AccessoryKey* keys, size_t count) {
+  std::string additional_keys;
+  for (size_t i = 0; i + 1 < count; i++) {
+    if (i > 0) {
+      additional_keys += ",";
+    }
+    additional_keys +=
+        "\"" + Base64Encode(keys[i].private_key, kPrivateKeyBytes) + "\"";
+  }
+  return "{\"id\": " + std::to_string(id) +
+         ",\"colorComponents\": [    0,    1,    0,    1],\"name\": \"" +
+         name + "\",\"privateKey\": \"" +
+         Base64Encode(keys[count - 1].private_key, kPrivateKeyBytes) +
+         "\",\"icon\": \"\",\"isActive\": true,\"additionalKeys\": [" +
+         additional_keys + "]}";
+}
+
+long GenerateAccessoryKeys(size_t count, AccessoryKey* keys) {
+  std::vector<uint8_t> private_keys;
+  std::vector<uint8_t> public_keys;
+  std::vector<uint8_t> digests;
+  std::vector<Sha256Lane> lanes;
+  long rejected = 0;
+  size_t generated = 0;
+
+  // Derive and hash all missing keys at once; usually only a few candidates
+  // have to be replaced in the next round.
+  while (generated < count) {
+    size_t n = count - generated;
+    private_keys.resize(n * kPrivateKeyBytes);
+    public_keys.resize(n * kPublicKeyBytes);
+    digests.resize(n * kSha256DigestBytes);
+    lanes.resize(n);
+    if (!FillRandom(private_keys.data(), private_keys.size())) {
+      return -1;
+    }
+    DerivePublicKeys(private_keys.data(), n, public_keys.data());
+    for (size_t i = 0; i < n; i++) {
+      lanes[i] = {public_keys.data() + i * kPublicKeyBytes + 1,
+                  p224::kFieldBytes, digests.data() + i * kSha256DigestBytes};
+    }
+    Sha256DigestLanes(lanes.data(), n);
+
+    for (size_t i = 0; i < n; i++) {
+      const uint8_t* private_key = private_keys.data() + i * kPrivateKeyBytes;
+      const uint8_t* public_key = public_keys.data() + i * kPublicKeyBytes;
+      const uint8_t* digest = digests.data() + i * kSha256DigestBytes;
+      // Zero or out of range keys have no public key of their own.
+      if (public_key[0] != 0x04 ||
+          std::memcmp(private_key, kGroupOrder, kPrivateKeyBytes) >= 0 ||
+          !IsUsableHashedKey(digest)) {
+        rejected++;
+        continue;
+      }
+      AccessoryKey& key = keys[generated++];
+      std::memcpy(key.private_key, private_key, kPrivateKeyBytes);
+      std::memcpy(key.advertisement_key, public_key + 1, p224::kFieldBytes);
+      std::memcpy(key.hashed_key, digest, kSha256DigestBytes);
+    }
+  }
+  return rejected;
+}
+
+}  // namespace haystack
@@ -0,0 +1,48 @@
+#ifndef HAYSTACK_NATIVE_KEY_GENERATOR_H_
+#define HAYSTACK_NATIVE_KEY_GENERATOR_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "p224.h"
+#include "report_decryptor.h"
+#include "sha256.h"
+
+namespace haystack {
+
+// A key pair of an accessory as provisioned by generate_keys: the private key,
+// the advertisement key (x coordinate of the public key) sent by the
+// accessory and the SHA-256 of the advertisement key, which is its id.
+struct AccessoryKey {
+  uint8_t private_key[kPrivateKeyBytes];
+  uint8_t advertisement_key[p224::kFieldBytes];
+  uint8_t hashed_key[kSha256DigestBytes];
+};
+
+// Fills |out| with |len| bytes from the CSPRNG of the operating system.
+// Returns false if it is not available.
+bool FillRandom(uint8_t* out, size_t len);
+
+// Standard base64 with padding.
+std::string Base64Encode(const uint8_t* data, size_t len);
+
+// Returns true if the base64 of |hashed_key| has no '/' in its first 7
+// characters. Ids with a '/' there break the lookup in the app and endpoint.
+bool IsUsableHashedKey(const uint8_t hashed_key[kSha256DigestBytes]);
+
+// The entry of an accessory in _devices.json exactly as written by
+// generate_keys.py, for import into the app. The last of the |count| keys is
+// the leading one, all others are additional keys.
+std::string DeviceJson(const std::string& name, uint32_t id,
+                       const AccessoryKey* keys, size_t count);
+
+// Generates |count| random key pairs with usable hashed keys into |keys|.
+// Candidates are derived in batches with the fixed-base tables and replaced
+// until enough of them are usable. Returns the number of rejected
+// candidates, or -1 if no random bytes were available.
+long GenerateAccessoryKeys(size_t count, AccessoryKey* keys);
+
+}  // namespace haystack
+
+#endif  // HAYSTACK_NATIVE_KEY_GENERATOR_H_
@@ -0,0 +1,445 @@
+#include "p224.h"
+
+#include <cstring>
+#include <vector>
+
+namespace haystack {
+namespace p224 {
+
+namespace {
+
+using u128 = unsigned __int128;
+
+// Curve constants. Everything except kP and kRR is in Montgomery form.
+constexpr FieldElement kP = {{0x0000000000000001ULL, 0xffffffff00000000ULL,
+                              0xffffffffffffffffULL, 0x00000000ffffffffULL}};
+constexpr FieldElement kRR = {{0xffffffff00000001ULL, 0xffffffff00000000ULL,
+                               0xfffffffe00000000ULL, 0x00000000ffffffffULL}};
+constexpr FieldElement kOne = {{0xffffffff00000000ULL, 0xffffffffffffffffULL,
+                                0x0000000000000000ULL, 0x0000000000000000ULL}};
+constexpr FieldElement kB = {{0xe768cdf663c059cdULL, 0x107ac2f3ccf01310ULL,
+                              0x3dceba98c8528151ULL, 0x000000007fc02f93ULL}};
+constexpr AffinePoint kG = {
+    {{0xbc9052266d0a4aeaULL, 0x852597366018bfaaULL, 0x6dd3af9bf96bec05ULL,
+      0x00000000a21b5e60ULL}},
+    {{0x2edca1e5eff3ede8ULL, 0xf8cd672b05335a6bULL, 0xaea9c5ae03dfe878ULL,
+      0x00000000614786f1ULL}}};
+
+// The fixed-base comb splits a scalar into kCombTeeth rows of kCombSpacing
+// bits. Column i of the scalar (bits i, i + 28, ..., i + 196) selects one
+// entry of each of the two 4 tooth tables.
+constexpr size_t kCombSpacing = 28;
+constexpr size_t kCombTeeth = 8;
+
+bool IsZero(const FieldElement& a) {
+  return (a.v[0] | a.v[1] | a.v[2] | a.v[3]) == 0;
+}
+
+bool Equal(const FieldElement& a, const FieldElement& b) {
+  return ((a.v[0] ^ b.v[0]) | (a.v[1] ^ b.v[1]) | (a.v[2] ^ b.v[2]) |
+          (a.v[3] ^ b.v[3])) == 0;
+}
+
+// r = a - p if a >= p, else a. |carry| is the bit above the top limb.
+void ReduceOnce(uint64_t carry, FieldElement* r) {
+  uint64_t t[4];
+  uint64_t borrow = 0;
+  for (int i = 0; i < 4; i++) {
+    u128 d = (u128)r->v[i] - kP.v[i] - borrow;
+    t[i] = (uint64_t)d;
+    borrow = (uint64_t)(d >> 64) & 1;
+  }
+  // Keep the subtraction unless it underflowed without a carry to absorb it.
+  uint64_t keep = (uint64_t)0 - ((borrow ^ 1) | carry);
+  for (int i = 0; i < 4; i++) {
+    r->v[i] = (t[i] & keep) | (r->v[i] & ~keep);
+  }
+}
+
+void Add(const FieldElement& a, const FieldElement& b, FieldElement* r) {
+  uint64_t carry = 0;
+  for (int i = 0; i < 4; i++) {
+    u128 s = (u128)a.v[i] + b.v[i] + carry;
+    r->v[i] = (uint64_t)s;
+    carry = (uint64_t)(s >> 64);
+  }
+  ReduceOnce(carry, r);
+}
+
+void Sub(const FieldElement& a, const FieldElement& b, FieldElement* r) {
+  uint64_t borrow = 0;
+  for (int i = 0; i < 4; i++) {
+    u128 d = (u128)a.v[i] - b.v[i] - borrow;
+    r->v[i] = (uint64_t)d;
+    borrow = (uint64_t)(d >> 64) & 1;
+  }
+  // Add p back if the subtraction underflowed.
+  uint64_t mask = (uint64_t)0 - borrow;
+  uint64_t carry = 0;
+  for (int i = 0; i < 4; i++) {
+    u128 s = (u128)r->v[i] + (kP.v[i] & mask) + carry;
+    r->v[i] = (uint64_t)s;
+    carry = (uint64_t)(s >> 64);
+  }
+}
+
+// Montgomery multiplication (CIOS). Since p = 1 mod 2^64 the per-word
+// reduction factor is simply -t[0].
+void Mul(const FieldElement& a, const FieldElement& b, FieldElement* r) {
+  uint64_t t[6] = {0, 0, 0, 0, 0, 0};
+  for (int i = 0; i < 4; i++) {
+    uint64_t c = 0;
+    for (int j = 0; j < 4; j++) {
+      u128 s = (u128)a.v[j] * b.v[i] + t[j] + c;
+      t[j] = (uint64_t)s;
+      c = (uint64_t)(s >> 64);
+    }
+    u128 s = (u128)t[4] + c;
+    t[4] = (uint64_t)s;
+    t[5] = (uint64_t)(s >> 64);
+
+    uint64_t m = (uint64_t)0 - t[0];
+    s = (u128)m * kP.v[0] + t[0];
+    c = (uint64_t)(s >> 64);
+    for (int j = 1; j < 4; j++) {
+      s = (u128)m * kP.v[j] + t[j] + c;
+      t[j - 1] = (uint64_t)s;
+      c = (uint64_t)(s >> 64);
+    }
+    s = (u128)t[4] + c;
+    t[3] = (uint64_t)s;
+    t[4] = t[5] + (uint64_t)(s >> 64);
+  }
+  std::memcpy(r->v, t, sizeof(r->v));
+  ReduceOnce(t[4], r);
+}
+
+void Sqr(const FieldElement& a, FieldElement* r) { Mul(a, a, r); }
+
+// r = a^(p-2) = a^-1. The exponent is 2^224 - 2^96 - 1, i.e. 127 ones,
+// a zero and 96 ones.
+void Invert(const FieldElement& a, FieldElement* r) {
+  FieldElement acc = a;
+  for (int i = 1; i < 127; i++) {
+    Sqr(acc, &acc);
+    Mul(acc, a, &acc);
+  }
+  Sqr(acc, &acc);
+  for (int i = 0; i < 96; i++) {
+    Sqr(acc, &acc);
+    Mul(acc, a, &acc);
+  }
+  *r = acc;
+}
+
+void ToMontgomery(const FieldElement& a, FieldElement* r) { Mul(a, kRR, r); }
+
+void FromMontgomery(const FieldElement& a, FieldElement* r) {
+  constexpr FieldElement kRawOne = {{1, 0, 0, 0}};
+  Mul(a, kRawOne, r);
+}
+
+// Parses a 28 byte big-endian value. Returns false if it is not below p.
+bool FromBytes(const uint8_t in[kFieldBytes], FieldElement* r) {
+  FieldElement raw = {{0, 0, 0, 0}};
+  for (size_t i = 0; i < kFieldBytes; i++) {
+    size_t bit = 8 * (kFieldBytes - 1 - i);
+    raw.v[bit / 64] |= (uint64_t)in[i] << (bit % 64);
+  }
+  FieldElement reduced = raw;
+  ReduceOnce(0, &reduced);
+  if (!Equal(reduced, raw)) {
+    return false;
+  }
+  ToMontgomery(raw, r);
+  return true;
+}
+
+void ToBytes(const FieldElement& a, uint8_t out[kFieldBytes]) {
+  FieldElement raw;
+  FromMontgomery(a, &raw);
+  for (size_t i = 0; i < kFieldBytes; i++) {
+    size_t bit = 8 * (kFieldBytes - 1 - i);
+    out[i] = (uint8_t)(raw.v[bit / 64] >> (bit % 64));
+  }
+}
+
+// dbl-2001-b for a = -3.
+void Double(const JacobianPoint& p, JacobianPoint* r) {
+  FieldElement delta, gamma, beta, alpha, t0, t1;
+  Sqr(p.z, &delta);
+  Sqr(p.y, &gamma);
+  Mul(p.x, gamma, &beta);
+  Sub(p.x, delta, &t0);
+  Add(p.x, delta, &t1);
+  Mul(t0, t1, &alpha);
+  Add(alpha, alpha, &t0);
+  Add(alpha, t0, &alpha);
+
+  // z3 = (y + z)^2 - gamma - delta
+  Add(p.y, p.z, &t0);
+  Sqr(t0, &t0);
+  Sub(t0, gamma, &t0);
+  Sub(t0, delta, &r->z);
+
+  // x3 = alpha^2 - 8 * beta
+  Add(beta, beta, &beta);
+  Add(beta, beta, &beta);
+  Add(beta, beta, &t1);
+  Sqr(alpha, &t0);
+  Sub(t0, t1, &r->x);
+
+  // y3 = alpha * (4 * beta - x3) - 8 * gamma^2
+  Sub(beta, r->x, &t0);
+  Mul(alpha, t0, &t0);
+  Sqr(gamma, &t1);
+  Add(t1, t1, &t1);
+  Add(t1, t1, &t1);
+  Add(t1, t1, &t1);
+  Sub(t0, t1, &r->y);
+}
+
+// add-2007-bl with the exceptional cases handled explicitly.
+void AddPoints(const JacobianPoint& p, const JacobianPoint& q,
+               JacobianPoint* r) {
+  if (IsZero(p.z)) {
+    *r = q;
+    return;
+  }
+  if (IsZero(q.z)) {
+    *r = p;
+    return;
+  }
+  FieldElement z1z1, z2z2, u1, u2, s1, s2, h, i, j, rr, v, t0;
+  Sqr(p.z, &z1z1);
+  Sqr(q.z, &z2z2);
+  Mul(p.x, z2z2, &u1);
+  Mul(q.x, z1z1, &u2);
+  Mul(p.y, q.z, &s1);
+  Mul(s1, z2z2, &s1);
+  Mul(q.y, p.z, &s2);
+  Mul(s2, z1z1, &s2);
+  Sub(u2, u1, &h);
+  Sub(s2, s1, &rr);
+  if (IsZero(h)) {
+    if (IsZero(rr)) {
+      Double(p, r);
+    } else {
+      *r = JacobianPoint{kOne, kOne, {{0, 0, 0, 0}}};
+    }
+    return;
+  }
+  Add(rr, rr, &rr);
+  Add(h, h, &i);
+  Sqr(i, &i);
+  Mul(h, i, &j);
+  Mul(u1, i, &v);
+
+  // z3 = ((z1 + z2)^2 - z1z1 - z2z2) * h
+  Add(p.z, q.z, &t0);
+  Sqr(t0, &t0);
+  Sub(t0, z1z1, &t0);
+  Sub(t0, z2z2, &t0);
+  Mul(t0, h, &r->z);
+
+  // x3 = r^2 - j - 2 * v
+  Sqr(rr, &t0);
+  Sub(t0, j, &t0);
+  Sub(t0, v, &t0);
+  Sub(t0, v, &r->x);
+
+  // y3 = r * (v - x3) - 2 * s1 * j
+  Sub(v, r->x, &t0);
+  Mul(rr, t0, &t0);
+  Mul(s1, j, &s1);
+  Add(s1, s1, &s1);
+  Sub(t0, s1, &r->y);
+}
+
+// Copies table[index] into |out| without a secret dependent memory access.
+void SelectPoint(const JacobianPoint* table, size_t size, uint32_t index,
+                 JacobianPoint* out) {
+  std::memset(out, 0, sizeof(*out));
+  for (size_t i = 0; i < size; i++) {
+    uint64_t mask = (uint64_t)0 - (uint64_t)(i == index);
+    const uint64_t* src = reinterpret_cast<const uint64_t*>(&table[i]);
+    uint64_t* dst = reinterpret_cast<uint64_t*>(out);
+    for (size_t w = 0; w < sizeof(JacobianPoint) / sizeof(uint64_t); w++) {
+      dst[w] |= src[w] & mask;
+    }
+  }
+}
+
+// tables[t][j] = sum of 2^(28 * (4 * t + k)) * G over the bits k set in j,
+// with z = 1 so additions stay cheap. tables[t][0] is the point at infinity.
+struct CombTables {
+  JacobianPoint tables[kCombTeeth / 4][16];
+};
+
+CombTables MakeCombTables() {
+  // rows[k] = 2^(28 * k) * G
+  JacobianPoint rows[kCombTeeth];
+  rows[0] = JacobianPoint{kG.x, kG.y, kOne};
+  for (size_t k = 1; k < kCombTeeth; k++) {
+    rows[k] = rows[k - 1];
+    for (size_t d = 0; d < kCombSpacing; d++) {
+      Double(rows[k], &rows[k]);
+    }
+  }
+
+  JacobianPoint sums[kCombTeeth / 4][16];
+  for (size_t t = 0; t < kCombTeeth / 4; t++) {
+    sums[t][0] = JacobianPoint{kOne, kOne, {{0, 0, 0, 0}}};
+    for (size_t j = 1; j < 16; j++) {
+      size_t low = 0;
+      while (((j >> low) & 1) == 0) {
+        low++;
+      }
+      AddPoints(sums[t][j & (j - 1)], rows[4 * t + low], &sums[t][j]);
+    }
+  }
+
+  AffinePoint affine[kCombTeeth / 4 * 16];
+  bool ok[kCombTeeth / 4 * 16];
+  BatchToAffine(&sums[0][0], kCombTeeth / 4 * 16, affine, ok);
+  CombTables comb;
+  for (size_t t = 0; t < kCombTeeth / 4; t++) {
+    comb.tables[t][0] = sums[t][0];
+    for (size_t j = 1; j < 16; j++) {
+      comb.tables[t][j] =
+          JacobianPoint{affine[16 * t + j].x, affine[16 * t + j].y, kOne};
+    }
+  }
+  return comb;
+}
+
+}  // namespace
+
+bool DecodePoint(const uint8_t in[kUncompressedPointBytes], AffinePoint* out) {
+  if (in[0] != 0x04) {
+    return false;
+  }
+  if (!FromBytes(in + 1, &out->x) || !FromBytes(in + 1 + kFieldBytes, &out->y)) {
+    return false;
+  }
+  // y^2 == x^3 - 3x + b
+  FieldElement lhs, rhs, t;
+  Sqr(out->y, &lhs);
+  Sqr(out->x, &rhs);
+  Mul(rhs, out->x, &rhs);
+  Add(out->x, out->x, &t);
+  Add(t, out->x, &t);
+  Sub(rhs, t, &rhs);
+  Add(rhs, kB, &rhs);
+  return Equal(lhs, rhs);
+}
+
+bool LoadScalar(const uint8_t* in, size_t len, uint8_t out[kScalarBytes]) {
+  if (len > kScalarBytes) {
+    return false;
+  }
+  std::memset(out, 0, kScalarBytes - len);
+  std::memcpy(out + kScalarBytes - len, in, len);
+  return true;
+}
+
+void ScalarMult(const uint8_t scalar[kScalarBytes], const AffinePoint& point,
+                JacobianPoint* out) {
+  // Fixed 4 bit window: table[i] = i * point.
+  JacobianPoint table[16];
+  table[0] = JacobianPoint{kOne, kOne, {{0, 0, 0, 0}}};
+  table[1] = JacobianPoint{point.x, point.y, kOne};
+  for (int i = 2; i < 16; i++) {
+    if (i % 2 == 0) {
+      Double(table[i / 2], &table[i]);
+    } else {
+      AddPoints(table[i - 1], table[1], &table[i]);
+    }
+  }
+
+  JacobianPoint acc = table[0];
+  JacobianPoint selected;
+  for (size_t i = 0; i < 2 * kScalarBytes; i++) {
+    if (i != 0) {
+      for (int d = 0; d < 4; d++) {
+        Double(acc, &acc);
+      }
+    }
+    uint8_t byte = scalar[i / 2];
+    uint32_t nibble = (i % 2 == 0) ? (byte >> 4) : (byte & 0x0f);
+    SelectPoint(table, 16, nibble, &selected);
+    AddPoints(acc, selected, &acc);
+  }
+  *out = acc;
+}
+
+void BaseMult(const uint8_t scalar[kScalarBytes], JacobianPoint* out) {
+  // Built on first use, thread safe as a function local static.
+  static const CombTables comb = MakeCombTables();
+
+  JacobianPoint acc = JacobianPoint{kOne, kOne, {{0, 0, 0, 0}}};
+  JacobianPoint selected;
+  for (size_t i = kCombSpacing; i-- > 0;) {
+    Double(acc, &acc);
+    for (size_t t = 0; t < kCombTeeth / 4; t++) {
+      uint32_t index = 0;
+      for (size_t k = 0; k < 4; k++) {
+        size_t bit = i + kCombSpacing * (4 * t + k);
+        uint32_t value = (scalar[kScalarBytes - 1 - bit / 8] >> (bit % 8)) & 1;
+        index |= value << k;
+      }
+      SelectPoint(comb.tables[t], 16, index, &selected);
+      AddPoints(acc, selected, &acc);
+    }
+  }
+  *out = acc;
+}
+
+void BatchToAffine(const JacobianPoint* in, size_t count, AffinePoint* out,
+                   bool* ok) {
+  if (count == 0) {
+    return;
+  }
+  // prefix[i] = z_0 * ... * z_i, skipping points at infinity.
+  std::vector<FieldElement> prefix(count);
+  FieldElement acc = kOne;
+  for (size_t i = 0; i < count; i++) {
+    ok[i] = !IsZero(in[i].z);
+    if (ok[i]) {
+      Mul(acc, in[i].z, &acc);
+    }
+    prefix[i] = acc;
+  }
+  FieldElement inv;
+  Invert(acc, &inv);
+  for (size_t i = count; i-- > 0;) {
+    if (!ok[i]) {
+      continue;
+    }
+    FieldElement z_inv, z_inv2, z_inv3;
+    if (i > 0) {
+      Mul(inv, prefix[i - 1], &z_inv);
+    } else {
+      z_inv = inv;
+    }
+    Mul(inv, in[i].z, &inv);
+    Sqr(z_inv, &z_inv2);
+    Mul(z_inv2, z_inv, &z_inv3);
+    Mul(in[i].x, z_inv2, &out[i].x);
+    Mul(in[i].y, z_inv3, &out[i].y);
+  }
+}
+
+void EncodeX(const AffinePoint& point, uint8_t out[kFieldBytes]) {
+  ToBytes(point.x, out);
+}
+
+void EncodePoint(const AffinePoint& point,
+                 uint8_t out[kUncompressedPointBytes]) {
+  out[0] = 0x04;
+  ToBytes(point.x, out + 1);
+  ToBytes(point.y, out + 1 + kFieldBytes);
+}
+
+}  // namespace p224
+}  // namespace haystack
@@ -0,0 +1,67 @@
+#ifndef HAYSTACK_NATIVE_P224_H_
+#define HAYSTACK_NATIVE_P224_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace haystack {
+namespace p224 {
+
+// Sizes of the big-endian encodings used by the Find My protocol.
+constexpr size_t kScalarBytes = 28;
+constexpr size_t kFieldBytes = 28;
+constexpr size_t kUncompressedPointBytes = 1 + 2 * kFieldBytes;
+
+// An element of GF(p), p = 2^224 - 2^96 + 1, kept in Montgomery form
+// (R = 2^256) as four little-endian 64 bit limbs.
+struct FieldElement {
+  uint64_t v[4];
+};
+
+// A point in Jacobian coordinates. The point at infinity has z == 0.
+struct JacobianPoint {
+  FieldElement x;
+  FieldElement y;
+  FieldElement z;
+};
+
+// A point in affine coordinates. Never the point at infinity.
+struct AffinePoint {
+  FieldElement x;
+  FieldElement y;
+};
+
+// Decodes an uncompressed SEC1 point (0x04 || X || Y) and checks that it lies
+// on the curve.
+bool DecodePoint(const uint8_t in[kUncompressedPointBytes], AffinePoint* out);
+
+// Loads a big-endian scalar of up to |len| <= 28 bytes, left padding it with
+// zeros the same way a BigInt private key would be interpreted.
+bool LoadScalar(const uint8_t* in, size_t len, uint8_t out[kScalarBytes]);
+
+// Computes |scalar| * |point| and leaves the result in Jacobian coordinates so
+// callers can share a single field inversion across many results.
+void ScalarMult(const uint8_t scalar[kScalarBytes], const AffinePoint& point,
+                JacobianPoint* out);
+
+// Computes |scalar| * G for the curve's base point G using precomputed comb
+// tables. Same result as ScalarMult with G, but without the per call table
+// and with a quarter of the doublings.
+void BaseMult(const uint8_t scalar[kScalarBytes], JacobianPoint* out);
+
+// Converts |count| Jacobian points to affine coordinates using one inversion
+// (Montgomery's trick). |ok[i]| is cleared for points at infinity.
+void BatchToAffine(const JacobianPoint* in, size_t count, AffinePoint* out,
+                   bool* ok);
+
+// Writes the big-endian encoding of the affine x coordinate.
+void EncodeX(const AffinePoint& point, uint8_t out[kFieldBytes]);
+
+// Writes the uncompressed SEC1 encoding of |point|.
+void EncodePoint(const AffinePoint& point,
+                 uint8_t out[kUncompressedPointBytes]);
+
+}  // namespace p224
+}  // namespace haystack
+
+#endif  // HAYSTACK_NATIVE_P224_H_
@@ -0,0 +1,42 @@
+#include "public_keys.h"
+
+#include <cstring>
+
+namespace haystack {
+
+namespace {
+
+// Number of public keys converted to affine coordinates with a single field
+// inversion.
+constexpr size_t kChunkSize = 64;
+
+}  // namespace
+
+size_t DerivePublicKeys(const uint8_t* private_keys, size_t count,
+                        uint8_t* public_keys) {
+  p224::JacobianPoint points[kChunkSize];
+  p224::AffinePoint affine[kChunkSize];
+  bool valid[kChunkSize];
+  size_t derived = 0;
+
+  for (size_t chunk = 0; chunk < count; chunk += kChunkSize) {
+    size_t n = count - chunk < kChunkSize ? count - chunk : kChunkSize;
+    for (size_t j = 0; j < n; j++) {
+      p224::BaseMult(private_keys + (chunk + j) * p224::kScalarBytes,
+                     &points[j]);
+    }
+    p224::BatchToAffine(points, n, affine, valid);
+    for (size_t j = 0; j < n; j++) {
+      uint8_t* out = public_keys + (chunk + j) * kPublicKeyBytes;
+      if (!valid[j]) {
+        std::memset(out, 0, kPublicKeyBytes);
+        continue;
+      }
+      p224::EncodePoint(affine[j], out);
+      derived++;
+    }
+  }
+  return derived;
+}
+
+}  // namespace haystack
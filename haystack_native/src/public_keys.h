@@ -0,0 +1,22 @@
+#ifndef HAYSTACK_NATIVE_PUBLIC_KEYS_H_
+#define HAYSTACK_NATIVE_PUBLIC_KEYS_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "p224.h"
+
+namespace haystack {
+
+constexpr size_t kPublicKeyBytes = p224::kUncompressedPointBytes;
+
+// Derives the uncompressed public keys of |count| 28 byte big-endian private
+// keys into |public_keys| (kPublicKeyBytes each). Keys which are zero modulo
+// the group order have no public key, their output is zeroed. Returns the
+// number of keys derived.
+size_t DerivePublicKeys(const uint8_t* private_keys, size_t count,
+                        uint8_t* public_keys);
+
+}  // namespace haystack
+
+#endif  // HAYSTACK_NATIVE_PUBLIC_KEYS_H_
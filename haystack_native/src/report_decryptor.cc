@@ -0,0 +1,126 @@
+#include "report_decryptor.h"
+
+#include <cstring>
+
+#include "aes_gcm.h"
+#include "p224.h"
+#include "sha256.h"
+
+namespace haystack {
+
+namespace {
+
+// Number of reports whose shared secrets are converted to affine coordinates
+// with a single field inversion.
+constexpr size_t kChunkSize = 64;
+
+}  // namespace
+
+void BuildKdfInput(const p224::AffinePoint& shared,
+                   const uint8_t* ephemeral_key, uint8_t out[kKdfInputBytes]) {
+  static const uint8_t kCounter[4] = {0, 0, 0, 1};
+  p224::EncodeX(shared, out);
+  std::memcpy(out + p224::kFieldBytes, kCounter, sizeof(kCounter));
+  std::memcpy(out + p224::kFieldBytes + sizeof(kCounter), ephemeral_key,
+              p224::kUncompressedPointBytes);
+}
+
+size_t DecryptReports(const ReportBatch& batch, size_t begin, size_t end,
+                      uint8_t* records) {
+  p224::JacobianPoint shared[kChunkSize];
+  p224::AffinePoint shared_affine[kChunkSize];
+  bool valid[kChunkSize];
+  const uint8_t* ephemeral_keys[kChunkSize];
+  const uint8_t* ciphertexts[kChunkSize];
+  const uint8_t* tags[kChunkSize];
+  size_t tag_lengths[kChunkSize];
+  uint8_t kdf_inputs[kChunkSize][kKdfInputBytes];
+  uint8_t derived_keys[kChunkSize][kSha256DigestBytes];
+  Sha256Lane kdf_lanes[kChunkSize];
+  GcmLane lanes[kChunkSize];
+  size_t decrypted = 0;
+
+  for (size_t chunk = begin; chunk < end; chunk += kChunkSize) {
+    size_t n = end - chunk < kChunkSize ? end - chunk : kChunkSize;
+
+    for (size_t j = 0; j < n; j++) {
+      size_t i = chunk + j;
+      uint8_t* record = records + i * kRecordBytes;
+      std::memset(record, 0, kRecordBytes);
+      std::memset(&shared[j], 0, sizeof(shared[j]));
+
+      const uint8_t* payload = batch.payloads + batch.payload_offsets[i];
+      size_t len = batch.payload_offsets[i + 1] - batch.payload_offsets[i];
+      // Payloads longer than 88 bytes carry an extra byte at index 4.
+      size_t shift = len > kPayloadBytes ? 1 : 0;
+      if (len - shift < kTagOffset) {
+        record[kRecordStatusOffset] = kReportMalformed;
+        continue;
+      }
+      std::memcpy(record, payload, 4);
+      record[4] = payload[4 + shift];
+      ephemeral_keys[j] = payload + kEphemeralKeyOffset + shift;
+      ciphertexts[j] = payload + kCiphertextOffset + shift;
+      tags[j] = payload + kTagOffset + shift;
+      tag_lengths[j] = len - shift - kTagOffset;
+
+      uint32_t key_index = batch.key_indices[i];
+      if (key_index >= batch.key_count) {
+        record[kRecordStatusOffset] = kReportInvalidKey;
+        continue;
+      }
+      p224::AffinePoint ephemeral;
+      if (!p224::DecodePoint(ephemeral_keys[j], &ephemeral)) {
+        record[kRecordStatusOffset] = kReportInvalidPoint;
+        continue;
+      }
+      p224::ScalarMult(batch.private_keys + key_index * kPrivateKeyBytes,
+                       ephemeral, &shared[j]);
+    }
+
+    p224::BatchToAffine(shared, n, shared_affine, valid);
+
+    // Derive the symmetric keys of the chunk with one multi-buffer hash, then
+    // decrypt all locations in one go so the GCM kernel can interleave them.
+    size_t lane_count = 0;
+    for (size_t j = 0; j < n; j++) {
+      uint8_t* record = records + (chunk + j) * kRecordBytes;
+      if (record[kRecordStatusOffset] != kReportOk) {
+        continue;
+      }
+      if (!valid[j]) {
+        record[kRecordStatusOffset] = kReportInvalidPoint;
+        continue;
+      }
+      uint8_t* derived = derived_keys[lane_count];
+      BuildKdfInput(shared_affine[j], ephemeral_keys[j],
+                    kdf_inputs[lane_count]);
+      kdf_lanes[lane_count] = {kdf_inputs[lane_count], kKdfInputBytes,
+                               derived};
+      GcmLane& lane = lanes[lane_count++];
+      lane.key = derived;
+      lane.iv = derived + kAesKeyBytes;
+      lane.ciphertext = ciphertexts[j];
+      lane.len = kCiphertextBytes;
+      lane.tag = tags[j];
+      lane.tag_len = tag_lengths[j];
+      lane.plaintext = record + kRecordPlaintextOffset;
+    }
+    Sha256DigestLanes(kdf_lanes, lane_count);
+    Aes128GcmDecryptLanes(lanes, lane_count);
+
+    // Reports failing authentication never reach the caller's decoding.
+    for (size_t l = 0; l < lane_count; l++) {
+      if (lanes[l].authentic) {
+        decrypted++;
+        continue;
+      }
+      uint8_t* record = lanes[l].plaintext - kRecordPlaintextOffset;
+      std::memset(lanes[l].plaintext, 0, kCiphertextBytes);
+      record[kRecordStatusOffset] = kReportTagMismatch;
+    }
+  }
+  return decrypted;
+}
+
+}  // namespace haystack
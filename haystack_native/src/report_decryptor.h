@@ -0,0 +1,69 @@
+#ifndef HAYSTACK_NATIVE_REPORT_DECRYPTOR_H_
+#define HAYSTACK_NATIVE_REPORT_DECRYPTOR_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "p224.h"
+
+namespace haystack {
+
+// Layout of an encrypted Find My report (after dropping the extra byte of
+// 89 byte payloads): seen time (4), confidence (1), ephemeral key (57),
+// encrypted location (10), tag (rest).
+constexpr size_t kPayloadBytes = 88;
+constexpr size_t kEphemeralKeyOffset = 5;
+constexpr size_t kCiphertextOffset = 62;
+constexpr size_t kCiphertextBytes = 10;
+constexpr size_t kTagOffset = kCiphertextOffset + kCiphertextBytes;
+constexpr size_t kPrivateKeyBytes = 28;
+
+// Every decrypted report is written as a fixed size record: the seen time and
+// confidence exactly as in the payload (bytes 0..4), the decrypted location
+// (bytes 5..14) and a ReportStatus (byte 15).
+constexpr size_t kRecordBytes = 16;
+constexpr size_t kRecordPlaintextOffset = 5;
+constexpr size_t kRecordStatusOffset = 15;
+
+enum ReportStatus : uint8_t {
+  kReportOk = 0,
+  kReportMalformed = 1,
+  kReportInvalidKey = 2,
+  kReportInvalidPoint = 3,
+  // The GCM tag did not match: the report is corrupt or belongs to a
+  // different key.
+  kReportTagMismatch = 4,
+  // The report was not decrypted, because its DecryptJob was cancelled.
+  kReportCancelled = 5,
+};
+
+// A batch of reports in flat buffers. Payload i is
+// payloads[payload_offsets[i] .. payload_offsets[i + 1]) and is decrypted with
+// the 28 byte big-endian private key number key_indices[i].
+struct ReportBatch {
+  const uint8_t* payloads;
+  const uint32_t* payload_offsets;
+  const uint32_t* key_indices;
+  size_t report_count;
+  const uint8_t* private_keys;
+  size_t key_count;
+};
+
+// Input of the ANSI X9.63 KDF with SHA-256, one round:
+// SHA256(secret || 00000001 || ephemeral key). The first 16 bytes of the
+// digest are the AES key, the last 16 the IV.
+constexpr size_t kKdfInputBytes =
+    p224::kFieldBytes + 4 + p224::kUncompressedPointBytes;
+
+void BuildKdfInput(const p224::AffinePoint& shared,
+                   const uint8_t* ephemeral_key, uint8_t out[kKdfInputBytes]);
+
+// Decrypts reports [begin, end) of |batch| into |records|, which holds
+// kRecordBytes per report of the whole batch. Returns the number of reports
+// decrypted successfully.
+size_t DecryptReports(const ReportBatch& batch, size_t begin, size_t end,
+                      uint8_t* records);
+
+}  // namespace haystack
+
+#endif  // HAYSTACK_NATIVE_REPORT_DECRYPTOR_H_
@@ -0,0 +1,66 @@
+#include "report_encryptor.h"
+
+#include <cstring>
+
+#include "aes_gcm.h"
+#include "sha256.h"
+
+namespace haystack {
+
+namespace {
+
+void StoreBigEndian(uint32_t value, uint8_t* out) {
+  out[0] = (uint8_t)(value >> 24);
+  out[1] = (uint8_t)(value >> 16);
+  out[2] = (uint8_t)(value >> 8);
+  out[3] = (uint8_t)value;
+}
+
+}  // namespace
+
+bool EncryptReport(const uint8_t public_key[kPublicKeyBytes],
+                   const uint8_t ephemeral_scalar[p224::kScalarBytes],
+                   uint32_t seen_time, uint8_t confidence,
+                   const Location& location, bool extended, uint8_t* payload) {
+  p224::AffinePoint accessory;
+  if (!p224::DecodePoint(public_key, &accessory)) {
+    return false;
+  }
+  // The ephemeral public key and the shared secret, converted together.
+  p224::JacobianPoint points[2];
+  p224::AffinePoint affine[2];
+  bool valid[2];
+  p224::BaseMult(ephemeral_scalar, &points[0]);
+  p224::ScalarMult(ephemeral_scalar, accessory, &points[1]);
+  p224::BatchToAffine(points, 2, affine, valid);
+  if (!valid[0] || !valid[1]) {
+    return false;
+  }
+
+  size_t shift = extended ? 1 : 0;
+  StoreBigEndian(seen_time, payload);
+  if (extended) {
+    payload[4] = 0;
+  }
+  payload[4 + shift] = confidence;
+  uint8_t* ephemeral_key = payload + kEphemeralKeyOffset + shift;
+  p224::EncodePoint(affine[0], ephemeral_key);
+
+  uint8_t kdf_input[kKdfInputBytes];
+  uint8_t derived[kSha256DigestBytes];
+  BuildKdfInput(affine[1], ephemeral_key, kdf_input);
+  Sha256Digest(kdf_input, sizeof(kdf_input), derived);
+
+  uint8_t plaintext[kCiphertextBytes];
+  StoreBigEndian(location.latitude, plaintext);
+  StoreBigEndian(location.longitude, plaintext + 4);
+  plaintext[8] = location.accuracy;
+  plaintext[9] = location.status;
+  Aes128GcmEncrypt(derived, derived + kAesKeyBytes,
+                   kSha256DigestBytes - kAesKeyBytes, plaintext,
+                   kCiphertextBytes, payload + kCiphertextOffset + shift,
+                   payload + kTagOffset + shift);
+  return true;
+}
+
+}  // namespace haystack
@@ -0,0 +1,37 @@
+#ifndef HAYSTACK_NATIVE_REPORT_ENCRYPTOR_H_
+#define HAYSTACK_NATIVE_REPORT_ENCRYPTOR_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "public_keys.h"
+#include "report_decryptor.h"
+
+namespace haystack {
+
+// Size of the payload variant with an extra byte at index 4, which decoders
+// skip.
+constexpr size_t kExtendedPayloadBytes = kPayloadBytes + 1;
+
+// The plaintext of a report: latitude and longitude in units of 1e-7 degrees,
+// big-endian, followed by the accuracy and the status byte.
+struct Location {
+  uint32_t latitude;
+  uint32_t longitude;
+  uint8_t accuracy;
+  uint8_t status;
+};
+
+// Encrypts |location| for the accessory with the uncompressed |public_key| the
+// way a finder device does, with the ephemeral key |ephemeral_scalar| * G.
+// Writes kPayloadBytes to |payload|, or kExtendedPayloadBytes if |extended|.
+// Used to create test and benchmark reports. Returns false if the public key
+// or the ephemeral scalar is invalid.
+bool EncryptReport(const uint8_t public_key[kPublicKeyBytes],
+                   const uint8_t ephemeral_scalar[p224::kScalarBytes],
+                   uint32_t seen_time, uint8_t confidence,
+                   const Location& location, bool extended, uint8_t* payload);
+
+}  // namespace haystack
+
+#endif  // HAYSTACK_NATIVE_REPORT_ENCRYPTOR_H_
@@ -0,0 +1,200 @@
+#include "sha256.h"
+
+#include <cstring>
+
+#if defined(HAYSTACK_HAVE_SHA_X86)
+#include <cpuid.h>
+#endif
+
+namespace haystack {
+
+const uint32_t kSha256InitialState[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                                         0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                         0x1f83d9ab, 0x5be0cd19};
+
+const uint32_t kSha256RoundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+namespace {
+
+inline uint32_t Rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+void Compress(uint32_t state[8], const uint8_t block[64]) {
+  uint32_t w[64];
+  for (int i = 0; i < 16; i++) {
+    w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 |
+           (uint32_t)block[4 * i + 2] << 8 | (uint32_t)block[4 * i + 3];
+  }
+  for (int i = 16; i < 64; i++) {
+    uint32_t s0 = Rotr(w[i - 15], 7) ^ Rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = Rotr(w[i - 2], 17) ^ Rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+  uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+  for (int i = 0; i < 64; i++) {
+    uint32_t s1 = Rotr(e, 6) ^ Rotr(e, 11) ^ Rotr(e, 25);
+    uint32_t ch = (e & f) ^ (~e & g);
+    uint32_t t1 = h + s1 + ch + kSha256RoundConstants[i] + w[i];
+    uint32_t s0 = Rotr(a, 2) ^ Rotr(a, 13) ^ Rotr(a, 22);
+    uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+    uint32_t t2 = s0 + maj;
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+}
+
+}  // namespace
+
+Sha256::Sha256() : buffered_(0), total_(0) {
+  std::memcpy(state_, kSha256InitialState, sizeof(state_));
+}
+
+void Sha256::Update(const uint8_t* data, size_t len) {
+  total_ += len;
+  if (buffered_ > 0) {
+    size_t take = 64 - buffered_;
+    if (take > len) {
+      take = len;
+    }
+    std::memcpy(buffer_ + buffered_, data, take);
+    buffered_ += take;
+    data += take;
+    len -= take;
+    if (buffered_ < 64) {
+      return;
+    }
+    Compress(state_, buffer_);
+    buffered_ = 0;
+  }
+  while (len >= 64) {
+    Compress(state_, data);
+    data += 64;
+    len -= 64;
+  }
+  std::memcpy(buffer_, data, len);
+  buffered_ = len;
+}
+
+void Sha256::Final(uint8_t out[kSha256DigestBytes]) {
+  uint64_t bits = total_ * 8;
+  uint8_t pad[72] = {0x80};
+  size_t pad_len = (buffered_ < 56) ? 56 - buffered_ : 120 - buffered_;
+  for (int i = 0; i < 8; i++) {
+    pad[pad_len + i] = (uint8_t)(bits >> (56 - 8 * i));
+  }
+  Update(pad, pad_len + 8);
+  for (int i = 0; i < 8; i++) {
+    out[4 * i] = (uint8_t)(state_[i] >> 24);
+    out[4 * i + 1] = (uint8_t)(state_[i] >> 16);
+    out[4 * i + 2] = (uint8_t)(state_[i] >> 8);
+    out[4 * i + 3] = (uint8_t)state_[i];
+  }
+}
+
+void Sha256Digest(const uint8_t* data, size_t len,
+                  uint8_t out[kSha256DigestBytes]) {
+  Sha256 sha;
+  sha.Update(data, len);
+  sha.Final(out);
+}
+
+void Sha256Blocks::Reset(const uint8_t* data, size_t len) {
+  data_ = data;
+  full_ = len / 64;
+  count_ = (len + 8) / 64 + 1;
+  size_t rest = len - 64 * full_;
+  size_t tail_len = 64 * (count_ - full_);
+  std::memset(tail_, 0, tail_len);
+  std::memcpy(tail_, data + 64 * full_, rest);
+  tail_[rest] = 0x80;
+  uint64_t bits = (uint64_t)len * 8;
+  for (int i = 0; i < 8; i++) {
+    tail_[tail_len - 1 - i] = (uint8_t)(bits >> (8 * i));
+  }
+}
+
+void Sha256DigestLanesPortable(const Sha256Lane* lanes, size_t count) {
+  for (size_t l = 0; l < count; l++) {
+    Sha256Blocks blocks(lanes[l].data, lanes[l].len);
+    uint32_t state[8];
+    std::memcpy(state, kSha256InitialState, sizeof(state));
+    for (size_t b = 0; b < blocks.count(); b++) {
+      Compress(state, blocks.block(b));
+    }
+    for (int i = 0; i < 8; i++) {
+      lanes[l].digest[4 * i] = (uint8_t)(state[i] >> 24);
+      lanes[l].digest[4 * i + 1] = (uint8_t)(state[i] >> 16);
+      lanes[l].digest[4 * i + 2] = (uint8_t)(state[i] >> 8);
+      lanes[l].digest[4 * i + 3] = (uint8_t)state[i];
+    }
+  }
+}
+
+bool Avx2Available() {
+#if defined(HAYSTACK_HAVE_SHA_X86)
+  static const bool available = __builtin_cpu_supports("avx2");
+  return available;
+#else
+  return false;
+#endif
+}
+
+bool ShaNiAvailable() {
+#if defined(HAYSTACK_HAVE_SHA_X86)
+  static const bool available = [] {
+    unsigned int eax, ebx, ecx, edx;
+    // CPUID leaf 7, EBX bit 29.
+    return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) &&
+           (ebx & (1u << 29)) != 0 && __builtin_cpu_supports("sse4.1");
+  }();
+  return available;
+#else
+  return false;
+#endif
+}
+
+void Sha256DigestLanes(const Sha256Lane* lanes, size_t count) {
+#if defined(HAYSTACK_HAVE_SHA_X86)
+  // Eight AVX2 lanes outrun one SHA-NI stream, so only the messages which do
+  // not fill all eight lanes go through SHA-NI.
+  if (Avx2Available()) {
+    size_t full = ShaNiAvailable() ? count - count % 8 : count;
+    Sha256DigestLanesAvx2(lanes, full);
+    lanes += full;
+    count -= full;
+  }
+  if (ShaNiAvailable()) {
+    Sha256DigestLanesShaNi(lanes, count);
+    return;
+  }
+#endif
+  Sha256DigestLanesPortable(lanes, count);
+}
+
+}  // namespace haystack
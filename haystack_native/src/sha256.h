@@ -0,0 +1,81 @@
+#ifndef HAYSTACK_NATIVE_SHA256_H_
+#define HAYSTACK_NATIVE_SHA256_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace haystack {
+
+constexpr size_t kSha256DigestBytes = 32;
+
+// Incremental SHA-256.
+class Sha256 {
+ public:
+  Sha256();
+
+  void Update(const uint8_t* data, size_t len);
+  void Final(uint8_t out[kSha256DigestBytes]);
+
+ private:
+  uint32_t state_[8];
+  uint8_t buffer_[64];
+  size_t buffered_;
+  uint64_t total_;
+};
+
+// One-shot SHA-256 of |len| bytes.
+void Sha256Digest(const uint8_t* data, size_t len,
+                  uint8_t out[kSha256DigestBytes]);
+
+// One message of a multi-buffer hash.
+struct Sha256Lane {
+  const uint8_t* data;
+  size_t len;
+  uint8_t* digest;
+};
+
+// Hashes |count| independent messages with the fastest kernel the CPU
+// supports.
+void Sha256DigestLanes(const Sha256Lane* lanes, size_t count);
+
+// The kernels behind Sha256DigestLanes, exposed for tests and benchmarks.
+void Sha256DigestLanesPortable(const Sha256Lane* lanes, size_t count);
+#if defined(HAYSTACK_HAVE_SHA_X86)
+// Runs 8 messages side by side in AVX2 registers. Must only be called if
+// Avx2Available() returns true.
+void Sha256DigestLanesAvx2(const Sha256Lane* lanes, size_t count);
+// Uses the SHA extensions. Must only be called if ShaNiAvailable() returns
+// true.
+void Sha256DigestLanesShaNi(const Sha256Lane* lanes, size_t count);
+#endif
+bool Avx2Available();
+bool ShaNiAvailable();
+
+// The padded 64 byte blocks of a message. Full blocks are read in place, the
+// last one or two are padded in a small buffer.
+class Sha256Blocks {
+ public:
+  Sha256Blocks() = default;
+  Sha256Blocks(const uint8_t* data, size_t len) { Reset(data, len); }
+
+  void Reset(const uint8_t* data, size_t len);
+
+  size_t count() const { return count_; }
+  const uint8_t* block(size_t i) const {
+    return i < full_ ? data_ + 64 * i : tail_ + 64 * (i - full_);
+  }
+
+ private:
+  const uint8_t* data_;
+  size_t full_;
+  size_t count_;
+  uint8_t tail_[128];
+};
+
+// Constants shared with the SIMD kernels.
+extern const uint32_t kSha256InitialState[8];
+extern const uint32_t kSha256RoundConstants[64];
+
+}  // namespace haystack
+
+#endif  // HAYSTACK_NATIVE_SHA256_H_
@@ -0,0 +1,221 @@
+// SHA-256 of many short independent messages (advertisement keys, KDF
+// inputs). With the SHA extensions every message runs through the dedicated
+// round instructions; on CPUs with AVX2 only, eight messages share the 32 bit
+// lanes of the vector registers and are hashed round by round.
+//
+// Compiled with -mavx2 -msha -msse4.1 -mssse3, see CMakeLists.txt.
+
+#include "sha256.h"
+
+#include <immintrin.h>
+
+#include <cstring>
+
+namespace haystack {
+
+namespace {
+
+constexpr size_t kLanes = 8;
+
+inline uint32_t LoadBigEndian(const uint8_t* p) {
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 |
+         (uint32_t)p[3];
+}
+
+inline void StoreDigest(const uint32_t state[8], uint8_t* out) {
+  for (int i = 0; i < 8; i++) {
+    out[4 * i] = (uint8_t)(state[i] >> 24);
+    out[4 * i + 1] = (uint8_t)(state[i] >> 16);
+    out[4 * i + 2] = (uint8_t)(state[i] >> 8);
+    out[4 * i + 3] = (uint8_t)state[i];
+  }
+}
+
+inline __m256i Rotr(__m256i x, int n) {
+  return _mm256_or_si256(_mm256_srli_epi32(x, n),
+                         _mm256_slli_epi32(x, 32 - n));
+}
+
+// One compression of eight lanes. |w| holds the first 16 message words with
+// lane l in the 32 bit element l.
+void CompressLanes(__m256i state[8], __m256i w[16]) {
+  __m256i a = state[0], b = state[1], c = state[2], d = state[3];
+  __m256i e = state[4], f = state[5], g = state[6], h = state[7];
+  for (int i = 0; i < 64; i++) {
+    __m256i wi;
+    if (i < 16) {
+      wi = w[i];
+    } else {
+      __m256i w15 = w[(i - 15) & 15];
+      __m256i w2 = w[(i - 2) & 15];
+      __m256i s0 =
+          _mm256_xor_si256(_mm256_xor_si256(Rotr(w15, 7), Rotr(w15, 18)),
+                           _mm256_srli_epi32(w15, 3));
+      __m256i s1 =
+          _mm256_xor_si256(_mm256_xor_si256(Rotr(w2, 17), Rotr(w2, 19)),
+                           _mm256_srli_epi32(w2, 10));
+      wi = _mm256_add_epi32(_mm256_add_epi32(w[i & 15], s0),
+                            _mm256_add_epi32(w[(i - 7) & 15], s1));
+      w[i & 15] = wi;
+    }
+    __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(Rotr(e, 6), Rotr(e, 11)),
+                                  Rotr(e, 25));
+    __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f),
+                                  _mm256_andnot_si256(e, g));
+    __m256i t1 = _mm256_add_epi32(
+        _mm256_add_epi32(h, s1),
+        _mm256_add_epi32(
+            ch, _mm256_add_epi32(
+                    _mm256_set1_epi32((int)kSha256RoundConstants[i]), wi)));
+    __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(Rotr(a, 2), Rotr(a, 13)),
+                                  Rotr(a, 22));
+    __m256i maj = _mm256_xor_si256(
+        _mm256_xor_si256(_mm256_and_si256(a, b), _mm256_and_si256(a, c)),
+        _mm256_and_si256(b, c));
+    h = g;
+    g = f;
+    f = e;
+    e = _mm256_add_epi32(d, t1);
+    d = c;
+    c = b;
+    b = a;
+    a = _mm256_add_epi32(t1, _mm256_add_epi32(s0, maj));
+  }
+  state[0] = _mm256_add_epi32(state[0], a);
+  state[1] = _mm256_add_epi32(state[1], b);
+  state[2] = _mm256_add_epi32(state[2], c);
+  state[3] = _mm256_add_epi32(state[3], d);
+  state[4] = _mm256_add_epi32(state[4], e);
+  state[5] = _mm256_add_epi32(state[5], f);
+  state[6] = _mm256_add_epi32(state[6], g);
+  state[7] = _mm256_add_epi32(state[7], h);
+}
+
+// Hashes one message with the SHA extensions, following the layout of the
+// Intel SHA extensions white paper: the state is kept as ABEF and CDGH.
+void DigestShaNi(const Sha256Lane& lane) {
+  const __m128i shuffle =
+      _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  __m128i state0 = _mm_loadu_si128(
+      reinterpret_cast<const __m128i*>(&kSha256InitialState[0]));
+  __m128i state1 = _mm_loadu_si128(
+      reinterpret_cast<const __m128i*>(&kSha256InitialState[4]));
+  __m128i tmp = _mm_shuffle_epi32(state0, 0xb1);     // CDAB
+  state1 = _mm_shuffle_epi32(state1, 0x1b);          // EFGH
+  state0 = _mm_alignr_epi8(tmp, state1, 8);          // ABEF
+  state1 = _mm_blend_epi16(state1, tmp, 0xf0);       // CDGH
+
+  Sha256Blocks blocks(lane.data, lane.len);
+  for (size_t b = 0; b < blocks.count(); b++) {
+    const __m128i* block = reinterpret_cast<const __m128i*>(blocks.block(b));
+    __m128i abef = state0;
+    __m128i cdgh = state1;
+    __m128i w[4];
+    for (int i = 0; i < 16; i++) {
+      if (i < 4) {
+        w[i] = _mm_shuffle_epi8(_mm_loadu_si128(block + i), shuffle);
+      } else {
+        // W[4i .. 4i + 3] from the previous 16 words.
+        __m128i t = _mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]);
+        t = _mm_add_epi32(t,
+                          _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4));
+        w[i & 3] = _mm_sha256msg2_epu32(t, w[(i + 3) & 3]);
+      }
+      __m128i msg = _mm_add_epi32(
+          w[i & 3], _mm_loadu_si128(reinterpret_cast<const __m128i*>(
+                        &kSha256RoundConstants[4 * i])));
+      state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+      state0 = _mm_sha256rnds2_epu32(state0, state1,
+                                     _mm_shuffle_epi32(msg, 0x0e));
+    }
+    state0 = _mm_add_epi32(state0, abef);
+    state1 = _mm_add_epi32(state1, cdgh);
+  }
+
+  tmp = _mm_shuffle_epi32(state0, 0x1b);             // FEBA
+  state1 = _mm_shuffle_epi32(state1, 0xb1);          // DCHG
+  state0 = _mm_blend_epi16(tmp, state1, 0xf0);       // DCBA
+  state1 = _mm_alignr_epi8(state1, tmp, 8);          // HGFE
+  uint32_t state[8];
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[0]), state0);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[4]), state1);
+  StoreDigest(state, lane.digest);
+}
+
+}  // namespace
+
+void Sha256DigestLanesAvx2(const Sha256Lane* lanes, size_t count) {
+  static const uint8_t kZeroBlock[64] = {0};
+
+  for (size_t base = 0; base < count; base += kLanes) {
+    const Sha256Lane* lane = lanes + base;
+    size_t n = count - base < kLanes ? count - base : kLanes;
+
+    // Messages of different lengths are hashed together. Once a lane has run
+    // out of blocks it hashes zeros and its state is masked from updates.
+    Sha256Blocks blocks[kLanes];
+    size_t max_blocks = 0;
+    int32_t block_counts[kLanes] = {0};
+    for (size_t l = 0; l < n; l++) {
+      blocks[l].Reset(lane[l].data, lane[l].len);
+      block_counts[l] = (int32_t)blocks[l].count();
+      if (blocks[l].count() > max_blocks) {
+        max_blocks = blocks[l].count();
+      }
+    }
+    const __m256i counts = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(block_counts));
+
+    __m256i state[8];
+    for (int i = 0; i < 8; i++) {
+      state[i] = _mm256_set1_epi32((int)kSha256InitialState[i]);
+    }
+    for (size_t b = 0; b < max_blocks; b++) {
+      const uint8_t* data[kLanes];
+      for (size_t l = 0; l < kLanes; l++) {
+        data[l] = l < n && b < blocks[l].count() ? blocks[l].block(b)
+                                                 : kZeroBlock;
+      }
+      __m256i w[16];
+      for (int i = 0; i < 16; i++) {
+        w[i] = _mm256_setr_epi32(
+            (int)LoadBigEndian(data[0] + 4 * i),
+            (int)LoadBigEndian(data[1] + 4 * i),
+            (int)LoadBigEndian(data[2] + 4 * i),
+            (int)LoadBigEndian(data[3] + 4 * i),
+            (int)LoadBigEndian(data[4] + 4 * i),
+            (int)LoadBigEndian(data[5] + 4 * i),
+            (int)LoadBigEndian(data[6] + 4 * i),
+            (int)LoadBigEndian(data[7] + 4 * i));
+      }
+      __m256i previous[8];
+      std::memcpy(previous, state, sizeof(state));
+      CompressLanes(state, w);
+      // Keep the new state only in lanes which still had block b.
+      __m256i active = _mm256_cmpgt_epi32(counts, _mm256_set1_epi32((int)b));
+      for (int i = 0; i < 8; i++) {
+        state[i] = _mm256_blendv_epi8(previous[i], state[i], active);
+      }
+    }
+
+    alignas(32) uint32_t words[8][kLanes];
+    for (int i = 0; i < 8; i++) {
+      _mm256_store_si256(reinterpret_cast<__m256i*>(words[i]), state[i]);
+    }
+    for (size_t l = 0; l < n; l++) {
+      uint32_t digest[8];
+      for (int i = 0; i < 8; i++) {
+        digest[i] = words[i][l];
+      }
+      StoreDigest(digest, lane[l].digest);
+    }
+  }
+}
+
+void Sha256DigestLanesShaNi(const Sha256Lane* lanes, size_t count) {
+  for (size_t l = 0; l < count; l++) {
+    DigestShaNi(lanes[l]);
+  }
+}
+
+}  // namespace haystack
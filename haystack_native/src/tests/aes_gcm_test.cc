@@ -0,0 +1,145 @@
+// Checks the GCM tag verification and that the runtime selected multi-lane
+// kernel agrees with the portable implementation.
+
+#include "aes_gcm.h"
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+
+#define EXPECT(cond)                                                  \
+  do {                                                                \
+    if (!(cond)) {                                                    \
+      std::fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+      failures++;                                                     \
+    }                                                                 \
+  } while (0)
+
+struct LaneData {
+  uint8_t key[haystack::kAesKeyBytes];
+  uint8_t iv[haystack::kGcmLaneIvBytes];
+  uint8_t ciphertext[haystack::kAesBlockBytes];
+  size_t len;
+  uint8_t tag[haystack::kAesBlockBytes];
+  size_t tag_len;
+};
+
+std::vector<haystack::GcmLane> MakeLanes(std::vector<LaneData>& data,
+                                         std::vector<uint8_t>& out) {
+  out.assign(data.size() * haystack::kAesBlockBytes, 0);
+  std::vector<haystack::GcmLane> lanes(data.size());
+  for (size_t i = 0; i < data.size(); i++) {
+    lanes[i].key = data[i].key;
+    lanes[i].iv = data[i].iv;
+    lanes[i].ciphertext = data[i].ciphertext;
+    lanes[i].len = data[i].len;
+    lanes[i].tag = data[i].tag;
+    lanes[i].tag_len = data[i].tag_len;
+    lanes[i].plaintext = out.data() + i * haystack::kAesBlockBytes;
+  }
+  return lanes;
+}
+
+void TestNistVector() {
+  // NIST GCM test case 2: zero key, zero 96 bit IV, one zero block.
+  const uint8_t key[16] = {0};
+  const uint8_t iv[12] = {0};
+  const uint8_t ciphertext[16] = {0x03, 0x88, 0xda, 0xce, 0x60, 0xb6,
+                                  0xa3, 0x92, 0xf3, 0x28, 0xc2, 0xb9,
+                                  0x71, 0xb2, 0xfe, 0x78};
+  uint8_t tag[16] = {0xab, 0x6e, 0x47, 0xd4, 0x2c, 0xec, 0x13, 0xbd,
+                     0xf5, 0x3a, 0x67, 0xb2, 0x12, 0x57, 0xbd, 0xdf};
+  uint8_t plaintext[16];
+  const uint8_t zero[16] = {0};
+  EXPECT(haystack::Aes128GcmDecrypt(key, iv, sizeof(iv), ciphertext, 16, tag,
+                                    16, plaintext));
+  EXPECT(std::memcmp(plaintext, zero, 16) == 0);
+  EXPECT(haystack::Aes128GcmDecrypt(key, iv, sizeof(iv), ciphertext, 16, tag,
+                                    12, plaintext));
+  uint8_t encrypted[16];
+  uint8_t encrypted_tag[16];
+  haystack::Aes128GcmEncrypt(key, iv, sizeof(iv), zero, 16, encrypted,
+                             encrypted_tag);
+  EXPECT(std::memcmp(encrypted, ciphertext, 16) == 0);
+  EXPECT(std::memcmp(encrypted_tag, tag, 16) == 0);
+  tag[15] ^= 0x80;
+  EXPECT(!haystack::Aes128GcmDecrypt(key, iv, sizeof(iv), ciphertext, 16, tag,
+                                     16, plaintext));
+  EXPECT(!haystack::Aes128GcmDecrypt(key, iv, sizeof(iv), ciphertext, 16, tag,
+                                     0, plaintext));
+}
+
+void TestLaneVector() {
+  // 16 byte IV and a 10 byte ciphertext like a Find My report.
+  LaneData lane = {
+      {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b,
+       0x0c, 0x0d, 0x0e, 0x0f},
+      {0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b,
+       0x1c, 0x1d, 0x1e, 0x1f},
+      {0xf5, 0xaf, 0xc5, 0x85, 0x49, 0x87, 0x12, 0xbf, 0xee, 0x21},
+      10,
+      {0x7c, 0x4d, 0xce, 0x49, 0xc6, 0x4e, 0x1e, 0xde, 0xa3, 0xf1, 0x96, 0x3b,
+       0xee, 0xcb, 0xe7, 0x53},
+      16};
+  std::vector<LaneData> data(9, lane);
+  data[3].tag[0] ^= 0x01;
+  data[8].ciphertext[9] ^= 0x01;
+  for (int kernel = 0; kernel < 2; kernel++) {
+    std::vector<uint8_t> out;
+    auto lanes = MakeLanes(data, out);
+    if (kernel == 0) {
+      haystack::Aes128GcmDecryptLanesPortable(lanes.data(), lanes.size());
+    } else {
+      haystack::Aes128GcmDecryptLanes(lanes.data(), lanes.size());
+    }
+    for (size_t i = 0; i < lanes.size(); i++) {
+      EXPECT(lanes[i].authentic == (i != 3 && i != 8));
+    }
+    EXPECT(std::memcmp(out.data(), "0123456789", 10) == 0);
+  }
+}
+
+void TestKernelsAgree() {
+  std::mt19937 rng(224);
+  // Lane counts around the interleave width exercise the partial batches.
+  for (size_t count : {1, 7, 8, 9, 17, 64}) {
+    std::vector<LaneData> data(count);
+    for (size_t i = 0; i < count; i++) {
+      for (auto& b : data[i].key) b = (uint8_t)rng();
+      for (auto& b : data[i].iv) b = (uint8_t)rng();
+      for (auto& b : data[i].ciphertext) b = (uint8_t)rng();
+      data[i].len = 1 + rng() % haystack::kAesBlockBytes;
+      for (auto& b : data[i].tag) b = (uint8_t)rng();
+      data[i].tag_len = 4 + rng() % 13;
+    }
+    std::vector<uint8_t> expected, actual;
+    auto portable = MakeLanes(data, expected);
+    haystack::Aes128GcmDecryptLanesPortable(portable.data(), count);
+    auto selected = MakeLanes(data, actual);
+    haystack::Aes128GcmDecryptLanes(selected.data(), count);
+    EXPECT(expected == actual);
+    for (size_t i = 0; i < count; i++) {
+      EXPECT(portable[i].authentic == selected[i].authentic);
+    }
+  }
+}
+
+}  // namespace
+
+int main() {
+  TestNistVector();
+  TestLaneVector();
+  TestKernelsAgree();
+  std::printf("AES-NI kernel %s\n",
+              haystack::AesNiAvailable() ? "used" : "not available");
+  if (failures != 0) {
+    std::fprintf(stderr, "%d check(s) failed\n", failures);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,88 @@
+// Checks keyfile validation, the marker search and the size checks of the
+// firmware patcher.
+
+#include "firmware_patcher.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+
+#define EXPECT(cond)                                                  \
+  do {                                                                \
+    if (!(cond)) {                                                    \
+      std::fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+      failures++;                                                     \
+    }                                                                 \
+  } while (0)
+
+// A firmware image with the marker at |offset| followed by room for
+// |max_keys| keys and some non-zero data.
+std::vector<uint8_t> Firmware(size_t offset, size_t max_keys) {
+  std::vector<uint8_t> firmware(offset, 0x5a);
+  firmware.insert(firmware.end(), haystack::kKeyMarker,
+                  haystack::kKeyMarker + haystack::kKeyMarkerBytes);
+  firmware.resize(offset + max_keys * haystack::kAdvertisementKeyBytes, 0);
+  firmware.insert(firmware.end(), 64, 0xa5);
+  return firmware;
+}
+
+void TestKeyfileKeyCount() {
+  std::vector<uint8_t> keyfile(1 + 3 * 28, 0x11);
+  keyfile[0] = 3;
+  EXPECT(haystack::KeyfileKeyCount(keyfile.data(), keyfile.size()) == 3);
+  EXPECT(haystack::KeyfileKeyCount(keyfile.data(), keyfile.size() - 1) == 0);
+  keyfile[0] = 0;
+  EXPECT(haystack::KeyfileKeyCount(keyfile.data(), 1) == 0);
+  EXPECT(haystack::KeyfileKeyCount(keyfile.data(), 0) == 0);
+}
+
+void TestFindKeyMarker() {
+  std::vector<uint8_t> firmware = Firmware(1000, 50);
+  size_t offset = 0;
+  EXPECT(haystack::FindKeyMarker(firmware.data(), firmware.size(), &offset));
+  EXPECT(offset == 1000);
+
+  // A second marker makes the offset ambiguous.
+  std::vector<uint8_t> twice = firmware;
+  twice.insert(twice.end(), haystack::kKeyMarker,
+               haystack::kKeyMarker + haystack::kKeyMarkerBytes);
+  EXPECT(!haystack::FindKeyMarker(twice.data(), twice.size(), &offset));
+  // A truncated marker is no marker.
+  EXPECT(!haystack::FindKeyMarker(firmware.data(), 1000 + 27, &offset));
+}
+
+void TestKeysFit() {
+  std::vector<uint8_t> firmware = Firmware(100, 50);
+  EXPECT(haystack::KeysFit(firmware.data(), firmware.size(), 100, 1));
+  EXPECT(haystack::KeysFit(firmware.data(), firmware.size(), 100, 50));
+  EXPECT(!haystack::KeysFit(firmware.data(), firmware.size(), 100, 51));
+  EXPECT(!haystack::KeysFit(firmware.data(), firmware.size(), 100, 0));
+  // Without data after the key array, the image itself is the limit.
+  EXPECT(!haystack::KeysFit(firmware.data(), firmware.size() - 64, 100, 51));
+}
+
+void TestEsp32KeyPartitionImageBytes() {
+  EXPECT(haystack::Esp32KeyPartitionImageBytes(1 + 28) == 0x1000);
+  EXPECT(haystack::Esp32KeyPartitionImageBytes(0x1000) == 0x1000);
+  EXPECT(haystack::Esp32KeyPartitionImageBytes(0x1001) == 0x2000);
+  EXPECT(haystack::Esp32KeyPartitionImageBytes(0x100000) == 0x100000);
+  EXPECT(haystack::Esp32KeyPartitionImageBytes(0x100001) == 0);
+}
+
+}  // namespace
+
+int main() {
+  TestKeyfileKeyCount();
+  TestFindKeyMarker();
+  TestKeysFit();
+  TestEsp32KeyPartitionImageBytes();
+  if (failures != 0) {
+    std::fprintf(stderr, "%d check(s) failed\n", failures);
+    return 1;
+  }
+  return 0;
+}
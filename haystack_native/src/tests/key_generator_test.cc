@@ -0,0 +1,97 @@
+// Checks the key generator: base64 encoding, the hashed key rule of
+// generate_keys.py and the consistency of generated key pairs.
+
+#include "key_generator.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "public_keys.h"
+
+namespace {
+
+int failures = 0;
+
+#define EXPECT(cond)                                                  \
+  do {                                                                \
+    if (!(cond)) {                                                    \
+      std::fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+      failures++;                                                     \
+    }                                                                 \
+  } while (0)
+
+std::string Encode(const char* text) {
+  return haystack::Base64Encode(reinterpret_cast<const uint8_t*>(text),
+                                std::strlen(text));
+}
+
+void TestBase64() {
+  // RFC 4648 test vectors.
+  EXPECT(Encode("") == "");
+  EXPECT(Encode("f") == "Zg==");
+  EXPECT(Encode("fo") == "Zm8=");
+  EXPECT(Encode("foo") == "Zm9v");
+  EXPECT(Encode("foob") == "Zm9vYg==");
+  EXPECT(Encode("fooba") == "Zm9vYmE=");
+  EXPECT(Encode("foobar") == "Zm9vYmFy");
+  const uint8_t high[3] = {0xfb, 0xff, 0xbf};
+  EXPECT(haystack::Base64Encode(high, 3) == "+/+/");
+}
+
+void TestUsableHashedKey() {
+  uint8_t digest[haystack::kSha256DigestBytes] = {0};
+  EXPECT(haystack::IsUsableHashedKey(digest));
+  // The 7th character is made of the low 4 bits of byte 4 and the high 2
+  // bits of byte 5, the 8th of the low 6 bits of byte 5.
+  digest[4] = 0x0f;
+  digest[5] = 0xc0;
+  EXPECT(!haystack::IsUsableHashedKey(digest));
+  digest[4] = 0;
+  digest[5] = 0x3f;
+  EXPECT(haystack::IsUsableHashedKey(digest));
+  digest[0] = 0xfc;
+  EXPECT(!haystack::IsUsableHashedKey(digest));
+}
+
+void TestGeneratedKeys() {
+  const size_t kCount = 200;
+  std::vector<haystack::AccessoryKey> keys(kCount);
+  EXPECT(haystack::GenerateAccessoryKeys(kCount, keys.data()) >= 0);
+
+  std::vector<uint8_t> private_keys;
+  for (const haystack::AccessoryKey& key : keys) {
+    private_keys.insert(private_keys.end(), key.private_key,
+                        key.private_key + sizeof(key.private_key));
+  }
+  std::vector<uint8_t> public_keys(kCount * haystack::kPublicKeyBytes);
+  EXPECT(haystack::DerivePublicKeys(private_keys.data(), kCount,
+                                    public_keys.data()) == kCount);
+  for (size_t i = 0; i < kCount; i++) {
+    const haystack::AccessoryKey& key = keys[i];
+    EXPECT(std::memcmp(key.advertisement_key,
+                       public_keys.data() + i * haystack::kPublicKeyBytes + 1,
+                       sizeof(key.advertisement_key)) == 0);
+    uint8_t digest[haystack::kSha256DigestBytes];
+    haystack::Sha256Digest(key.advertisement_key,
+                           sizeof(key.advertisement_key), digest);
+    EXPECT(std::memcmp(key.hashed_key, digest, sizeof(digest)) == 0);
+    EXPECT(haystack::Base64Encode(digest, sizeof(digest)).find('/') >= 7);
+  }
+  EXPECT(std::memcmp(keys[0].private_key, keys[1].private_key,
+                     haystack::kPrivateKeyBytes) != 0);
+}
+
+}  // namespace
+
+int main() {
+  TestBase64();
+  TestUsableHashedKey();
+  TestGeneratedKeys();
+  if (failures != 0) {
+    std::fprintf(stderr, "%d check(s) failed\n", failures);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,135 @@
+// Checks the fixed-base comb multiplication against the generic scalar
+// multiplication and public keys produced with the Python cryptography
+// package.
+
+#include "p224.h"
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "public_keys.h"
+
+namespace {
+
+int failures = 0;
+
+#define EXPECT(cond)                                                  \
+  do {                                                                \
+    if (!(cond)) {                                                    \
+      std::fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+      failures++;                                                     \
+    }                                                                 \
+  } while (0)
+
+struct Vector {
+  uint8_t private_key[28];
+  uint8_t public_key[57];
+};
+
+// Private keys 1, a random key and n - 1.
+const Vector kVectors[] = {
+    {{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01},
+     {0x04, 0xb7, 0x0e, 0x0c, 0xbd, 0x6b, 0xb4, 0xbf, 0x7f, 0x32, 0x13,
+      0x90, 0xb9, 0x4a, 0x03, 0xc1, 0xd3, 0x56, 0xc2, 0x11, 0x22, 0x34,
+      0x32, 0x80, 0xd6, 0x11, 0x5c, 0x1d, 0x21, 0xbd, 0x37, 0x63, 0x88,
+      0xb5, 0xf7, 0x23, 0xfb, 0x4c, 0x22, 0xdf, 0xe6, 0xcd, 0x43, 0x75,
+      0xa0, 0x5a, 0x07, 0x47, 0x64, 0x44, 0xd5, 0x81, 0x99, 0x85, 0x00,
+      0x7e, 0x34}},
+    {{0x41, 0x4c, 0x34, 0x3c, 0x10, 0x27, 0xc4, 0xd1, 0xc3, 0x86,
+      0xbb, 0xc4, 0xcd, 0x61, 0x3e, 0x30, 0xd8, 0xf1, 0x6a, 0xdf,
+      0x91, 0xb7, 0x58, 0x4a, 0x22, 0x65, 0xb1, 0xf6},
+     {0x04, 0xc5, 0xed, 0xea, 0xff, 0x6a, 0x16, 0x59, 0xfd, 0x18, 0xac,
+      0x9d, 0x26, 0x1a, 0x3c, 0x95, 0x5b, 0x13, 0x92, 0x12, 0x23, 0xcd,
+      0xea, 0xef, 0x25, 0xc5, 0x26, 0x4f, 0x39, 0x05, 0x65, 0x0b, 0x14,
+      0x37, 0xa8, 0x17, 0x3a, 0x0d, 0xe3, 0x47, 0xc3, 0x93, 0x15, 0x0a,
+      0x12, 0x38, 0xab, 0x18, 0x5d, 0x37, 0x60, 0x24, 0x7c, 0xb9, 0xa5,
+      0xb5, 0xfb}},
+    {{0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+      0xff, 0xff, 0xff, 0xff, 0x16, 0xa2, 0xe0, 0xb8, 0xf0, 0x3e,
+      0x13, 0xdd, 0x29, 0x45, 0x5c, 0x5c, 0x2a, 0x3c},
+     {0x04, 0xb7, 0x0e, 0x0c, 0xbd, 0x6b, 0xb4, 0xbf, 0x7f, 0x32, 0x13,
+      0x90, 0xb9, 0x4a, 0x03, 0xc1, 0xd3, 0x56, 0xc2, 0x11, 0x22, 0x34,
+      0x32, 0x80, 0xd6, 0x11, 0x5c, 0x1d, 0x21, 0x42, 0xc8, 0x9c, 0x77,
+      0x4a, 0x08, 0xdc, 0x04, 0xb3, 0xdd, 0x20, 0x19, 0x32, 0xbc, 0x8a,
+      0x5e, 0xa5, 0xf8, 0xb8, 0x9b, 0xbb, 0x2a, 0x7e, 0x66, 0x7a, 0xff,
+      0x81, 0xcd}},
+};
+
+// The group order n.
+const uint8_t kOrder[28] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                            0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                            0x16, 0xa2, 0xe0, 0xb8, 0xf0, 0x3e, 0x13,
+                            0xdd, 0x29, 0x45, 0x5c, 0x5c, 0x2a, 0x3d};
+
+void TestKnownPublicKeys() {
+  size_t count = sizeof(kVectors) / sizeof(kVectors[0]);
+  std::vector<uint8_t> private_keys;
+  for (const Vector& v : kVectors) {
+    private_keys.insert(private_keys.end(), v.private_key,
+                        v.private_key + 28);
+  }
+  // Neither zero nor n have a public key.
+  private_keys.insert(private_keys.end(), 28, 0);
+  private_keys.insert(private_keys.end(), kOrder, kOrder + 28);
+
+  std::vector<uint8_t> public_keys((count + 2) * haystack::kPublicKeyBytes,
+                                   0xaa);
+  EXPECT(haystack::DerivePublicKeys(private_keys.data(), count + 2,
+                                    public_keys.data()) == count);
+  for (size_t i = 0; i < count; i++) {
+    EXPECT(std::memcmp(public_keys.data() + i * haystack::kPublicKeyBytes,
+                       kVectors[i].public_key,
+                       haystack::kPublicKeyBytes) == 0);
+  }
+  const uint8_t zero[haystack::kPublicKeyBytes] = {0};
+  for (size_t i = count; i < count + 2; i++) {
+    EXPECT(std::memcmp(public_keys.data() + i * haystack::kPublicKeyBytes,
+                       zero, haystack::kPublicKeyBytes) == 0);
+  }
+}
+
+void TestBaseMultMatchesScalarMult() {
+  haystack::p224::AffinePoint generator;
+  EXPECT(haystack::p224::DecodePoint(kVectors[0].public_key, &generator));
+
+  std::mt19937 rng(224);
+  const size_t kCount = 100;
+  std::vector<haystack::p224::JacobianPoint> points(2 * kCount);
+  for (size_t i = 0; i < kCount; i++) {
+    uint8_t scalar[28];
+    for (auto& b : scalar) b = (uint8_t)rng();
+    // Also cover scalars above the group order and with sparse bits.
+    if (i == 0) std::memset(scalar, 0xff, sizeof(scalar));
+    if (i == 1) std::memset(scalar + 1, 0, sizeof(scalar) - 1);
+    haystack::p224::BaseMult(scalar, &points[2 * i]);
+    haystack::p224::ScalarMult(scalar, generator, &points[2 * i + 1]);
+  }
+
+  std::vector<haystack::p224::AffinePoint> affine(points.size());
+  bool ok[2 * kCount];
+  haystack::p224::BatchToAffine(points.data(), points.size(), affine.data(),
+                                ok);
+  for (size_t i = 0; i < kCount; i++) {
+    uint8_t comb[57], generic[57];
+    EXPECT(ok[2 * i] && ok[2 * i + 1]);
+    haystack::p224::EncodePoint(affine[2 * i], comb);
+    haystack::p224::EncodePoint(affine[2 * i + 1], generic);
+    EXPECT(std::memcmp(comb, generic, sizeof(comb)) == 0);
+  }
+}
+
+}  // namespace
+
+int main() {
+  TestKnownPublicKeys();
+  TestBaseMultMatchesScalarMult();
+  if (failures != 0) {
+    std::fprintf(stderr, "%d check(s) failed\n", failures);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,308 @@
+// Known answer tests for the batch report decryption. The vectors were
+// produced with the Python cryptography package the same way Apple devices
+// encrypt reports: ECDH on secp224r1, X9.63 KDF and AES-128-GCM with a
+// 16 byte IV.
+
+#include "report_decryptor.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include "decrypt_job.h"
+#include "thread_pool.h"
+
+namespace {
+
+int failures = 0;
+
+#define EXPECT(cond)                                                  \
+  do {                                                                \
+    if (!(cond)) {                                                    \
+      std::fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+      failures++;                                                     \
+    }                                                                 \
+  } while (0)
+
+struct Vector {
+  uint8_t key[28];
+  uint8_t payload[88];
+  uint8_t plaintext[10];
+};
+
+const Vector kVectors[] = {
+    {{0x41, 0x4c, 0x34, 0x3c, 0x10, 0x27, 0xc4, 0xd1, 0xc3, 0x86,
+      0xbb, 0xc4, 0xcd, 0x61, 0x3e, 0x30, 0xd8, 0xf1, 0x6a, 0xdf,
+      0x91, 0xb7, 0x58, 0x4a, 0x22, 0x65, 0xb1, 0xf6},
+     {0x61, 0x92, 0x64, 0xc2, 0xc4, 0x04, 0xdf, 0x97, 0x70, 0x09, 0x86,
+      0xc8, 0x74, 0xce, 0x6f, 0x6b, 0xd4, 0x6b, 0xe4, 0x30, 0xe4, 0x97,
+      0x30, 0xc2, 0xaa, 0x9a, 0x0c, 0x74, 0x1a, 0x7a, 0x74, 0xe8, 0x7e,
+      0x1f, 0x00, 0x01, 0x9f, 0x42, 0xae, 0x09, 0x1a, 0x62, 0x15, 0x40,
+      0xdb, 0xc2, 0x5e, 0x3c, 0xf6, 0x15, 0x2d, 0x57, 0x18, 0xb6, 0xb0,
+      0x94, 0x25, 0x89, 0x1b, 0xe5, 0x54, 0x22, 0xdb, 0x9d, 0x0f, 0x64,
+      0xeb, 0xce, 0xce, 0x2a, 0xb0, 0x5b, 0x1b, 0xdd, 0xe6, 0x7c, 0x5d,
+      0xb5, 0xf6, 0xbe, 0xa4, 0xc9, 0x48, 0x01, 0xce, 0x5d, 0x9a, 0x70},
+     {0xc9, 0x35, 0x18, 0x7c, 0x07, 0xe4, 0xd5, 0x63, 0x6e, 0x9b}},
+    {{0x3a, 0x90, 0x29, 0x31, 0xcd, 0x44, 0x7e, 0x35, 0xb8, 0xb6,
+      0xd8, 0xfe, 0x44, 0x2e, 0x3d, 0x43, 0x72, 0x04, 0xe5, 0x2d,
+      0xb2, 0x22, 0x1a, 0x58, 0x00, 0x8a, 0x05, 0xa7},
+     {0x36, 0x07, 0xea, 0x7a, 0xb9, 0x04, 0x21, 0xa9, 0x1d, 0x49, 0xe7,
+      0x5c, 0x17, 0x23, 0xc5, 0x94, 0x7e, 0xed, 0x1e, 0x1a, 0xc8, 0x62,
+      0xd9, 0x21, 0x99, 0x24, 0x64, 0x98, 0x40, 0x78, 0x90, 0xa4, 0xee,
+      0x4a, 0xf8, 0x31, 0xfd, 0xfa, 0xcb, 0x22, 0x1e, 0x8f, 0x2c, 0xb7,
+      0x92, 0x23, 0x3b, 0x65, 0x0f, 0xf1, 0x52, 0x9d, 0x55, 0x8d, 0x8f,
+      0xcb, 0xf5, 0xa2, 0xab, 0x12, 0x31, 0xf8, 0x4c, 0x0c, 0xcf, 0xed,
+      0xb5, 0x5e, 0xb3, 0x5f, 0x24, 0x72, 0x65, 0xc6, 0x8b, 0x66, 0x6e,
+      0xd8, 0xfe, 0xbf, 0x0e, 0x35, 0xf8, 0xd1, 0x3e, 0x79, 0x20, 0x08},
+     {0x06, 0xa6, 0x8a, 0x02, 0xf0, 0xe1, 0x61, 0xaf, 0x37, 0xf8}},
+};
+
+class Batch {
+ public:
+  void AddKey(const uint8_t key[28]) {
+    keys_.insert(keys_.end(), key, key + 28);
+  }
+
+  void AddReport(const uint8_t* payload, size_t len, uint32_t key_index) {
+    payloads_.insert(payloads_.end(), payload, payload + len);
+    offsets_.push_back((uint32_t)payloads_.size());
+    key_indices_.push_back(key_index);
+  }
+
+  haystack::ReportBatch View() const {
+    haystack::ReportBatch batch;
+    batch.payloads = payloads_.data();
+    batch.payload_offsets = offsets_.data();
+    batch.key_indices = key_indices_.data();
+    batch.report_count = key_indices_.size();
+    batch.private_keys = keys_.data();
+    batch.key_count = keys_.size() / 28;
+    return batch;
+  }
+
+  size_t Run() {
+    records_.assign(key_indices_.size() * haystack::kRecordBytes, 0xff);
+    return haystack::DecryptReports(View(), 0, key_indices_.size(),
+                                    records_.data());
+  }
+
+  const uint8_t* Record(size_t i) const {
+    return records_.data() + i * haystack::kRecordBytes;
+  }
+
+ private:
+  std::vector<uint8_t> payloads_;
+  std::vector<uint32_t> offsets_ = {0};
+  std::vector<uint32_t> key_indices_;
+  std::vector<uint8_t> keys_;
+  std::vector<uint8_t> records_;
+};
+
+void ExpectDecrypted(const uint8_t* record, const Vector& v) {
+  EXPECT(record[haystack::kRecordStatusOffset] == haystack::kReportOk);
+  EXPECT(std::memcmp(record, v.payload, 5) == 0);
+  EXPECT(std::memcmp(record + haystack::kRecordPlaintextOffset, v.plaintext,
+                     sizeof(v.plaintext)) == 0);
+}
+
+void TestDecryptsBothPayloadVariants() {
+  Batch batch;
+  batch.AddKey(kVectors[0].key);
+  batch.AddKey(kVectors[1].key);
+  batch.AddReport(kVectors[0].payload, 88, 0);
+  batch.AddReport(kVectors[1].payload, 88, 1);
+
+  // The 89 byte variant carries an extra byte at index 4.
+  uint8_t long_payload[89];
+  std::memcpy(long_payload, kVectors[1].payload, 4);
+  long_payload[4] = 0x5a;
+  std::memcpy(long_payload + 5, kVectors[1].payload + 4, 84);
+  batch.AddReport(long_payload, sizeof(long_payload), 1);
+
+  EXPECT(batch.Run() == 3);
+  ExpectDecrypted(batch.Record(0), kVectors[0]);
+  ExpectDecrypted(batch.Record(1), kVectors[1]);
+  ExpectDecrypted(batch.Record(2), kVectors[1]);
+}
+
+void TestManyReportsAcrossChunks() {
+  Batch batch;
+  batch.AddKey(kVectors[0].key);
+  batch.AddKey(kVectors[1].key);
+  for (int i = 0; i < 150; i++) {
+    batch.AddReport(kVectors[i % 2].payload, 88, i % 2);
+  }
+  EXPECT(batch.Run() == 150);
+  for (int i = 0; i < 150; i++) {
+    ExpectDecrypted(batch.Record(i), kVectors[i % 2]);
+  }
+}
+
+void TestRejectsBadInput() {
+  Batch batch;
+  batch.AddKey(kVectors[0].key);
+
+  batch.AddReport(kVectors[0].payload, 60, 0);
+  batch.AddReport(kVectors[0].payload, 88, 7);
+  uint8_t off_curve[88];
+  std::memcpy(off_curve, kVectors[0].payload, sizeof(off_curve));
+  off_curve[40] ^= 0x01;
+  batch.AddReport(off_curve, sizeof(off_curve), 0);
+  batch.AddReport(kVectors[0].payload, 88, 0);
+  uint8_t bad_tag[88];
+  std::memcpy(bad_tag, kVectors[0].payload, sizeof(bad_tag));
+  bad_tag[87] ^= 0x01;
+  batch.AddReport(bad_tag, sizeof(bad_tag), 0);
+  // A report decrypted with the wrong key fails authentication as well.
+  batch.AddKey(kVectors[1].key);
+  batch.AddReport(kVectors[0].payload, 88, 1);
+
+  EXPECT(batch.Run() == 1);
+  EXPECT(batch.Record(0)[haystack::kRecordStatusOffset] ==
+         haystack::kReportMalformed);
+  EXPECT(batch.Record(1)[haystack::kRecordStatusOffset] ==
+         haystack::kReportInvalidKey);
+  EXPECT(batch.Record(2)[haystack::kRecordStatusOffset] ==
+         haystack::kReportInvalidPoint);
+  ExpectDecrypted(batch.Record(3), kVectors[0]);
+  const uint8_t zero[10] = {0};
+  for (int i = 4; i < 6; i++) {
+    EXPECT(batch.Record(i)[haystack::kRecordStatusOffset] ==
+           haystack::kReportTagMismatch);
+    EXPECT(std::memcmp(batch.Record(i) + haystack::kRecordPlaintextOffset,
+                       zero, sizeof(zero)) == 0);
+  }
+}
+
+void TestDecryptJobStreamsAllRecords() {
+  // Two keys, a few reports of the second one malformed, and more reports
+  // than fit into one shard.
+  Batch batch;
+  batch.AddKey(kVectors[0].key);
+  batch.AddKey(kVectors[1].key);
+  const size_t kCount = 3 * haystack::DecryptJob::kShardSize + 17;
+  for (size_t i = 0; i < kCount; i++) {
+    batch.AddReport(kVectors[i % 2].payload, i % 7 == 3 ? 70 : 88, i % 2);
+  }
+  batch.Run();
+
+  for (size_t workers : {1, 4}) {
+    haystack::ThreadPool pool(workers, 2);
+    haystack::DecryptJob job(&pool, batch.View());
+    std::vector<int> seen(kCount, 0);
+    uint32_t indices[100];
+    uint8_t records[100 * haystack::kRecordBytes];
+    int32_t n;
+    while ((n = job.Poll(indices, records, 100)) != -1) {
+      for (int32_t i = 0; i < n; i++) {
+        EXPECT(indices[i] < kCount);
+        seen[indices[i]]++;
+        EXPECT(std::memcmp(records + i * haystack::kRecordBytes,
+                           batch.Record(indices[i]),
+                           haystack::kRecordBytes) == 0);
+      }
+    }
+    for (size_t i = 0; i < kCount; i++) {
+      EXPECT(seen[i] == 1);
+    }
+  }
+
+  // Dropping a job before it is done must not touch freed memory.
+  haystack::ThreadPool pool(2, 1);
+  { haystack::DecryptJob job(&pool, batch.View()); }
+}
+
+void TestCancelledDecryptJob() {
+  Batch batch;
+  batch.AddKey(kVectors[0].key);
+  const size_t kCount = 8 * haystack::DecryptJob::kShardSize;
+  for (size_t i = 0; i < kCount; i++) {
+    batch.AddReport(kVectors[0].payload, 88, 0);
+  }
+  batch.Run();
+
+  haystack::ThreadPool pool(1, 1);
+  std::mutex mutex;
+  std::condition_variable deleted;
+  bool is_deleted = false;
+  auto* job = new haystack::DecryptJob(&pool, batch.View(), [&] {
+    std::lock_guard<std::mutex> lock(mutex);
+    is_deleted = true;
+    deleted.notify_all();
+  });
+  job->Cancel();
+  // Records of the shards which were queued are still handed out, either
+  // decrypted or marked as cancelled, and the job ends early.
+  uint32_t indices[100];
+  uint8_t records[100 * haystack::kRecordBytes];
+  size_t handed_out = 0;
+  int32_t n;
+  for (;;) {
+    job->Wait(1000);
+    if ((n = job->Poll(indices, records, 100)) == -1) {
+      break;
+    }
+    for (int32_t i = 0; i < n; i++) {
+      const uint8_t* record = records + i * haystack::kRecordBytes;
+      EXPECT(record[haystack::kRecordStatusOffset] ==
+                 haystack::kReportCancelled ||
+             std::memcmp(record, batch.Record(indices[i]),
+                         haystack::kRecordBytes) == 0);
+    }
+    handed_out += n;
+  }
+  EXPECT(handed_out < kCount);
+  haystack::DecryptJob::Release(job);
+  std::unique_lock<std::mutex> lock(mutex);
+  EXPECT(deleted.wait_for(lock, std::chrono::seconds(10),
+                          [&] { return is_deleted; }));
+}
+
+void TestReleasedDecryptJobIsDeleted() {
+  Batch batch;
+  batch.AddKey(kVectors[0].key);
+  const size_t kCount = 8 * haystack::DecryptJob::kShardSize;
+  for (size_t i = 0; i < kCount; i++) {
+    batch.AddReport(kVectors[0].payload, 88, 0);
+  }
+  batch.Run();
+
+  // Released while shards are still queued and running, the job is deleted
+  // by the last thread using it, before the pool is destroyed.
+  std::mutex mutex;
+  std::condition_variable deleted;
+  size_t deleted_count = 0;
+  {
+    haystack::ThreadPool pool(2, 1);
+    for (int i = 0; i < 10; i++) {
+      haystack::DecryptJob::Release(
+          new haystack::DecryptJob(&pool, batch.View(), [&] {
+            std::lock_guard<std::mutex> lock(mutex);
+            deleted_count++;
+            deleted.notify_all();
+          }));
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    EXPECT(deleted.wait_for(lock, std::chrono::seconds(10),
+                            [&] { return deleted_count == 10; }));
+  }
+}
+
+}  // namespace
+
+int main() {
+  TestDecryptsBothPayloadVariants();
+  TestManyReportsAcrossChunks();
+  TestRejectsBadInput();
+  TestDecryptJobStreamsAllRecords();
+  TestCancelledDecryptJob();
+  TestReleasedDecryptJobIsDeleted();
+  if (failures != 0) {
+    std::fprintf(stderr, "%d check(s) failed\n", failures);
+    return 1;
+  }
+  return 0;
+}
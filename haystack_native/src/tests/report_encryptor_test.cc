@@ -0,0 +1,128 @@
+// Encrypts reports for random keys and checks that DecryptReports recovers
+// them, in both payload variants.
+
+#include "report_encryptor.h"
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+
+#define EXPECT(cond)                                                  \
+  do {                                                                \
+    if (!(cond)) {                                                    \
+      std::fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+      failures++;                                                     \
+    }                                                                 \
+  } while (0)
+
+void TestRoundTrip() {
+  std::mt19937 rng(89);
+  const size_t kKeys = 3;
+  const size_t kReports = 70;
+  std::vector<uint8_t> private_keys(kKeys * haystack::kPrivateKeyBytes);
+  for (auto& b : private_keys) b = (uint8_t)rng();
+  std::vector<uint8_t> public_keys(kKeys * haystack::kPublicKeyBytes);
+  EXPECT(haystack::DerivePublicKeys(private_keys.data(), kKeys,
+                                    public_keys.data()) == kKeys);
+
+  std::vector<uint8_t> payloads;
+  std::vector<uint32_t> offsets = {0};
+  std::vector<uint32_t> key_indices;
+  std::vector<haystack::Location> locations;
+  for (size_t i = 0; i < kReports; i++) {
+    uint8_t scalar[haystack::p224::kScalarBytes];
+    for (auto& b : scalar) b = (uint8_t)rng();
+    haystack::Location location = {(uint32_t)rng() % 900000000,
+                                   (uint32_t)rng() % 1800000000,
+                                   (uint8_t)rng(), (uint8_t)rng()};
+    bool extended = i % 2 == 1;
+    uint8_t payload[haystack::kExtendedPayloadBytes];
+    size_t key = i % kKeys;
+    // The last report is encrypted for a key which is not in the batch.
+    if (i + 1 == kReports) {
+      EXPECT(haystack::EncryptReport(public_keys.data(), scalar, 1000, 2,
+                                     location, extended, payload));
+      key = 1;
+    } else {
+      EXPECT(haystack::EncryptReport(
+          public_keys.data() + key * haystack::kPublicKeyBytes, scalar,
+          (uint32_t)(7000000 + i), (uint8_t)i, location, extended, payload));
+    }
+    size_t len = extended ? haystack::kExtendedPayloadBytes
+                          : haystack::kPayloadBytes;
+    payloads.insert(payloads.end(), payload, payload + len);
+    offsets.push_back((uint32_t)payloads.size());
+    key_indices.push_back((uint32_t)key);
+    locations.push_back(location);
+  }
+
+  haystack::ReportBatch batch;
+  batch.payloads = payloads.data();
+  batch.payload_offsets = offsets.data();
+  batch.key_indices = key_indices.data();
+  batch.report_count = kReports;
+  batch.private_keys = private_keys.data();
+  batch.key_count = kKeys;
+  std::vector<uint8_t> records(kReports * haystack::kRecordBytes);
+  EXPECT(haystack::DecryptReports(batch, 0, kReports, records.data()) ==
+         kReports - 1);
+
+  for (size_t i = 0; i + 1 < kReports; i++) {
+    const uint8_t* record = records.data() + i * haystack::kRecordBytes;
+    const haystack::Location& location = locations[i];
+    uint32_t seen_time = (uint32_t)(7000000 + i);
+    const uint8_t expected[haystack::kRecordBytes] = {
+        (uint8_t)(seen_time >> 24),
+        (uint8_t)(seen_time >> 16),
+        (uint8_t)(seen_time >> 8),
+        (uint8_t)seen_time,
+        (uint8_t)i,
+        (uint8_t)(location.latitude >> 24),
+        (uint8_t)(location.latitude >> 16),
+        (uint8_t)(location.latitude >> 8),
+        (uint8_t)location.latitude,
+        (uint8_t)(location.longitude >> 24),
+        (uint8_t)(location.longitude >> 16),
+        (uint8_t)(location.longitude >> 8),
+        (uint8_t)location.longitude,
+        location.accuracy,
+        location.status,
+        haystack::kReportOk};
+    EXPECT(std::memcmp(record, expected, sizeof(expected)) == 0);
+  }
+  EXPECT(records[(kReports - 1) * haystack::kRecordBytes +
+                 haystack::kRecordStatusOffset] ==
+         haystack::kReportTagMismatch);
+}
+
+void TestInvalidInputs() {
+  uint8_t private_key[haystack::kPrivateKeyBytes] = {0};
+  private_key[27] = 1;
+  uint8_t public_key[haystack::kPublicKeyBytes];
+  haystack::DerivePublicKeys(private_key, 1, public_key);
+  uint8_t payload[haystack::kExtendedPayloadBytes];
+  const haystack::Location location = {0, 0, 0, 0};
+  uint8_t zero[haystack::p224::kScalarBytes] = {0};
+  EXPECT(!haystack::EncryptReport(public_key, zero, 0, 0, location, false,
+                                  payload));
+  public_key[56] ^= 1;
+  EXPECT(!haystack::EncryptReport(public_key, private_key, 0, 0, location,
+                                  false, payload));
+}
+
+}  // namespace
+
+int main() {
+  TestRoundTrip();
+  TestInvalidInputs();
+  if (failures != 0) {
+    std::fprintf(stderr, "%d check(s) failed\n", failures);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,113 @@
+// Checks the SHA-256 kernels against known digests and each other.
+
+#include "sha256.h"
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+
+#define EXPECT(cond)                                                  \
+  do {                                                                \
+    if (!(cond)) {                                                    \
+      std::fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+      failures++;                                                     \
+    }                                                                 \
+  } while (0)
+
+using Kernel = void (*)(const haystack::Sha256Lane*, size_t);
+
+struct Digest {
+  uint8_t bytes[haystack::kSha256DigestBytes];
+};
+
+// Hashes |messages| with |kernel|.
+std::vector<Digest> Run(Kernel kernel,
+                        const std::vector<std::vector<uint8_t>>& messages) {
+  std::vector<Digest> digests(messages.size());
+  std::vector<haystack::Sha256Lane> lanes(messages.size());
+  for (size_t i = 0; i < messages.size(); i++) {
+    lanes[i] = {messages[i].data(), messages[i].size(), digests[i].bytes};
+  }
+  kernel(lanes.data(), lanes.size());
+  return digests;
+}
+
+std::vector<Kernel> Kernels() {
+  std::vector<Kernel> kernels = {haystack::Sha256DigestLanesPortable,
+                                 haystack::Sha256DigestLanes};
+#if defined(HAYSTACK_HAVE_SHA_X86)
+  if (haystack::Avx2Available()) {
+    kernels.push_back(haystack::Sha256DigestLanesAvx2);
+  }
+  if (haystack::ShaNiAvailable()) {
+    kernels.push_back(haystack::Sha256DigestLanesShaNi);
+  }
+#endif
+  return kernels;
+}
+
+void TestKnownDigests() {
+  // FIPS 180-2 examples: "abc" and the two block message.
+  const char* inputs[] = {
+      "abc", "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"};
+  const uint8_t expected[][32] = {
+      {0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40,
+       0xde, 0x5d, 0xae, 0x22, 0x23, 0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17,
+       0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad},
+      {0x24, 0x8d, 0x6a, 0x61, 0xd2, 0x06, 0x38, 0xb8, 0xe5, 0xc0, 0x26,
+       0x93, 0x0c, 0x3e, 0x60, 0x39, 0xa3, 0x3c, 0xe4, 0x59, 0x64, 0xff,
+       0x21, 0x67, 0xf6, 0xec, 0xed, 0xd4, 0x19, 0xdb, 0x06, 0xc1}};
+  std::vector<std::vector<uint8_t>> messages;
+  for (const char* input : inputs) {
+    messages.emplace_back(input, input + std::strlen(input));
+  }
+  for (Kernel kernel : Kernels()) {
+    auto digests = Run(kernel, messages);
+    for (size_t i = 0; i < messages.size(); i++) {
+      EXPECT(std::memcmp(digests[i].bytes, expected[i], 32) == 0);
+    }
+  }
+}
+
+void TestKernelsAgree() {
+  // Every length up to three blocks, so the lanes of a batch end after
+  // different numbers of blocks.
+  std::mt19937 rng(224);
+  std::vector<std::vector<uint8_t>> messages;
+  for (size_t len = 0; len <= 192; len++) {
+    std::vector<uint8_t> message(len);
+    for (auto& b : message) b = (uint8_t)rng();
+    messages.push_back(message);
+  }
+  std::vector<Digest> expected(messages.size());
+  for (size_t i = 0; i < messages.size(); i++) {
+    haystack::Sha256Digest(messages[i].data(), messages[i].size(),
+                           expected[i].bytes);
+  }
+  for (Kernel kernel : Kernels()) {
+    auto digests = Run(kernel, messages);
+    for (size_t i = 0; i < messages.size(); i++) {
+      EXPECT(std::memcmp(digests[i].bytes, expected[i].bytes, 32) == 0);
+    }
+  }
+}
+
+}  // namespace
+
+int main() {
+  TestKnownDigests();
+  TestKernelsAgree();
+  std::printf("AVX2 kernel %s, SHA-NI kernel %s\n",
+              haystack::Avx2Available() ? "tested" : "not available",
+              haystack::ShaNiAvailable() ? "tested" : "not available");
+  if (failures != 0) {
+    std::fprintf(stderr, "%d check(s) failed\n", failures);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,93 @@
+#include "thread_pool.h"
+
+namespace haystack {
+
+ThreadPool::ThreadPool(size_t workers, size_t capacity)
+    : capacity_(capacity > 0 ? capacity : 1) {
+  if (workers == 0) {
+    workers = std::thread::hardware_concurrency();
+  }
+  if (workers == 0) {
+    workers = 1;
+  }
+  for (size_t i = 0; i < workers; i++) {
+    workers_.push_back(std::unique_ptr<Worker>(new Worker()));
+  }
+  for (size_t i = 0; i < workers; i++) {
+    threads_.emplace_back(&ThreadPool::Run, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  work_available_.notify_all();
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+void ThreadPool::Submit(size_t shard, Task task) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  space_available_.wait(lock, [this] { return queued_ < capacity_; });
+  Worker& worker = *workers_[shard % workers_.size()];
+  {
+    std::lock_guard<std::mutex> worker_lock(worker.mutex);
+    worker.tasks.push_back(std::move(task));
+  }
+  queued_++;
+  lock.unlock();
+  work_available_.notify_one();
+}
+
+bool ThreadPool::PopOrSteal(size_t self, Task* task) {
+  {
+    Worker& own = *workers_[self];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.tasks.empty()) {
+      *task = std::move(own.tasks.back());
+      own.tasks.pop_back();
+      return true;
+    }
+  }
+  for (size_t i = 1; i < workers_.size(); i++) {
+    Worker& victim = *workers_[(self + i) % workers_.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      *task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::Run(size_t self) {
+  for (;;) {
+    Task task;
+    if (PopOrSteal(self, &task)) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queued_--;
+      }
+      space_available_.notify_one();
+      task();
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (queued_ > 0) {
+      // Another worker took the task but has not accounted for it yet.
+      lock.unlock();
+      std::this_thread::yield();
+      continue;
+    }
+    if (stopping_) {
+      return;
+    }
+    work_available_.wait(lock, [this] { return queued_ > 0 || stopping_; });
+  }
+}
+
+}  // namespace haystack
@@ -0,0 +1,60 @@
+#ifndef HAYSTACK_NATIVE_THREAD_POOL_H_
+#define HAYSTACK_NATIVE_THREAD_POOL_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace haystack {
+
+// A fixed set of worker threads with one task deque each. A task is queued on
+// the worker of its shard, so related work (e.g. the reports of one key) stays
+// together; idle workers steal from the other end of the other deques.
+// At most |capacity| tasks are queued at a time, Submit blocks until there is
+// room.
+class ThreadPool {
+ public:
+  using Task = std::function<void()>;
+
+  // |workers| == 0 uses one worker per hardware thread.
+  ThreadPool(size_t workers, size_t capacity);
+  // Runs all queued tasks, then joins the workers.
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  size_t worker_count() const { return workers_.size(); }
+
+  void Submit(size_t shard, Task task);
+
+ private:
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  // Takes the newest task of worker |self| or the oldest of another worker.
+  bool PopOrSteal(size_t self, Task* task);
+  void Run(size_t self);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::thread> threads_;
+  const size_t capacity_;
+
+  // Guards queued_ and stopping_.
+  std::mutex mutex_;
+  std::condition_variable work_available_;
+  std::condition_variable space_available_;
+  size_t queued_ = 0;
+  bool stopping_ = false;
+};
+
+}  // namespace haystack
+
+#endif  // HAYSTACK_NATIVE_THREAD_POOL_H_
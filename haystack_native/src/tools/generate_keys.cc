@@ -0,0 +1,294 @@
+// Generates the keys of one or many accessories, with the same output files as
+// generate_keys.py:
+//   <name>_keyfile       key count byte followed by the 28 byte advertisement
+//                        keys, flashed onto the accessory
+//   <name>.keys          private, advertisement and hashed key of every key
+//   <prefix>_devices.json  the accessories for import into the app
+//   <prefix>_<yaml>.yaml   the advertisement keys (with --yaml)
+// Devices are generated in parallel. With --devices N > 1 every device gets
+// its own keyfile and .keys named <prefix>_<i>, and one _devices.json lists
+// all of them.
+//
+//   generate_keys [-n keys] [-p prefix] [-y yaml] [-v] [-d devices]
+//                 [-j threads] [-o output dir]
+
+#include <sys/stat.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "key_generator.h"
+#include "thread_pool.h"
+
+namespace {
+
+const char kUsage[] =
+    "usage: generate_keys [-n NKEYS] [-p PREFIX] [-y YAML] [-v] [-d DEVICES]\n"
+    "                     [-j THREADS] [-o OUTPUT]\n"
+    "  -n, --nkeys    number of keys per device (default 1)\n"
+    "  -p, --prefix   prefix of the keyfiles (default random)\n"
+    "  -y, --yaml     yaml file where to write the list of generated keys\n"
+    "  -v, --verbose  print keys as they are generated\n"
+    "  -d, --devices  number of devices to generate (default 1)\n"
+    "  -j, --threads  number of threads (default one per core)\n"
+    "  -o, --output   output folder (default output/)\n";
+
+struct Options {
+  size_t keys = 1;
+  size_t max_keys = 1;
+  size_t devices = 1;
+  size_t threads = 0;
+  std::string prefix;
+  std::string yaml;
+  std::string output = "output/";
+  bool verbose = false;
+};
+
+struct Device {
+  std::string name;
+  uint32_t id = 0;
+  std::vector<haystack::AccessoryKey> keys;
+  long rejected = 0;
+  bool ok = false;
+};
+
+bool ParseCount(const char* arg, size_t* out) {
+  char* end = nullptr;
+  errno = 0;
+  long value = std::strtol(arg, &end, 10);
+  if (errno != 0 || end == arg || *end != '\0' || value < 0) {
+    return false;
+  }
+  *out = (size_t)value;
+  return true;
+}
+
+// Returns 0 to continue, -1 if the usage was printed on request, otherwise the
+// exit code.
+int ParseOptions(int argc, char** argv, Options* options) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "-h" || arg == "--help") {
+      std::printf("%s", kUsage);
+      return -1;
+    }
+    if (arg == "-v" || arg == "--verbose") {
+      options->verbose = true;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      std::fprintf(stderr, "%sunknown or incomplete option %s\n", kUsage,
+                   arg.c_str());
+      return 2;
+    }
+    const char* value = argv[++i];
+    bool ok = true;
+    if (arg == "-n" || arg == "--nkeys") {
+      ok = ParseCount(value, &options->keys);
+    } else if (arg == "-p" || arg == "--prefix") {
+      options->prefix = value;
+    } else if (arg == "-y" || arg == "--yaml") {
+      options->yaml = value;
+    } else if (arg == "-d" || arg == "--devices") {
+      ok = ParseCount(value, &options->devices) && options->devices > 0;
+    } else if (arg == "-j" || arg == "--threads") {
+      ok = ParseCount(value, &options->threads);
+    } else if (arg == "-o" || arg == "--output") {
+      options->output = value;
+      if (options->output.back() != '/') {
+        options->output += '/';
+      }
+    } else if (arg == "-tinfs" || arg == "--thisisnotforstalking") {
+      if (std::strcmp(value, "i_agree") == 0) {
+        options->max_keys = 50;
+      }
+    } else {
+      ok = false;
+    }
+    if (!ok) {
+      std::fprintf(stderr, "%sinvalid option %s %s\n", kUsage, arg.c_str(),
+                   value);
+      return 2;
+    }
+  }
+  if (options->keys < 1 || options->keys > options->max_keys) {
+    std::fprintf(stderr,
+                 "Number of keys out of range (between 1 and %zu)\n",
+                 options->max_keys);
+    return 2;
+  }
+  return 0;
+}
+
+// Uniform random number in [0, bound).
+bool RandomBelow(uint32_t bound, uint32_t* out) {
+  const uint32_t limit = UINT32_MAX - UINT32_MAX % bound;
+  uint32_t value;
+  do {
+    if (!haystack::FillRandom(reinterpret_cast<uint8_t*>(&value),
+                              sizeof(value))) {
+      return false;
+    }
+  } while (value >= limit);
+  *out = value % bound;
+  return true;
+}
+
+bool RandomPrefix(std::string* prefix) {
+  static const char kChars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+  for (int i = 0; i < 6; i++) {
+    uint32_t c;
+    if (!RandomBelow(sizeof(kChars) - 1, &c)) {
+      return false;
+    }
+    *prefix += kChars[c];
+  }
+  return true;
+}
+
+bool WriteFile(const std::string& path, const std::string& contents) {
+  FILE* file = std::fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    std::fprintf(stderr, "Could not write %s: %s\n", path.c_str(),
+                 std::strerror(errno));
+    return false;
+  }
+  bool ok = std::fwrite(contents.data(), 1, contents.size(), file) ==
+            contents.size();
+  ok = std::fclose(file) == 0 && ok;
+  return ok;
+}
+
+std::string KeysFile(const Device& device) {
+  std::string out;
+  for (const haystack::AccessoryKey& key : device.keys) {
+    out += "Private key: " +
+           haystack::Base64Encode(key.private_key, sizeof(key.private_key)) +
+           "\n";
+    out += "Advertisement key: " +
+           haystack::Base64Encode(key.advertisement_key,
+                                  sizeof(key.advertisement_key)) +
+           "\n";
+    out += "Hashed adv key: " +
+           haystack::Base64Encode(key.hashed_key, sizeof(key.hashed_key)) +
+           "\n";
+  }
+  return out;
+}
+
+std::string KeyFile(const Device& device) {
+  std::string out(1, (char)device.keys.size());
+  for (const haystack::AccessoryKey& key : device.keys) {
+    out.append(reinterpret_cast<const char*>(key.advertisement_key),
+               sizeof(key.advertisement_key));
+  }
+  return out;
+}
+
+// Generates the keys of |device| and writes its keyfile and .keys.
+void GenerateDevice(const Options& options, Device* device) {
+  device->keys.resize(options.keys);
+  device->rejected =
+      haystack::GenerateAccessoryKeys(options.keys, device->keys.data());
+  if (device->rejected < 0 || !RandomBelow(10000000, &device->id)) {
+    std::fprintf(stderr, "No random numbers available\n");
+    return;
+  }
+  std::string path = options.output + device->name;
+  device->ok = WriteFile(path + "_keyfile", KeyFile(*device)) &&
+               WriteFile(path + ".keys", KeysFile(*device));
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  int status = ParseOptions(argc, argv, &options);
+  if (status != 0) {
+    return status < 0 ? 0 : status;
+  }
+  if (options.prefix.empty() && !RandomPrefix(&options.prefix)) {
+    std::fprintf(stderr, "No random numbers available\n");
+    return 1;
+  }
+  if (mkdir(options.output.c_str(), 0755) != 0 && errno != EEXIST) {
+    std::fprintf(stderr, "Could not create %s: %s\n", options.output.c_str(),
+                 std::strerror(errno));
+    return 1;
+  }
+
+  std::vector<Device> devices(options.devices);
+  int width = (int)std::to_string(options.devices).size();
+  for (size_t i = 0; i < devices.size(); i++) {
+    if (devices.size() == 1) {
+      devices[i].name = options.prefix;
+    } else {
+      char suffix[32];
+      std::snprintf(suffix, sizeof(suffix), "_%0*zu", width, i + 1);
+      devices[i].name = options.prefix + suffix;
+    }
+  }
+  {
+    haystack::ThreadPool pool(options.threads, 1024);
+    std::printf("Generating %zu device(s) with %zu key(s) each on %zu "
+                "thread(s)\n",
+                devices.size(), options.keys, pool.worker_count());
+    std::printf("Output will be written to %s\n", options.output.c_str());
+    for (size_t i = 0; i < devices.size(); i++) {
+      Device* device = &devices[i];
+      pool.Submit(i, [&options, device] { GenerateDevice(options, device); });
+    }
+    // The pool runs all submitted devices before it is destroyed.
+  }
+
+  long rejected = 0;
+  std::string devices_json = "[\n";
+  std::string yaml = "  keys:\n";
+  for (size_t i = 0; i < devices.size(); i++) {
+    const Device& device = devices[i];
+    if (!device.ok) {
+      return 1;
+    }
+    rejected += device.rejected;
+    if (i > 0) {
+      devices_json += ",\n";
+    }
+    devices_json += haystack::DeviceJson(device.name, device.id,
+                                        device.keys.data(),
+                                        device.keys.size());
+    for (const haystack::AccessoryKey& key : device.keys) {
+      std::string advertisement_key = haystack::Base64Encode(
+          key.advertisement_key, sizeof(key.advertisement_key));
+      yaml += "    - \"" + advertisement_key + "\"\n";
+      if (options.verbose) {
+        std::printf("%s)\nPrivate key: %s\nAdvertisement key: %s\n"
+                    "Hashed adv key: %s\n",
+                    device.name.c_str(),
+                    haystack::Base64Encode(key.private_key,
+                                           sizeof(key.private_key))
+                        .c_str(),
+                    advertisement_key.c_str(),
+                    haystack::Base64Encode(key.hashed_key,
+                                           sizeof(key.hashed_key))
+                        .c_str());
+      }
+    }
+  }
+  devices_json += "]";
+  std::string path = options.output + options.prefix;
+  if (!WriteFile(path + "_devices.json", devices_json) ||
+      (!options.yaml.empty() &&
+       !WriteFile(path + "_" + options.yaml + ".yaml", yaml))) {
+    return 1;
+  }
+  if (rejected > 0) {
+    std::printf("%ld key(s) skipped and regenerated, because there was a / in "
+                "the b64 of the hashed pubkey\n",
+                rejected);
+  }
+  return 0;
+}
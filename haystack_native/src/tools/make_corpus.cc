@@ -0,0 +1,261 @@
+// Creates a synthetic corpus of encrypted location reports for testing and
+// benchmarking without an Apple account:
+//   <prefix>_devices.json  the accessories, for import into the app (same
+//                          format as generate_keys)
+//   <prefix>_reports.json  their reports in the format of Apple's fetch
+//                          service ({"results": [...]}), half of them with
+//                          the 89 byte payload variant by default
+// Reports are spread over the last days around a fixed location.
+//
+//   make_corpus [-d devices] [-n keys] [-r reports per key] [-D days]
+//               [-x percent 89 byte payloads] [-p prefix] [-j threads]
+//               [-o output dir]
+
+#include <sys/stat.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "key_generator.h"
+#include "public_keys.h"
+#include "report_encryptor.h"
+#include "thread_pool.h"
+
+namespace {
+
+const char kUsage[] =
+    "usage: make_corpus [-d DEVICES] [-n KEYS] [-r REPORTS] [-D DAYS]\n"
+    "                   [-x PERCENT] [-p PREFIX] [-j THREADS] [-o OUTPUT]\n"
+    "  -d  number of devices (default 1)\n"
+    "  -n  number of keys per device (default 1)\n"
+    "  -r  number of reports per key (default 100)\n"
+    "  -D  number of days the reports are spread over (default 7)\n"
+    "  -x  percentage of 89 byte payloads (default 50)\n"
+    "  -p  prefix of the output files (default corpus)\n"
+    "  -j  number of threads (default one per core)\n"
+    "  -o  output folder (default output/)\n";
+
+// Seconds between the Unix epoch and 2001-01-01, the epoch of seen times.
+constexpr long kAppleEpochOffset = 978307200;
+
+// Center of the generated locations, in units of 1e-7 degrees.
+constexpr uint32_t kLatitude = 525200000;
+constexpr uint32_t kLongitude = 134050000;
+
+struct Options {
+  size_t devices = 1;
+  size_t keys = 1;
+  size_t reports = 100;
+  size_t days = 7;
+  size_t extended_percent = 50;
+  size_t threads = 0;
+  std::string prefix = "corpus";
+  std::string output = "output/";
+};
+
+// The reports of one key as entries of the results array.
+struct KeyReports {
+  std::string json;
+  bool ok = false;
+};
+
+bool WriteFile(const std::string& path, const std::string& contents) {
+  FILE* file = std::fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    std::fprintf(stderr, "Could not write %s: %s\n", path.c_str(),
+                 std::strerror(errno));
+    return false;
+  }
+  bool ok = std::fwrite(contents.data(), 1, contents.size(), file) ==
+            contents.size();
+  ok = std::fclose(file) == 0 && ok;
+  return ok;
+}
+
+// Encrypts the reports of the key with |public_key| and |hashed_key|, seen
+// after |oldest| (Unix time).
+void EncryptKeyReports(const Options& options, const uint8_t* public_key,
+                       const uint8_t* hashed_key, long oldest,
+                       KeyReports* out) {
+  uint64_t seed;
+  std::vector<uint8_t> scalars(options.reports * haystack::kPrivateKeyBytes);
+  if (!haystack::FillRandom(reinterpret_cast<uint8_t*>(&seed),
+                            sizeof(seed)) ||
+      !haystack::FillRandom(scalars.data(), scalars.size())) {
+    std::fprintf(stderr, "No random numbers available\n");
+    return;
+  }
+  std::mt19937_64 rng(seed);
+  std::uniform_int_distribution<long> seen(0, (long)options.days * 86400);
+  std::uniform_int_distribution<long> delay(60, 1800);
+  std::uniform_int_distribution<int> offset(-500000, 500000);
+  std::uniform_int_distribution<int> accuracy(5, 100);
+  std::uniform_int_distribution<int> confidence(1, 3);
+  std::uniform_int_distribution<size_t> percent(0, 99);
+
+  std::string id = haystack::Base64Encode(hashed_key,
+                                          haystack::kSha256DigestBytes);
+  for (size_t i = 0; i < options.reports; i++) {
+    long seen_time = oldest + seen(rng);
+    haystack::Location location = {
+        (uint32_t)((int64_t)kLatitude + offset(rng)),
+        (uint32_t)((int64_t)kLongitude + offset(rng)), (uint8_t)accuracy(rng),
+        0};
+    bool extended = percent(rng) < options.extended_percent;
+    uint8_t* scalar = scalars.data() + i * haystack::kPrivateKeyBytes;
+    uint8_t payload[haystack::kExtendedPayloadBytes];
+    // Ephemeral scalars without a point (zero or the group order) are drawn
+    // again, which practically never happens.
+    while (!haystack::EncryptReport(
+        public_key, scalar, (uint32_t)(seen_time - kAppleEpochOffset),
+        (uint8_t)confidence(rng), location, extended, payload)) {
+      if (!haystack::FillRandom(scalar, haystack::kPrivateKeyBytes)) {
+        return;
+      }
+    }
+    long long published = (long long)(seen_time + delay(rng)) * 1000;
+    if (!out->json.empty()) {
+      out->json += ",\n";
+    }
+    out->json +=
+        "{\"datePublished\": " + std::to_string(published) +
+        ", \"payload\": \"" +
+        haystack::Base64Encode(payload, extended
+                                            ? haystack::kExtendedPayloadBytes
+                                            : haystack::kPayloadBytes) +
+        "\", \"description\": \"found\", \"id\": \"" + id +
+        "\", \"statusCode\": 0}";
+  }
+  out->ok = true;
+}
+
+bool ParseCount(const char* arg, size_t* out) {
+  char* end = nullptr;
+  errno = 0;
+  long value = std::strtol(arg, &end, 10);
+  if (errno != 0 || end == arg || *end != '\0' || value < 0) {
+    return false;
+  }
+  *out = (size_t)value;
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  for (int i = 1; i < argc; i += 2) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      std::fprintf(stderr, "%s", kUsage);
+      return 2;
+    }
+    const char* value = argv[i + 1];
+    bool ok = true;
+    if (arg == "-d") {
+      ok = ParseCount(value, &options.devices) && options.devices > 0;
+    } else if (arg == "-n") {
+      ok = ParseCount(value, &options.keys) && options.keys > 0 &&
+           options.keys <= 255;
+    } else if (arg == "-r") {
+      ok = ParseCount(value, &options.reports);
+    } else if (arg == "-D") {
+      ok = ParseCount(value, &options.days) && options.days > 0;
+    } else if (arg == "-x") {
+      ok = ParseCount(value, &options.extended_percent) &&
+           options.extended_percent <= 100;
+    } else if (arg == "-p") {
+      options.prefix = value;
+    } else if (arg == "-j") {
+      ok = ParseCount(value, &options.threads);
+    } else if (arg == "-o") {
+      options.output = value;
+      if (options.output.back() != '/') options.output += '/';
+    } else {
+      ok = false;
+    }
+    if (!ok) {
+      std::fprintf(stderr, "%s", kUsage);
+      return 2;
+    }
+  }
+  if (mkdir(options.output.c_str(), 0755) != 0 && errno != EEXIST) {
+    std::fprintf(stderr, "Could not create %s: %s\n", options.output.c_str(),
+                 std::strerror(errno));
+    return 1;
+  }
+
+  size_t key_count = options.devices * options.keys;
+  std::vector<haystack::AccessoryKey> keys(key_count);
+  if (haystack::GenerateAccessoryKeys(key_count, keys.data()) < 0) {
+    std::fprintf(stderr, "No random numbers available\n");
+    return 1;
+  }
+  std::vector<uint8_t> private_keys;
+  for (const haystack::AccessoryKey& key : keys) {
+    private_keys.insert(private_keys.end(), key.private_key,
+                        key.private_key + haystack::kPrivateKeyBytes);
+  }
+  std::vector<uint8_t> public_keys(key_count * haystack::kPublicKeyBytes);
+  haystack::DerivePublicKeys(private_keys.data(), key_count,
+                             public_keys.data());
+
+  long oldest = (long)std::time(nullptr) - (long)options.days * 86400;
+  std::vector<KeyReports> reports(key_count);
+  {
+    haystack::ThreadPool pool(options.threads, 1024);
+    std::printf("Encrypting %zu reports for %zu keys on %zu thread(s)\n",
+                key_count * options.reports, key_count, pool.worker_count());
+    for (size_t k = 0; k < key_count; k++) {
+      const uint8_t* public_key =
+          public_keys.data() + k * haystack::kPublicKeyBytes;
+      const uint8_t* hashed_key = keys[k].hashed_key;
+      KeyReports* out = &reports[k];
+      pool.Submit(k, [&options, public_key, hashed_key, oldest, out] {
+        EncryptKeyReports(options, public_key, hashed_key, oldest, out);
+      });
+    }
+    // The pool encrypts all submitted keys before it is destroyed.
+  }
+
+  std::string devices = "[\n";
+  std::string results = "{\"results\": [\n";
+  for (size_t d = 0; d < options.devices; d++) {
+    uint32_t id;
+    haystack::FillRandom(reinterpret_cast<uint8_t*>(&id), sizeof(id));
+    if (d > 0) {
+      devices += ",\n";
+    }
+    devices += haystack::DeviceJson(
+        options.prefix + "_" + std::to_string(d + 1), id % 10000000,
+        keys.data() + d * options.keys, options.keys);
+  }
+  bool first = true;
+  for (const KeyReports& key_reports : reports) {
+    if (!key_reports.ok) {
+      return 1;
+    }
+    if (key_reports.json.empty()) {
+      continue;
+    }
+    results += (first ? "" : ",\n") + key_reports.json;
+    first = false;
+  }
+  devices += "]";
+  results += "\n], \"statusCode\": \"200\"}";
+
+  std::string path = options.output + options.prefix;
+  if (!WriteFile(path + "_devices.json", devices) ||
+      !WriteFile(path + "_reports.json", results)) {
+    return 1;
+  }
+  std::printf("Output written to %s%s_devices.json and _reports.json\n",
+              options.output.c_str(), options.prefix.c_str());
+  return 0;
+}
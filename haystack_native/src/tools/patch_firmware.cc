@@ -0,0 +1,290 @@
+// Writes the keys of many accessories into firmware images in one run:
+//   nrf5x  copies of the base firmware with the keys of each keyfile written
+//          over the OFFLINEFINDINGPUBLICKEYHERE! marker, like the nrf5x
+//          "patch" make target
+//   esp32  key partition images to be flashed at 0x110000 (see with_key.csv)
+// The base firmware is mapped and searched for the marker once; the images are
+// written in parallel. Keyfiles are given as files or as directories, of which
+// all *_keyfile files are used.
+//
+//   patch_firmware [-j threads] [-o output dir] nrf5x <firmware.bin> <keyfiles>
+//   patch_firmware [-j threads] [-o output dir] esp32 <keyfiles>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "firmware_patcher.h"
+#include "thread_pool.h"
+
+namespace {
+
+const char kUsage[] =
+    "usage: patch_firmware [-j THREADS] [-o OUTPUT] nrf5x FIRMWARE KEYFILE...\n"
+    "       patch_firmware [-j THREADS] [-o OUTPUT] esp32 KEYFILE...\n"
+    "  -j  number of threads (default one per core)\n"
+    "  -o  output folder (default output/)\n"
+    "Each KEYFILE is a keyfile or a folder, of which all *_keyfile files "
+    "are used.\n";
+
+const char kKeyfileSuffix[] = "_keyfile";
+
+bool EndsWith(const std::string& s, const std::string& suffix) {
+  return s.size() >= suffix.size() &&
+         s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+std::string BaseName(const std::string& path) {
+  size_t slash = path.find_last_of('/');
+  return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+// Adds |path| or, if it is a directory, all keyfiles in it.
+bool CollectKeyfiles(const std::string& path, std::vector<std::string>* out) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    std::fprintf(stderr, "Could not open %s: %s\n", path.c_str(),
+                 std::strerror(errno));
+    return false;
+  }
+  if (!S_ISDIR(st.st_mode)) {
+    out->push_back(path);
+    return true;
+  }
+  DIR* dir = opendir(path.c_str());
+  if (dir == nullptr) {
+    std::fprintf(stderr, "Could not open %s: %s\n", path.c_str(),
+                 std::strerror(errno));
+    return false;
+  }
+  std::vector<std::string> found;
+  while (struct dirent* entry = readdir(dir)) {
+    if (EndsWith(entry->d_name, kKeyfileSuffix)) {
+      found.push_back(path + "/" + entry->d_name);
+    }
+  }
+  closedir(dir);
+  std::sort(found.begin(), found.end());
+  out->insert(out->end(), found.begin(), found.end());
+  return true;
+}
+
+bool ReadFile(const std::string& path, std::vector<uint8_t>* out) {
+  FILE* file = std::fopen(path.c_str(), "rb");
+  if (file == nullptr) {
+    return false;
+  }
+  uint8_t buffer[4096];
+  size_t n;
+  while ((n = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    out->insert(out->end(), buffer, buffer + n);
+  }
+  bool ok = !std::ferror(file);
+  std::fclose(file);
+  return ok;
+}
+
+bool WriteAll(int fd, const uint8_t* data, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    data += n;
+    len -= (size_t)n;
+  }
+  return true;
+}
+
+// A file mapped read-only into memory.
+class MappedFile {
+ public:
+  ~MappedFile() {
+    if (data_ != nullptr) munmap(data_, size_);
+  }
+
+  bool Open(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      size_ = (size_t)st.st_size;
+      void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      data_ = data == MAP_FAILED ? nullptr : data;
+    }
+    close(fd);
+    return data_ != nullptr;
+  }
+
+  const uint8_t* data() const { return static_cast<const uint8_t*>(data_); }
+  size_t size() const { return size_; }
+
+ private:
+  void* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+struct Job {
+  bool esp32 = false;
+  const MappedFile* firmware = nullptr;
+  size_t marker_offset = 0;
+  std::string output;
+  std::string image_suffix;
+};
+
+// Writes the image of |keyfile_path|. Returns false and prints the reason on
+// failure.
+bool PatchOne(const Job& job, const std::string& keyfile_path) {
+  std::vector<uint8_t> keyfile;
+  if (!ReadFile(keyfile_path, &keyfile)) {
+    std::fprintf(stderr, "Could not read %s\n", keyfile_path.c_str());
+    return false;
+  }
+  size_t key_count = haystack::KeyfileKeyCount(keyfile.data(), keyfile.size());
+  if (key_count == 0) {
+    std::fprintf(stderr, "%s is not a keyfile\n", keyfile_path.c_str());
+    return false;
+  }
+
+  std::string name = BaseName(keyfile_path);
+  if (EndsWith(name, kKeyfileSuffix)) {
+    name.resize(name.size() - std::strlen(kKeyfileSuffix));
+  }
+  std::string path = job.output + name + job.image_suffix;
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    std::fprintf(stderr, "Could not write %s: %s\n", path.c_str(),
+                 std::strerror(errno));
+    return false;
+  }
+
+  bool ok;
+  if (job.esp32) {
+    static const std::vector<uint8_t> kErased(haystack::kFlashSectorBytes,
+                                              0xff);
+    size_t image = haystack::Esp32KeyPartitionImageBytes(keyfile.size());
+    if (image == 0) {
+      std::fprintf(stderr, "%s does not fit into the key partition\n",
+                   keyfile_path.c_str());
+      close(fd);
+      unlink(path.c_str());
+      return false;
+    }
+    ok = WriteAll(fd, keyfile.data(), keyfile.size()) &&
+         WriteAll(fd, kErased.data(), image - keyfile.size());
+  } else {
+    const uint8_t* firmware = job.firmware->data();
+    size_t size = job.firmware->size();
+    size_t keys_end =
+        job.marker_offset + key_count * haystack::kAdvertisementKeyBytes;
+    if (!haystack::KeysFit(firmware, size, job.marker_offset, key_count)) {
+      std::fprintf(stderr, "The %zu keys of %s do not fit into the firmware\n",
+                   key_count, keyfile_path.c_str());
+      close(fd);
+      unlink(path.c_str());
+      return false;
+    }
+    ok = WriteAll(fd, firmware, job.marker_offset) &&
+         WriteAll(fd, keyfile.data() + 1, keyfile.size() - 1) &&
+         WriteAll(fd, firmware + keys_end, size - keys_end);
+  }
+  ok = close(fd) == 0 && ok;
+  if (!ok) {
+    std::fprintf(stderr, "Could not write %s\n", path.c_str());
+  }
+  return ok;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  size_t threads = 0;
+  std::string output = "output/";
+  int arg = 1;
+  for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+    if (std::strcmp(argv[arg], "-j") == 0) {
+      threads = std::strtoul(argv[arg + 1], nullptr, 10);
+    } else if (std::strcmp(argv[arg], "-o") == 0) {
+      output = argv[arg + 1];
+      if (output.back() != '/') output += '/';
+    } else {
+      break;
+    }
+  }
+  std::string mode = arg < argc ? argv[arg++] : "";
+  bool esp32 = mode == "esp32";
+  if ((!esp32 && mode != "nrf5x") || arg + (esp32 ? 0 : 1) >= argc) {
+    std::fprintf(stderr, "%s", kUsage);
+    return 2;
+  }
+
+  Job job;
+  job.esp32 = esp32;
+  job.output = output;
+  MappedFile firmware;
+  if (esp32) {
+    job.image_suffix = "_key_partition.bin";
+  } else {
+    std::string firmware_path = argv[arg++];
+    if (!firmware.Open(firmware_path)) {
+      std::fprintf(stderr, "Could not map %s\n", firmware_path.c_str());
+      return 1;
+    }
+    if (!haystack::FindKeyMarker(firmware.data(), firmware.size(),
+                                 &job.marker_offset)) {
+      std::fprintf(stderr, "%s has no unique %s marker\n",
+                   firmware_path.c_str(), haystack::kKeyMarker);
+      return 1;
+    }
+    job.firmware = &firmware;
+    job.image_suffix = "_" + BaseName(firmware_path);
+  }
+
+  std::vector<std::string> keyfiles;
+  for (; arg < argc; arg++) {
+    if (!CollectKeyfiles(argv[arg], &keyfiles)) {
+      return 1;
+    }
+  }
+  if (mkdir(output.c_str(), 0755) != 0 && errno != EEXIST) {
+    std::fprintf(stderr, "Could not create %s: %s\n", output.c_str(),
+                 std::strerror(errno));
+    return 1;
+  }
+
+  std::atomic<size_t> failed(0);
+  {
+    haystack::ThreadPool pool(threads, 1024);
+    for (size_t i = 0; i < keyfiles.size(); i++) {
+      const std::string* keyfile = &keyfiles[i];
+      pool.Submit(i, [&job, &failed, keyfile] {
+        if (!PatchOne(job, *keyfile)) failed++;
+      });
+    }
+    // The pool writes all submitted images before it is destroyed.
+  }
+
+  std::printf("%zu of %zu images written to %s\n",
+              keyfiles.size() - failed.load(), keyfiles.size(),
+              output.c_str());
+  if (esp32) {
+    std::printf("Flash them with esptool.py write_flash ... 0x%zx "
+                "<name>%s\n",
+                haystack::kEsp32KeyPartitionOffset, job.image_suffix.c_str());
+  }
+  return failed.load() == 0 ? 0 : 1;
+}
@@ -0,0 +1,118 @@
+import 'dart:collection';
+
+import 'package:latlong2/latlong.dart';
+import 'package:macless_haystack/accessory/accessory_model.dart';
+
+/// The location history of an accessory ordered by the start of its entries,
+/// entries with the same start in the order they were added.
+/// Finds the entry a report belongs to by a binary search instead of a scan
+/// of the whole history, so a refresh with m reports is merged into a history
+/// of n entries in O((n + m) log n).
+class AccessoryHistoryIndex {
+  final SplayTreeMap<_EntryKey, Pair> _entries =
+      SplayTreeMap(_EntryKey.compare);
+
+  /// Number of entries by their start and by their end in microseconds.
+  final Map<int, int> _starts = {};
+  final Map<int, int> _ends = {};
+  int _sequence = 0;
+
+  AccessoryHistoryIndex(Iterable<Pair> history) {
+    for (var entry in history) {
+      _insert(entry);
+    }
+  }
+
+  /// The number of entries.
+  int get length => _entries.length;
+
+  /// The entries ordered by their start.
+  List<Pair> toList() => _entries.values.toList();
+
+  /// A copy with copies of the entries, which are changed in place.
+  AccessoryHistoryIndex copy() => AccessoryHistoryIndex(_entries.values.map(
+      (entry) => Pair(entry.location, entry.start, entry.end)));
+
+  /// Adds a report seen at [date] and [location]:
+  /// - The report belongs to the first entry if it is within it, otherwise
+  ///   to the last entry starting before it.
+  /// - If an entry starts or ends at [date], the report is skipped.
+  /// - Near the location of its entry, the report extends the entry.
+  /// - At another location, the report is a new entry. If it is within its
+  ///   entry, the entry is split at it.
+  void add(DateTime date, LatLng location) {
+    final time = date.microsecondsSinceEpoch;
+    Pair? closest;
+    final first = _entries.isEmpty ? null : _entries[_entries.firstKey()]!;
+    if (first != null &&
+        date.isAfter(first.start) &&
+        date.isBefore(first.end)) {
+      closest = first;
+    } else if (_starts.containsKey(time) || _ends.containsKey(time)) {
+      return;
+    } else {
+      final key = _entries.lastKeyBefore(_EntryKey(time, -1));
+      closest = key == null ? null : _entries[key];
+    }
+
+    if (closest == null) {
+      _insert(Pair(location, date, date));
+      return;
+    }
+    bool latIsClose =
+        (closest.location.latitude - location.latitude).abs() <= 0.001;
+    bool lonIsClose =
+        (closest.location.longitude - location.longitude).abs() <= 0.001;
+    if (latIsClose && lonIsClose) {
+      if (date.isAfter(closest.end)) {
+        _setEnd(closest, date);
+      }
+      return;
+    }
+    _insert(Pair(location, date, date));
+    if (date.isAfter(closest.start) && date.isBefore(closest.end)) {
+      //add the closest entry again with the end time only
+      _insert(Pair(
+          LatLng(closest.location.latitude, closest.location.longitude),
+          closest.end,
+          closest.end));
+      _setEnd(closest, closest.start);
+    }
+  }
+
+  void _insert(Pair entry) {
+    _entries[_EntryKey(entry.start.microsecondsSinceEpoch, _sequence++)] =
+        entry;
+    _count(_starts, entry.start, 1);
+    _count(_ends, entry.end, 1);
+  }
+
+  void _setEnd(Pair entry, DateTime end) {
+    _count(_ends, entry.end, -1);
+    entry.end = end;
+    _count(_ends, end, 1);
+  }
+
+  static void _count(Map<int, int> counts, DateTime date, int delta) {
+    final time = date.microsecondsSinceEpoch;
+    final count = (counts[time] ?? 0) + delta;
+    if (count == 0) {
+      counts.remove(time);
+    } else {
+      counts[time] = count;
+    }
+  }
+}
+
+/// Orders the entries by their start, then by the order they were added.
+class _EntryKey {
+  final int start;
+  final int sequence;
+
+  _EntryKey(this.start, this.sequence);
+
+  static int compare(_EntryKey a, _EntryKey b) {
+    final byStart = a.start.compareTo(b.start);
+    return byStart != 0 ? byStart : a.sequence.compareTo(b.sequence);
+  }
+}
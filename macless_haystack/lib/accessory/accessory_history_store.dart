@@ -0,0 +1,228 @@
+import 'dart:convert';
+import 'dart:math';
+import 'dart:typed_data';
+
+import 'package:flutter_secure_storage/flutter_secure_storage.dart';
+import 'package:latlong2/latlong.dart';
+import 'package:logger/logger.dart';
+import 'package:macless_haystack/accessory/accessory_model.dart';
+import 'package:macless_haystack/accessory/history_segments.dart';
+
+/// Key of the history of all accessories as one JSON object, which was
+/// written before the history logs. It is moved into them on first use.
+const historyStorageKey = 'HISTORY';
+
+/// Identifies a history entry: neither its start nor its location change.
+typedef _EntryKey = (int start, double latitude, double longitude);
+
+/// Stores the history of each accessory as an append-only log of fixed-size
+/// records, split into segments. Storing a history appends only the entries
+/// which are new or have a new end. Once most records of a log are outdated,
+/// the log is compacted into new segments. A log is only read when the
+/// history of its accessory is loaded.
+class AccessoryHistoryStore {
+  /// A record is the latitude, longitude, start and end (microseconds since
+  /// epoch) of an entry as little endian float64, which holds the times
+  /// exactly and can be read on the web too.
+  static const recordSize = 32;
+  static const segmentRecords = 1024;
+
+  /// Entries are kept until this many days before today.
+  static const days = 7;
+
+  final FlutterSecureStorage _storage;
+  final HistorySegments _segments;
+  final Map<String, _HistoryLog> _logs = {};
+  Future<void>? _migration;
+
+  /// All operations run one after the other.
+  Future<void> _queue = Future.value();
+
+  var logger = Logger(
+    printer: PrettyPrinter(methodCount: 0),
+  );
+
+  AccessoryHistoryStore(this._storage, {HistorySegments? segments})
+      : _segments = segments ?? createHistorySegments(_storage);
+
+  /// Reads the history of the accessory [id], ordered by start.
+  Future<List<Pair<dynamic, dynamic>>> load(String id) =>
+      _serialized(() async {
+        final log = await _log(id);
+        List<Pair<dynamic, dynamic>> history = [
+          for (var entry in log.ends.entries)
+            Pair<LatLng, DateTime>(
+                LatLng(entry.key.$2, entry.key.$3),
+                DateTime.fromMicrosecondsSinceEpoch(entry.key.$1),
+                DateTime.fromMicrosecondsSinceEpoch(entry.value))
+        ];
+        return history..sort((a, b) => a.start.compareTo(b.start));
+      });
+
+  /// Stores the [history] of the accessory [id] without the entries which
+  /// ended before the last [days] days.
+  Future<void> store(String id, List<Pair<dynamic, dynamic>> history) =>
+      _serialized(() async {
+        await _store(id, await _log(id), history);
+      });
+
+  /// Deletes the history of the accessory [id].
+  Future<void> delete(String id) => _serialized(() async {
+        await _migrate();
+        _logs.remove(id);
+        await _segments.deleteAll(id);
+      });
+
+  Future<T> _serialized<T>(Future<T> Function() operation) {
+    final result = _queue.then((_) => operation());
+    _queue = result.then((_) {}, onError: (_) {});
+    return result;
+  }
+
+  static int _expiry() {
+    var nowMinusDays = DateTime.now().subtract(const Duration(days: days));
+    return DateTime(nowMinusDays.year, nowMinusDays.month, nowMinusDays.day)
+        .microsecondsSinceEpoch;
+  }
+
+  Future<_HistoryLog> _log(String id) async {
+    await _migrate();
+    return _logs[id] ??= await _replay(id);
+  }
+
+  /// Reads the log of [id]. Later records of an entry replace earlier ones.
+  Future<_HistoryLog> _replay(String id) async {
+    final log = _HistoryLog();
+    for (var segment in await _segments.list(id)) {
+      final bytes = await _segments.read(id, segment);
+      final data = ByteData.sublistView(bytes);
+      final records = bytes.length ~/ recordSize;
+      for (var offset = 0; offset < records * recordSize;
+          offset += recordSize) {
+        final start = data.getFloat64(offset + 16, Endian.little).toInt();
+        log.ends[(
+          start,
+          data.getFloat64(offset, Endian.little),
+          data.getFloat64(offset + 8, Endian.little)
+        )] = data.getFloat64(offset + 24, Endian.little).toInt();
+      }
+      log.segments.add(segment);
+      log.nextSegment = segment + 1;
+      log.records += records;
+      // After an incomplete record the next records go into a new segment
+      log.lastSegmentRecords =
+          bytes.length % recordSize == 0 ? records : segmentRecords;
+    }
+    final expiry = _expiry();
+    log.ends.removeWhere((key, end) => end <= expiry);
+    return log;
+  }
+
+  Future<void> _store(
+      String id, _HistoryLog log, List<Pair<dynamic, dynamic>> history) async {
+    final expiry = _expiry();
+    Map<_EntryKey, int> current = {
+      for (var entry in history)
+        if (entry.end.microsecondsSinceEpoch > expiry)
+          (
+            entry.start.microsecondsSinceEpoch,
+            entry.location.latitude,
+            entry.location.longitude
+          ): entry.end.microsecondsSinceEpoch
+    };
+    final expired = log.ends.length;
+    log.ends.removeWhere((key, end) => end <= expiry);
+    if (expired != log.ends.length) {
+      logger.i(
+          '${expired - log.ends.length} history elements have been filtered out and will be deleted due to age.');
+    }
+
+    final changed = current.entries
+        .where((entry) => log.ends[entry.key] != entry.value)
+        .toList();
+    // Entries can only be removed by rewriting the log
+    final removed = log.ends.keys.any((key) => !current.containsKey(key));
+    final outdated = log.records + changed.length - current.length;
+    if (removed || outdated > max(current.length, segmentRecords)) {
+      await _compact(id, log, current);
+    } else {
+      await _append(id, log, changed);
+    }
+  }
+
+  Future<void> _append(String id, _HistoryLog log,
+      List<MapEntry<_EntryKey, int>> entries) async {
+    for (var i = 0; i < entries.length;) {
+      if (log.segments.isEmpty || log.lastSegmentRecords >= segmentRecords) {
+        log.segments.add(log.nextSegment++);
+        log.lastSegmentRecords = 0;
+      }
+      final count =
+          min(segmentRecords - log.lastSegmentRecords, entries.length - i);
+      final bytes = Uint8List(count * recordSize);
+      final data = ByteData.sublistView(bytes);
+      for (var j = 0; j < count; j++) {
+        final entry = entries[i + j];
+        final offset = j * recordSize;
+        data.setFloat64(offset, entry.key.$2, Endian.little);
+        data.setFloat64(offset + 8, entry.key.$3, Endian.little);
+        data.setFloat64(offset + 16, entry.key.$1.toDouble(), Endian.little);
+        data.setFloat64(offset + 24, entry.value.toDouble(), Endian.little);
+      }
+      await _segments.append(id, log.segments.last, bytes);
+      log.lastSegmentRecords += count;
+      log.records += count;
+      i += count;
+    }
+    for (var entry in entries) {
+      log.ends[entry.key] = entry.value;
+    }
+  }
+
+  /// Writes the [entries] into new segments and deletes the old ones
+  /// afterwards, so that a replay in between still finds every entry.
+  Future<void> _compact(
+      String id, _HistoryLog log, Map<_EntryKey, int> entries) async {
+    logger.d('Compacting ${log.records} history records to ${entries.length}');
+    final old = List.of(log.segments);
+    log.segments.clear();
+    log.records = 0;
+    log.ends.clear();
+    await _append(id, log, entries.entries.toList());
+    for (var segment in old) {
+      await _segments.delete(id, segment);
+    }
+  }
+
+  /// Moves the history of all accessories from [historyStorageKey] into
+  /// their logs once. If that fails, it is tried again on the next start.
+  Future<void> _migrate() => _migration ??= () async {
+        try {
+          String? history = await _storage.read(key: historyStorageKey);
+          if (history == null) {
+            return;
+          }
+          Map<String, dynamic> jsonDecoded = jsonDecode(history);
+          for (var item in jsonDecoded.entries) {
+            final log = _logs[item.key] ??= await _replay(item.key);
+            await _store(item.key, log,
+                (item.value as List).map((e) => Pair.fromJson(e)).toList());
+          }
+          await _storage.delete(key: historyStorageKey);
+        } catch (e) {
+          logger.e('Could not move the stored history into logs: $e');
+        }
+      }();
+}
+
+/// The state of the log of an accessory.
+class _HistoryLog {
+  /// The end of every entry by its start and location.
+  final Map<_EntryKey, int> ends = {};
+  final List<int> segments = [];
+  int nextSegment = 0;
+
+  /// The number of records in all segments and in the last one.
+  int records = 0;
+  int lastSegmentRecords = 0;
+}
@@ -3,7 +3,9 @@ import 'dart:convert';
 import 'package:flutter/material.dart';
 import 'package:geocoding/geocoding.dart';
 import 'package:macless_haystack/accessory/accessory_battery.dart';
+import 'package:macless_haystack/accessory/accessory_history_index.dart';
 import 'package:macless_haystack/accessory/accessory_icon_model.dart';
+import 'package:macless_haystack/accessory/report_hash_set.dart';
 import 'package:macless_haystack/findMy/find_my_controller.dart';
 import 'package:macless_haystack/location/location_model.dart';
 import 'package:latlong2/latlong.dart';
@@ -75,9 +77,20 @@ class Accessory {
   /// (null if battery data not found)
   AccessoryBatteryStatus? lastBatteryStatus;
 
-  /// A list of known locations over time.
-  List<Pair<dynamic, dynamic>> locationHistory = [];
-  Map<String, dynamic> hashesWithTS = {};
+  /// The known locations over time. Reports are added to it by
+  /// [addLocationHistoryEntries] without rebuilding it.
+  AccessoryHistoryIndex _historyIndex;
+
+  /// The entries of [_historyIndex], listed when they are read.
+  List<Pair<dynamic, dynamic>>? _locationHistory;
+
+  /// The hashes of the reports decrypted in the last days.
+  ReportHashSet reportHashes;
+
+  /// The latest publication time (milliseconds since epoch) of the known
+  /// reports of each hashed advertisement key. Only newer reports are
+  /// fetched.
+  Map<String, dynamic> publishedUntil;
 
   /// Stores address information about the current location.
   Future<Placemark?> place = Future.value(null);
@@ -97,11 +110,15 @@ class Accessory {
       String icon = 'mappin',
       this.color = Colors.grey,
       required this.additionalKeys,
-      required this.hashesWithTS,
       required this.lastBatteryStatus,
-      required this.locationHistory})
+      required List<Pair<dynamic, dynamic>> locationHistory,
+      ReportHashSet? reportHashes,
+      Map<String, dynamic>? publishedUntil})
       : _icon = icon,
         _lastLocation = lastLocation,
+        _historyIndex = AccessoryHistoryIndex(locationHistory),
+        reportHashes = reportHashes ?? ReportHashSet(),
+        publishedUntil = publishedUntil ?? {},
         super() {
     _init();
   }
@@ -123,10 +140,12 @@ class Accessory {
         icon: _icon,
         isActive: isActive,
         lastLocation: lastLocation,
-        hashesWithTS: hashesWithTS,
+        reportHashes: reportHashes,
         additionalKeys: additionalKeys,
-        locationHistory: locationHistory,
-        lastBatteryStatus: lastBatteryStatus);
+        locationHistory: const [],
+        lastBatteryStatus: lastBatteryStatus,
+        publishedUntil: publishedUntil)
+      .._historyIndex = _historyIndex.copy();
   }
 
   /// Updates the properties of this accessor with the new values of the [newAccessory].
@@ -137,11 +156,24 @@ class Accessory {
     color = newAccessory.color;
     _icon = newAccessory._icon;
     isActive = newAccessory.isActive;
-    hashesWithTS = newAccessory.hashesWithTS;
-    locationHistory = newAccessory.locationHistory;
+    reportHashes = newAccessory.reportHashes;
+    publishedUntil = newAccessory.publishedUntil;
+    _historyIndex = newAccessory._historyIndex;
+    _locationHistory = null;
     additionalKeys = newAccessory.additionalKeys;
   }
 
+  /// The known locations over time, ordered by start. The list cannot be
+  /// changed, reports are added by [addLocationHistoryEntries].
+  List<Pair<dynamic, dynamic>> get locationHistory =>
+      _locationHistory ??= List.unmodifiable(_historyIndex.toList());
+
+  /// Replaces the known locations with [history].
+  set locationHistory(List<Pair<dynamic, dynamic>> history) {
+    _historyIndex = AccessoryHistoryIndex(history);
+    _locationHistory = null;
+  }
+
   /// The last known location of the accessory.
   LatLng? get lastLocation {
     return _lastLocation;
@@ -197,9 +229,16 @@ class Accessory {
         lastBatteryStatus = json['lastBatteryStatus'] != null
             ? AccessoryBatteryStatus.values.byName(json['lastBatteryStatus'])
             : null,
-        hashesWithTS = json['hashesWithTS'] != null
-            ? jsonDecode(json['hashesWithTS']) as Map<String, dynamic>
+        /*hashesWithTS is only for migration and can be removed in the future*/
+        reportHashes = json['reportHashes'] != null
+            ? ReportHashSet.fromBytes(base64Decode(json['reportHashes']))
+            : ReportHashSet.fromTimestamps(json['hashesWithTS'] != null
+                ? jsonDecode(json['hashesWithTS']) as Map<String, dynamic>
+                : <String, dynamic>{}),
+        publishedUntil = json['publishedUntil'] != null
+            ? Map<String, dynamic>.from(json['publishedUntil'])
             : <String, dynamic>{},
+        _historyIndex = AccessoryHistoryIndex(const []),
         additionalKeys =
             json['additionalKeys']?.cast<String>() ?? List.empty() {
     _init();
@@ -224,7 +263,8 @@ class Accessory {
         'isActive': isActive,
         'icon': _icon,
         'color': color.value.toRadixString(16).padLeft(8, '0'),
-        'hashesWithTS': jsonEncode(hashesWithTS),
+        'reportHashes': base64Encode(reportHashes.toBytes()),
+        'publishedUntil': publishedUntil,
         'additionalKeys': additionalKeys,
         ...lastBatteryStatus != null
             ? {'lastBatteryStatus': lastBatteryStatus!.name}
@@ -264,92 +304,22 @@ class Accessory {
   }
 
   void addLocationHistoryEntry(FindMyLocationReport report) {
-    var reportDate = report.timestamp ?? report.published!;
-    logger.d(
-        'Adding report with timestamp $reportDate and ${report.longitude} - ${report.latitude}');
-
-    Pair? closest;
-    //Find the closest history report by time
-    for (int i = 0; i < locationHistory.length; i++) {
-      Pair currentPair = locationHistory[i];
-      //If it is between the first pair, we have the closest one and will finish
-      if (reportDate.isAtSameMomentAs(currentPair.start) ||
-          reportDate.isAtSameMomentAs(currentPair.end) ||
-          (reportDate.isAfter(locationHistory[0].start) &&
-              reportDate.isBefore(locationHistory[0].end))) {
-        closest = currentPair;
-        break;
-      }
-      //closest already set, but is earlier than current one
-      if (reportDate.isAtSameMomentAs(currentPair.start) ||
-          reportDate.isAtSameMomentAs(currentPair.end) ||
-          (closest != null &&
-              currentPair.start.isBefore(reportDate) &&
-              reportDate.isAfter(closest.start))) {
-        closest = currentPair;
-        continue;
-      }
-      if (reportDate.isAtSameMomentAs(currentPair.start) ||
-          (closest == null && currentPair.start.isBefore(reportDate))) {
-        closest = currentPair;
-        continue;
-      }
-    }
-
-    if (closest != null) {
-      logger.d(
-          'Found closest with ts ${closest.start} - ${closest.end} and ${closest.location.longitude} - ${closest.location.latitude}');
-      bool latIsClose =
-          (closest.location.latitude - report.latitude!).abs() <= 0.001;
-      bool lonIsClose =
-          (closest.location.longitude - report.longitude!).abs() <= 0.001;
-      if (latIsClose && lonIsClose) {
-        //similar
-        if (reportDate.isAfter(closest.end)) {
-          logger.d('Changing closest end date to $reportDate');
-          closest.end = reportDate;
-        } else {
-          logger.d('Date not changed, because is before current date.');
-        }
-      } else if (!reportDate.isAtSameMomentAs(closest.start) &&
-          !reportDate.isAtSameMomentAs(closest.end)) {
-        logger.d('Adding new one, because closest is too far away');
-        //not like before, so add new one
-        Pair<LatLng, DateTime> pair = Pair(
-            LatLng(report.latitude!, report.longitude!),
-            reportDate,
-            reportDate);
-        //add the new one
-        locationHistory.add(pair);
-        if (reportDate.isAfter(closest.start) &&
-            reportDate.isBefore(closest.end)) {
-          logger.d(
-              'Splitting closest, because new entry is in between with other location.');
-          //add the closest entry again with the end time only
-          locationHistory.add(Pair(
-              LatLng(closest.location.latitude, closest.location.longitude),
-              closest.end,
-              closest.end));
-          //change the existing closest entry end date to the former start date
-          closest.end = closest.start;
-        }
-      } else {
-        logger.w(
-            'New entry at $reportDate (Lon: ${report.location.longitude}, Lat: ${report.location.latitude}) will be skipped, because we have already an entry at other location. (Lon: ${closest.location.longitude}, Lat: ${closest.location.latitude})');
-      }
-    } else {
-      logger.d('Closest not found. Adding to list.');
-      //no report before
-      Pair<LatLng, DateTime> pair = Pair(
-          LatLng(report.latitude!, report.longitude!), reportDate, reportDate);
-      locationHistory.add(pair);
-    }
+    addLocationHistoryEntries([report]);
   }
 
-  void addLocationHistory(List<dynamic> historyList) {
-    locationHistory = historyList.map((item) {
-      return Pair.fromJson(item);
-    }).toList();
+  /// Adds the [reports], sorted by time, to the history with the rules of
+  /// [AccessoryHistoryIndex.add].
+  void addLocationHistoryEntries(Iterable<FindMyLocationReport> reports) {
+    var count = 0;
+    for (var report in reports) {
+      _historyIndex.add(report.timestamp ?? report.published!,
+          LatLng(report.latitude!, report.longitude!));
+      count++;
+    }
+    if (count > 0) {
+      _locationHistory = null;
+    }
+    logger.d('Added $count reports to a history of ${_historyIndex.length}');
   }
 
   DateTime latestHistoryEntry() {
@@ -360,37 +330,40 @@ class Accessory {
   }
 
   void addDecryptedHash(String? hash) {
-    if (hash != null && hash.length >= 10) {
-      hashesWithTS[hash.substring(hash.length - 10)] =
-          DateTime.now().millisecondsSinceEpoch;
-    }
+    reportHashes.add(hash);
+  }
+
+  /// Forgets the hashes added by [addDecryptedHash], e.g. if the decryption
+  /// of their reports was cancelled.
+  void removeDecryptedHashes(Iterable<String?> hashes) {
+    reportHashes.removeAll(hashes);
   }
 
   bool containsHash(String? hash) {
-    if (hash == null || hash.length < 10) {
-      return false;
-    }
+    return reportHashes.contains(hash);
+  }
 
-    return hashesWithTS.containsKey(hash.substring(hash.length - 10));
+  /// Remembers that the reports of the key [id] published until [published]
+  /// are known, so that they are not fetched again.
+  void addPublished(String? id, DateTime? published) {
+    if (id == null || published == null) {
+      return;
+    }
+    var millis = published.millisecondsSinceEpoch;
+    if ((publishedUntil[id] ?? 0) < millis) {
+      publishedUntil[id] = millis;
+    }
   }
 
   void removeOldHashes() {
-    hashesWithTS.removeWhere((key, value) {
-      int sevenDaysAgo =
-          DateTime.now().millisecondsSinceEpoch - (7 * 24 * 60 * 60 * 1000);
-      return value < sevenDaysAgo;
-    });
+    reportHashes.removeOld();
   }
 
   void clearLocationHistory() {
-    locationHistory.clear();
+    locationHistory = [];
   }
 
   List<Pair<dynamic, dynamic>> getSortedLocationHistory() {
-    locationHistory.sort((a, b) {
-      return a.start.compareTo(b.start);
-    });
-
     return locationHistory;
   }
 }
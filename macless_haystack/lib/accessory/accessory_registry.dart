@@ -3,18 +3,27 @@ import 'dart:convert';
 import 'package:flutter/material.dart';
 import 'package:flutter_secure_storage/flutter_secure_storage.dart';
 import 'package:logger/logger.dart';
+import 'package:macless_haystack/accessory/accessory_history_store.dart';
 import 'package:macless_haystack/accessory/accessory_model.dart';
 import 'package:latlong2/latlong.dart';
+import 'package:macless_haystack/findMy/decryption_scheduler.dart';
 import 'package:macless_haystack/findMy/find_my_controller.dart';
 import 'package:macless_haystack/findMy/models.dart';
 import 'package:flutter_settings_screens/flutter_settings_screens.dart';
 import 'package:macless_haystack/preferences/user_preferences_model.dart';
 
 const accessoryStorageKey = 'ACCESSORIES';
-const historyStorageKey = 'HISTORY';
 
 class AccessoryRegistry extends ChangeNotifier {
   var _storage = const FlutterSecureStorage();
+  late var _historyStore = AccessoryHistoryStore(_storage);
+
+  /// The loads of the history by accessory, each started once.
+  Map<Accessory, Future<void>> _historyLoads = Map.identity();
+
+  /// How often the history of each accessory was deleted, so that a history
+  /// decrypted before is not stored again.
+  final Map<Accessory, int> _historyDeletes = Map.identity();
   List<Accessory> _accessories = [];
   bool loading = false;
   bool initialLoadFinished = false;
@@ -23,6 +32,12 @@ class AccessoryRegistry extends ChangeNotifier {
     printer: PrettyPrinter(methodCount: 0),
   );
 
+  /// Decrypts the reports of a refresh, newest first.
+  final DecryptionScheduler _scheduler = DecryptionScheduler();
+
+  /// The accessories whose reports are being decrypted.
+  List<_HistoryFill> _fills = [];
+
   /// Creates the accessory registry.
   ///
   /// This is used to manage the accessories of the user.
@@ -56,7 +71,6 @@ class AccessoryRegistry extends ChangeNotifier {
     } else {
       _accessories = [];
     }
-    await loadHistory();
 
     loading = false;
 
@@ -65,28 +79,32 @@ class AccessoryRegistry extends ChangeNotifier {
 
   set setStorage(FlutterSecureStorage s) {
     _storage = s;
+    _historyStore = AccessoryHistoryStore(s);
+    _historyLoads = Map.identity();
   }
 
-  Future<void> loadHistory() async {
-    String? history = await _storage.read(key: historyStorageKey);
-    if (history != null) {
-      Map<String, dynamic> jsonDecoded = jsonDecode(history);
-      for (var item in _accessories) {
-        var currElement = jsonDecoded[item.id];
-        if (currElement != null) {
-          item.addLocationHistory(currElement);
-        }
-      }
-    }
+  /// Loads the stored history of [accessory] the first time it is needed,
+  /// so that the start does not wait for the history of all accessories.
+  Future<void> loadHistory(Accessory accessory) {
+    return _historyLoads.putIfAbsent(accessory, () async {
+      accessory.locationHistory = await _historyStore.load(accessory.id);
+    });
   }
 
   /// Fetches new location reports and matches them to their accessory.
-  Future<int> loadLocationReports(
-      Iterable<Accessory> currentAccessories) async {
-    List<Future<List<FindMyLocationReport>>> runningLocationRequests = [];
-
-    // request location updates for all accessories simultaneously
+  /// With [latestOnly] only the latest report of each key is fetched to
+  /// update the last locations. The history is left to the next full fetch
+  /// then, so that it gets the reports in between too.
+  Future<int> loadLocationReports(Iterable<Accessory> currentAccessories,
+      {bool latestOnly = false}) async {
+    if (!latestOnly) {
+      // A new refresh replaces the decryption of the last one
+      cancelDecryption();
+    }
+    // request location updates for all accessories in one batch
     String? url = Settings.getValue<String>(endpointUrl);
+    List<List<FindMyKeyPair>> keyPairsByAccessory = [];
+    Map<String, int> since = {};
     for (var i = 0; i < currentAccessories.length; i++) {
       var accessory = currentAccessories.elementAt(i);
 
@@ -100,15 +118,15 @@ class AccessoryRegistry extends ChangeNotifier {
               .toList();
 
       hashedPublicKeys.add(keyPair);
-
-      var locationRequest =
-          FindMyController.computeResults(hashedPublicKeys, url);
-      runningLocationRequests.add(locationRequest);
+      keyPairsByAccessory.add(hashedPublicKeys);
+      since.addAll(Map<String, int>.from(accessory.publishedUntil));
     }
 
-    var reportsForAccessories = await Future.wait(runningLocationRequests);
+    var reportsForAccessories = await FindMyController.computeResultsBatched(
+        keyPairsByAccessory, url,
+        since: since, limit: latestOnly ? 1 : null);
+    int workers = Settings.getValue<int>(decryptionWorkers, defaultValue: 0)!;
     int out = 0;
-    Map<Accessory, Future<List<Pair<dynamic, dynamic>>>> historyEntries = {};
     for (var i = 0; i < currentAccessories.length; i++) {
       var accessory = currentAccessories.elementAt(i);
       var reports = reportsForAccessories.elementAt(i);
@@ -132,47 +150,52 @@ class AccessoryRegistry extends ChangeNotifier {
           accessory.hasChangedFlag = true;
         }
       }
-      historyEntries[accessory] = fillLocationHistory(reports, accessory);
     }
     // Store updated lastLocation and datePublished for accessories
     _storeAccessories();
 
-    _storeHistory(historyEntries);
+    if (!latestOnly) {
+      var historyAccessories = currentAccessories.toList();
+      await Future.wait(historyAccessories.map(loadHistory));
+      var deletes = {
+        for (var accessory in historyAccessories)
+          accessory: _historyDeletes[accessory] ?? 0
+      };
+      fillLocationHistories(historyAccessories, reportsForAccessories,
+              workers: workers)
+          .then((_) => _storeHistory(deletes))
+          .catchError((Object e, StackTrace stackTrace) {
+        logger.e('Error on storing the history',
+            error: e, stackTrace: stackTrace);
+      });
+    }
 
     initialLoadFinished = true;
     notifyListeners();
     return Future.value(out);
   }
 
-  Future<void> _storeHistory(
-      Map<Accessory, Future<List<Pair<dynamic, dynamic>>>>
-          historyEntries) async {
-    Map<String, List<Pair<dynamic, dynamic>>> historyEntriesAsJson = {};
-    for (var entry in historyEntries.entries) {
-      Accessory key = entry.key;
-      Future<List<Pair<dynamic, dynamic>>> future = entry.value;
-      List<Pair<dynamic, dynamic>> result = await future;
-      var nowMinusDays = DateTime.now().subtract(const Duration(days: 7));
-      var upperDayLimit =
-          DateTime(nowMinusDays.year, nowMinusDays.month, nowMinusDays.day);
-      var filtered = result
-          .where((element) => element.end.isAfter(upperDayLimit))
-          .toList();
-      if (filtered.length != result.length) {
-        logger.i(
-            '${result.length - filtered.length} history elements have been filtered out and will be deleted due to age.');
+  /// Appends the new and changed history entries of the accessories to their
+  /// logs. [deletes] are the accessories with their count of deleted
+  /// histories when their reports were fetched. Accessories removed or
+  /// cleared since are skipped.
+  Future<void> _storeHistory(Map<Accessory, int> deletes) async {
+    for (var entry in deletes.entries) {
+      var accessory = entry.key;
+      if (!_accessories.contains(accessory) ||
+          (_historyDeletes[accessory] ?? 0) != entry.value) {
+        continue;
       }
-      historyEntriesAsJson[key.id] = filtered;
+      await _historyStore.store(accessory.id, accessory.locationHistory);
     }
-    //find all accessories not in list (inactive or single item refresh)
-    accessories
-        .where((a) => !historyEntriesAsJson.keys.toList().contains(a.id))
-        .forEach((a) {
-      historyEntriesAsJson[a.id] = a.locationHistory;
-    });
+  }
 
-    var historyJson = jsonEncode(historyEntriesAsJson);
-    _storage.write(key: historyStorageKey, value: historyJson);
+  /// Deletes the stored history of [accessory] after cancelling the
+  /// decryption, so that no reports are added to it afterwards.
+  void _deleteHistory(Accessory accessory) {
+    cancelDecryption();
+    _historyDeletes[accessory] = (_historyDeletes[accessory] ?? 0) + 1;
+    _historyStore.delete(accessory.id);
   }
 
   /// Stores the user's accessories in persistent storage.
@@ -203,78 +226,177 @@ class AccessoryRegistry extends ChangeNotifier {
   void removeAccessory(Accessory accessory) {
     _accessories.remove(accessory);
     accessory.getHashedPublicKey().then((publicKey) {
+      FindMyController.forgetKeyPair(publicKey);
       _storage.delete(key: publicKey);
     });
+    _deleteHistory(accessory);
 
     _storeAccessories();
     notifyListeners();
   }
 
+  /// Decrypts the new [reports] on [workers] threads (0: one per core) and
+  /// adds them to the history of [accessory].
   Future<List<Pair<dynamic, dynamic>>> fillLocationHistory(
-      List<FindMyLocationReport> reports, Accessory accessory) async {
-    List<FindMyLocationReport> decryptedReports = [];
-    //Decrypt only reports that are not already decrypted
-    Set<String> hashes = {};
-    int count = 0;
-    //This will be achieved by saving the hash(payload) of all already decrypted reports
-    for (var i = 0; i < reports.length; i++) {
-      var currHash = reports[i].hash;
-      if (!accessory.containsHash(currHash)) {
-        accessory.addDecryptedHash(currHash);
-        logger.d('Decrypting report $i of ${reports.length} with id $currHash');
-        await reports[i].decrypt();
-        decryptedReports.add(reports[i]);
-      } else {
-        count++;
+      List<FindMyLocationReport> reports, Accessory accessory,
+      {int workers = 0}) async {
+    await fillLocationHistories([accessory], [reports], workers: workers);
+    return accessory.locationHistory;
+  }
+
+  /// Decrypts the new reports of all [accessories], `reportsByAccessory[i]`
+  /// of accessory i, on [workers] threads (0: one per core) and adds them to
+  /// their history. The newest report of every accessory is decrypted first
+  /// to update its last location, then the others from the newest to the
+  /// oldest in chunks. After each chunk only the last locations are redrawn,
+  /// the reports are added to the history once the decryption is done.
+  /// The next call or [cancelDecryption] cancels it, the reports which were
+  /// not decrypted by then are fetched again by the next refresh.
+  /// Returns false if it was cancelled.
+  Future<bool> fillLocationHistories(List<Accessory> accessories,
+      List<List<FindMyLocationReport>> reportsByAccessory,
+      {int workers = 0}) async {
+    cancelDecryption();
+    List<_HistoryFill> fills = [];
+    for (var i = 0; i < accessories.length; i++) {
+      var fill = _HistoryFill(accessories[i]);
+      //Decrypt only reports that are not already decrypted
+      //This will be achieved by saving the hash(payload) of all already decrypted reports
+      for (var report in reportsByAccessory[i]) {
+        var currHash = report.hash;
+        if (!fill.accessory.containsHash(currHash)) {
+          fill.accessory.addDecryptedHash(currHash);
+          fill.newReports.add(report);
+        } else {
+          fill.published.add(report);
+          fill.skipped++;
+        }
       }
+      //Reports which are already decrypted are added right away
+      fill.addDecrypted(
+          fill.newReports.where((report) => !report.isEncrypted()));
+      fills.add(fill);
+    }
+    _fills = fills;
+    var changed = false;
+    for (var fill in fills) {
+      changed = _publishLatest(fill.accessory, fill.decrypted) || changed;
+    }
+    if (changed) {
+      notifyListeners();
+    }
 
-      hashes.add(currHash!);
+    var completed = await _scheduler.run(
+        fills.map((fill) => fill.newReports).toList(), (decrypted) {
+      var changed = false;
+      decrypted.forEach((i, reports) {
+        var chunk = reports.where((report) => !report.isEncrypted()).toList();
+        fills[i].addDecrypted(chunk);
+        changed = _publishLatest(fills[i].accessory, chunk) || changed;
+      });
+      if (changed) {
+        notifyListeners(); //redraw the UI with the latest locations so far
+      }
+    }, workers: workers);
+
+    if (completed) {
+      _fills = [];
+      _addToHistories(fills);
+      for (var fill in fills) {
+        //The reports are only marked as fetched once all are decrypted, so
+        //that a cancelled decryption fetches them again
+        for (var report in fill.published) {
+          fill.accessory.addPublished(report.id, report.published);
+        }
+        logger.d(
+            '${fill.newReports.length} reports decrypted. Decryption of ${fill.skipped} reports skipped, because they are already fetched and decrypted.');
+        //All hashes, that are not in the reports anymore can be deleted, because they are out of time
+        fill.accessory.removeOldHashes();
+      }
     }
-    logger.d(
-        '${reports.length - count} reports decrypted. Decryption of $count reports skipped, because they are already fetched and decrypted.');
-    //All hashes, that are not in the reports anymore can be deleted, because they are out of time
-    accessory.removeOldHashes();
-    //Sort by date
-    decryptedReports.sort((a, b) {
-      var aDate = a.timestamp ?? DateTime(1970);
-      var bDate = b.timestamp ?? DateTime(1970);
-      return aDate.compareTo(bDate);
-    });
+    _storeAccessories();
+    return completed;
+  }
 
-    //Update the latest timestamp
-    if (decryptedReports.isNotEmpty) {
-      var lastReport = decryptedReports[decryptedReports.length - 1];
-      var oldTs = accessory.datePublished;
-      var latestReportTS =
-          lastReport.timestamp ?? lastReport.published ?? DateTime(1971);
+  /// Cancels the decryption of [fillLocationHistories]. The history keeps the
+  /// reports decrypted so far, all others are forgotten to be decrypted by
+  /// the next refresh.
+  void cancelDecryption() {
+    _scheduler.cancel();
+    _addToHistories(_fills);
+    for (var fill in _fills) {
+      fill.accessory.removeDecryptedHashes(fill.newReports
+          .where((report) => report.isEncrypted())
+          .map((report) => report.hash));
+    }
+    _fills = [];
+  }
 
-      if (oldTs == null || oldTs.isBefore(latestReportTS)) {
-        //only an actualization if oldTS is not set or is older than the latest of the new ones
-        accessory.lastLocation =
-            LatLng(lastReport.latitude!, lastReport.longitude!);
-        accessory.datePublished = latestReportTS;
+  /// Updates the last location of [accessory] if the newest of the decrypted
+  /// [reports] is newer than it. Returns true if it was updated.
+  bool _publishLatest(
+      Accessory accessory, Iterable<FindMyLocationReport> reports) {
+    if (reports.isEmpty) {
+      return false;
+    }
+    var lastReport = reports.reduce((latest, report) =>
+        (report.timestamp ?? DateTime(1970))
+                .isBefore(latest.timestamp ?? DateTime(1970))
+            ? latest
+            : report);
+    var oldTs = accessory.datePublished;
+    var latestReportTS =
+        lastReport.timestamp ?? lastReport.published ?? DateTime(1971);
+
+    if (oldTs != null && !oldTs.isBefore(latestReportTS)) {
+      return false;
+    }
+    //only an actualization if oldTS is not set or is older than the latest of the new ones
+    accessory.lastLocation =
+        LatLng(lastReport.latitude!, lastReport.longitude!);
+    accessory.datePublished = latestReportTS;
 
-        //Update alway battery status
-        accessory.lastBatteryStatus = lastReport.batteryStatus;
+    //Update alway battery status
+    accessory.lastBatteryStatus = lastReport.batteryStatus;
 
-        accessory.hasChangedFlag = true;
+    accessory.hasChangedFlag = true;
+    return true;
+  }
 
-        notifyListeners(); //redraw the UI, if the timestamp has changed
+  /// Adds the reports of [fills] decrypted so far to the history of their
+  /// accessory at once and from the oldest to the newest, so the history is
+  /// the same however the decryption was split into chunks.
+  void _addToHistories(Iterable<_HistoryFill> fills) {
+    bool changed = false;
+    for (var fill in fills) {
+      if (fill.decrypted.isNotEmpty) {
+        _addLocationHistoryEntries(fill.accessory, fill.decrypted);
+        changed = true;
       }
     }
+    if (changed) {
+      notifyListeners();
+    }
+  }
+
+  void _addLocationHistoryEntries(
+      Accessory accessory, List<FindMyLocationReport> added) {
+    //Sort by date
+    added.sort((a, b) {
+      var aDate = a.timestamp ?? DateTime(1970);
+      var bDate = b.timestamp ?? DateTime(1970);
+      return aDate.compareTo(bDate);
+    });
 
-//add to history in correct order
-    for (var i = 0; i < decryptedReports.length; i++) {
-      FindMyLocationReport report = decryptedReports[i];
+    //add to history in correct order
+    accessory.addLocationHistoryEntries(added.where((report) {
       if (report.longitude!.abs() <= 180 && report.latitude!.abs() <= 90) {
-        accessory.addLocationHistoryEntry(report);
-      } else {
-        logger.d(
-            'Report skipped, because of anomaly data (lat: ${report.latitude}, lon: ${report.longitude}, acc: ${report.accuracy})');
+        return true;
       }
-    }
-    _storeAccessories();
-    return accessory.locationHistory;
+      logger.d(
+          'Report skipped, because of anomaly data (lat: ${report.latitude}, lon: ${report.longitude}, acc: ${report.accuracy})');
+      return false;
+    }));
   }
 
   /// Updates [oldAccessory] with the values from [newAccessory].
@@ -300,29 +422,18 @@ class AccessoryRegistry extends ChangeNotifier {
   }
 
   void deleteData(Accessory accessory) {
+    _deleteHistory(accessory);
     accessory.lastBatteryStatus = null;
     accessory.lastLocation = null;
-    accessory.hashesWithTS.clear();
+    accessory.reportHashes.clear();
+    accessory.publishedUntil.clear();
     accessory.datePublished = DateTime(1970);
     accessory.place = Future.value(null);
-    accessory.locationHistory.clear();
-    _removeHistoryEntry(accessory);
+    accessory.clearLocationHistory();
     _storeAccessories();
     notifyListeners();
   }
 
-  Future<void> _removeHistoryEntry(Accessory accessoryToRemove) async {
-    String? history = await _storage.read(key: historyStorageKey);
-    if (history == null || history.isEmpty) {
-      return;
-    }
-    Map<String, dynamic> historyMap = jsonDecode(history);
-
-    historyMap.remove(accessoryToRemove.id);
-
-    await _storage.write(key: historyStorageKey, value: jsonEncode(historyMap));
-  }
-
   void saveOrderUpdates(List<Accessory> newOrder) {
     final Map<Accessory, int> positionMap = {
       for (int i = 0; i < newOrder.length; i++) newOrder[i]: i,
@@ -331,3 +442,27 @@ class AccessoryRegistry extends ChangeNotifier {
     _storeAccessories();
   }
 }
+
+/// The state of the history of an accessory while its reports are decrypted.
+class _HistoryFill {
+  final Accessory accessory;
+
+  /// The reports which were not decrypted before.
+  final List<FindMyLocationReport> newReports = [];
+
+  /// The new reports decrypted so far.
+  final List<FindMyLocationReport> decrypted = [];
+
+  /// The reports marking the publication time of their key when done.
+  final List<FindMyLocationReport> published = [];
+  int skipped = 0;
+
+  _HistoryFill(this.accessory);
+
+  void addDecrypted(Iterable<FindMyLocationReport> reports) {
+    for (var report in reports) {
+      decrypted.add(report);
+      published.add(report);
+    }
+  }
+}
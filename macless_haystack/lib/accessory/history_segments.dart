@@ -0,0 +1,20 @@
+import 'dart:typed_data';
+
+export 'history_segments_storage.dart'
+    if (dart.library.io) 'history_segments_file.dart';
+
+/// The numbered segments of the history log of each accessory.
+abstract class HistorySegments {
+  /// Returns the numbers of the segments of [id] in ascending order.
+  Future<List<int>> list(String id);
+
+  Future<Uint8List> read(String id, int segment);
+
+  /// Appends [bytes] to the segment, which is created if missing.
+  Future<void> append(String id, int segment, Uint8List bytes);
+
+  Future<void> delete(String id, int segment);
+
+  /// Deletes all segments of [id].
+  Future<void> deleteAll(String id);
+}
@@ -0,0 +1,119 @@
+import 'dart:convert';
+import 'dart:math';
+import 'dart:typed_data';
+
+import 'package:flutter_secure_storage/flutter_secure_storage.dart';
+import 'package:logger/logger.dart';
+import 'package:macless_haystack/accessory/history_segments.dart';
+import 'package:pointycastle/export.dart';
+
+/// Key of the AES key of the history logs in the secure storage.
+const historyKeyStorageKey = 'HISTORY_KEY';
+
+/// Encrypts the segments of another [HistorySegments] with AES-GCM under a
+/// random key, which is kept in the secure storage.
+/// Every append is a frame of its own, so the segments stay append-only: the
+/// length of the cipher text (little endian uint32), the nonce and the cipher
+/// text with the tag. The id and number of the segment are authenticated, so
+/// frames cannot be moved to another segment.
+class EncryptedHistorySegments implements HistorySegments {
+  static const _keySize = 32;
+  static const _nonceSize = 12;
+  static const _tagSize = 16;
+  static const _headerSize = 4 + _nonceSize;
+
+  final HistorySegments _segments;
+  final FlutterSecureStorage _storage;
+  final Random _random = Random.secure();
+  Future<Uint8List>? _key;
+
+  var logger = Logger(
+    printer: PrettyPrinter(methodCount: 0),
+  );
+
+  EncryptedHistorySegments(this._segments, this._storage);
+
+  @override
+  Future<List<int>> list(String id) => _segments.list(id);
+
+  /// Returns the plain text of the frames of the segment. A frame which is
+  /// incomplete or cannot be decrypted ends the segment. It is returned as
+  /// one more byte, an incomplete record, so that the log continues in a new
+  /// segment.
+  @override
+  Future<Uint8List> read(String id, int segment) async {
+    final key = await _loadKey();
+    final bytes = await _segments.read(id, segment);
+    final data = ByteData.sublistView(bytes);
+    final plainText = BytesBuilder(copy: false);
+    for (var offset = 0; offset < bytes.length;) {
+      final length = offset + _headerSize <= bytes.length
+          ? data.getUint32(offset, Endian.little)
+          : 0;
+      final end = offset + _headerSize + length;
+      if (length < _tagSize || end > bytes.length) {
+        plainText.addByte(0);
+        break;
+      }
+      final nonce =
+          Uint8List.sublistView(bytes, offset + 4, offset + _headerSize);
+      try {
+        plainText.add(_cipher(false, key, id, segment, nonce)
+            .process(Uint8List.sublistView(bytes, offset + _headerSize, end)));
+      } on InvalidCipherTextException {
+        logger.w('Could not decrypt segment $segment of the history of $id');
+        plainText.addByte(0);
+        break;
+      }
+      offset = end;
+    }
+    return plainText.takeBytes();
+  }
+
+  @override
+  Future<void> append(String id, int segment, Uint8List bytes) async {
+    final key = await _loadKey();
+    final nonce = _randomBytes(_nonceSize);
+    final cipherText = _cipher(true, key, id, segment, nonce).process(bytes);
+    final frame = Uint8List(_headerSize + cipherText.length)
+      ..setAll(4, nonce)
+      ..setAll(_headerSize, cipherText);
+    ByteData.sublistView(frame).setUint32(0, cipherText.length, Endian.little);
+    await _segments.append(id, segment, frame);
+  }
+
+  @override
+  Future<void> delete(String id, int segment) => _segments.delete(id, segment);
+
+  @override
+  Future<void> deleteAll(String id) => _segments.deleteAll(id);
+
+  /// Reads the key, or creates it on first use. If that fails, it is tried
+  /// again by the next operation.
+  Future<Uint8List> _loadKey() =>
+      _key ??= _readKey().catchError((Object e, StackTrace stackTrace) {
+        _key = null;
+        return Future<Uint8List>.error(e, stackTrace);
+      });
+
+  Future<Uint8List> _readKey() async {
+    final stored = await _storage.read(key: historyKeyStorageKey);
+    if (stored != null) {
+      return base64Decode(stored);
+    }
+    final key = _randomBytes(_keySize);
+    await _storage.write(key: historyKeyStorageKey, value: base64Encode(key));
+    return key;
+  }
+
+  Uint8List _randomBytes(int length) =>
+      Uint8List.fromList(List.generate(length, (_) => _random.nextInt(256)));
+
+  static GCMBlockCipher _cipher(bool encrypt, Uint8List key, String id,
+          int segment, Uint8List nonce) =>
+      GCMBlockCipher(AESEngine())
+        ..init(
+            encrypt,
+            AEADParameters(KeyParameter(key), _tagSize * 8, nonce,
+                Uint8List.fromList(utf8.encode('$id/$segment'))));
+}
@@ -0,0 +1,71 @@
+import 'dart:io';
+import 'dart:typed_data';
+
+import 'package:flutter_secure_storage/flutter_secure_storage.dart';
+import 'package:macless_haystack/accessory/history_segments.dart';
+import 'package:macless_haystack/accessory/history_segments_encrypted.dart';
+import 'package:path_provider/path_provider.dart';
+
+/// Keeps the segments as files in the application support directory, one
+/// directory per accessory, encrypted with a key in the secure [storage].
+HistorySegments createHistorySegments(FlutterSecureStorage storage) =>
+    EncryptedHistorySegments(_FileSegments(), storage);
+
+class _FileSegments implements HistorySegments {
+  Future<Directory>? _root;
+
+  Future<Directory> _directory(String id) async {
+    final root = await (_root ??= getApplicationSupportDirectory()
+        .then((directory) => Directory('${directory.path}/history')));
+    return Directory('${root.path}/accessory_${Uri.encodeComponent(id)}');
+  }
+
+  Future<File> _file(String id, int segment) async =>
+      File('${(await _directory(id)).path}/$segment.log');
+
+  @override
+  Future<List<int>> list(String id) async {
+    final directory = await _directory(id);
+    if (!await directory.exists()) {
+      return [];
+    }
+    List<int> segments = [];
+    await for (var file in directory.list()) {
+      final name = file.uri.pathSegments.last;
+      final segment = name.endsWith('.log')
+          ? int.tryParse(name.substring(0, name.length - 4))
+          : null;
+      if (segment != null) {
+        segments.add(segment);
+      }
+    }
+    return segments..sort();
+  }
+
+  @override
+  Future<Uint8List> read(String id, int segment) async =>
+      (await _file(id, segment)).readAsBytes();
+
+  @override
+  Future<void> append(String id, int segment, Uint8List bytes) async {
+    final file = await _file(id, segment);
+    await file.parent.create(recursive: true);
+    await file.writeAsBytes(bytes, mode: FileMode.append, flush: true);
+  }
+
+  @override
+  Future<void> delete(String id, int segment) async {
+    final file = await _file(id, segment);
+    if (await file.exists()) {
+      await file.delete();
+    }
+  }
+
+  @override
+  Future<void> deleteAll(String id) async {
+    final directory = await _directory(id);
+    if (await directory.exists()) {
+      await directory.delete(recursive: true);
+    }
+  }
+}
@@ -0,0 +1,72 @@
+import 'dart:convert';
+import 'dart:typed_data';
+
+import 'package:flutter_secure_storage/flutter_secure_storage.dart';
+import 'package:macless_haystack/accessory/history_segments.dart';
+
+/// Keeps the segments Base64 encoded in [storage] where there are no files
+/// (web). The numbers of the segments of an accessory are kept as a list
+/// under their own key.
+HistorySegments createHistorySegments(FlutterSecureStorage storage) =>
+    _StorageSegments(storage);
+
+class _StorageSegments implements HistorySegments {
+  final FlutterSecureStorage _storage;
+
+  _StorageSegments(this._storage);
+
+  String _listKey(String id) => 'HISTORY_SEGMENTS_$id';
+
+  String _key(String id, int segment) => 'HISTORY_${segment}_$id';
+
+  Future<void> _writeList(String id, List<int> segments) async {
+    if (segments.isEmpty) {
+      await _storage.delete(key: _listKey(id));
+    } else {
+      await _storage.write(key: _listKey(id), value: jsonEncode(segments));
+    }
+  }
+
+  @override
+  Future<List<int>> list(String id) async {
+    final segments = await _storage.read(key: _listKey(id));
+    if (segments == null) {
+      return [];
+    }
+    return List<int>.from(jsonDecode(segments) as List)..sort();
+  }
+
+  @override
+  Future<Uint8List> read(String id, int segment) async {
+    final bytes = await _storage.read(key: _key(id, segment));
+    return bytes == null ? Uint8List(0) : base64Decode(bytes);
+  }
+
+  @override
+  Future<void> append(String id, int segment, Uint8List bytes) async {
+    final old = await read(id, segment);
+    await _storage.write(
+        key: _key(id, segment),
+        value: base64Encode(Uint8List(old.length + bytes.length)
+          ..setAll(0, old)
+          ..setAll(old.length, bytes)));
+    final segments = await list(id);
+    if (!segments.contains(segment)) {
+      await _writeList(id, segments..add(segment));
+    }
+  }
+
+  @override
+  Future<void> delete(String id, int segment) async {
+    await _storage.delete(key: _key(id, segment));
+    await _writeList(id, (await list(id))..remove(segment));
+  }
+
+  @override
+  Future<void> deleteAll(String id) async {
+    for (var segment in await list(id)) {
+      await _storage.delete(key: _key(id, segment));
+    }
+    await _writeList(id, []);
+  }
+}
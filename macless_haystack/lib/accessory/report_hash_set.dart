@@ -0,0 +1,267 @@
+import 'dart:collection';
+import 'dart:typed_data';
+
+/// The hashes of the reports of an accessory which were decrypted in the last
+/// [days] days, so that they are not decrypted again.
+///
+/// Instead of the hashes, a sorted list of 64-bit fingerprints is kept for
+/// each day, and days which are too old are dropped as a whole. A hash takes
+/// 8 bytes in memory and about 10.7 bytes (Base64) in the stored accessory,
+/// where an entry of the former hashesWithTS JSON took 31 bytes.
+/// A new report is mistaken for a decrypted one and skipped if the suffixes
+/// of their hashes are the same. The hash is the Base64 payload, so the
+/// suffix of an 88-byte payload ends in `==` and carries only 44 bits (52
+/// bits for 89 bytes). With n hashes at most about n / 2^44 of the new
+/// reports are skipped, the 64-bit fingerprints add practically nothing.
+class ReportHashSet {
+  static const days = 7;
+
+  /// Hashes are identified by their last characters, like the keys of the
+  /// former hashesWithTS.
+  static const _hashSuffixLength = 10;
+  static const _version = 1;
+  static const _millisecondsPerDay = 24 * 60 * 60 * 1000;
+
+  /// The fingerprints by the day (since epoch) they were added.
+  final SplayTreeMap<int, _DayFingerprints> _days = SplayTreeMap();
+
+  ReportHashSet();
+
+  /// Takes the former hashesWithTS: the time (milliseconds since epoch) each
+  /// hash was added by the last characters of the hash.
+  ReportHashSet.fromTimestamps(Map<String, dynamic> hashesWithTS) {
+    hashesWithTS.forEach((suffix, added) {
+      _day(DateTime.fromMillisecondsSinceEpoch(added))
+          .add(_fingerprint(suffix));
+    });
+  }
+
+  /// Reads the format of [toBytes].
+  /// Throws [FormatException] if [bytes] are not in this format.
+  ReportHashSet.fromBytes(Uint8List bytes) {
+    final data = ByteData.sublistView(bytes);
+    if (bytes.isEmpty || bytes[0] != _version) {
+      throw const FormatException('Unknown report hash format');
+    }
+    var offset = 1;
+    while (offset < bytes.length) {
+      if (offset + 8 > bytes.length) {
+        throw const FormatException('Truncated report hashes');
+      }
+      final day = data.getUint32(offset, Endian.little);
+      final count = data.getUint32(offset + 4, Endian.little);
+      offset += 8;
+      if (offset + count * 8 > bytes.length) {
+        throw const FormatException('Truncated report hashes');
+      }
+      List<_Fingerprint> fingerprints = [
+        for (var i = 0; i < count; i++, offset += 8)
+          (
+            data.getUint32(offset + 4, Endian.little),
+            data.getUint32(offset, Endian.little)
+          )
+      ];
+      _days[day] = _DayFingerprints.sorted(fingerprints);
+    }
+  }
+
+  /// Writes a version byte, then for every day its number and the number of
+  /// its fingerprints as little endian uint32 and the fingerprints as little
+  /// endian uint64. A uint64 is written as two uint32, which works on the web
+  /// too.
+  Uint8List toBytes() {
+    final lists = {
+      for (var entry in _days.entries) entry.key: entry.value.fingerprints()
+    };
+    final bytes = Uint8List(1 +
+        lists.values.fold(0, (size, list) => size + 8 + list.length * 8));
+    final data = ByteData.sublistView(bytes);
+    bytes[0] = _version;
+    var offset = 1;
+    lists.forEach((day, fingerprints) {
+      data.setUint32(offset, day, Endian.little);
+      data.setUint32(offset + 4, fingerprints.length, Endian.little);
+      offset += 8;
+      for (var (high, low) in fingerprints) {
+        data.setUint32(offset, low, Endian.little);
+        data.setUint32(offset + 4, high, Endian.little);
+        offset += 8;
+      }
+    });
+    return bytes;
+  }
+
+  /// The number of hashes.
+  int get length => _days.values.fold(0, (size, day) => size + day.length);
+
+  /// Returns true if [hash] was added. Hashes shorter than the identifying
+  /// suffix are never added.
+  bool contains(String? hash) {
+    final fingerprint = _fingerprintOf(hash);
+    return fingerprint != null &&
+        _days.values.any((day) => day.contains(fingerprint));
+  }
+
+  void add(String? hash) {
+    final fingerprint = _fingerprintOf(hash);
+    if (fingerprint != null) {
+      _day(DateTime.now()).add(fingerprint);
+    }
+  }
+
+  void removeAll(Iterable<String?> hashes) {
+    final fingerprints =
+        hashes.map(_fingerprintOf).whereType<_Fingerprint>().toSet();
+    if (fingerprints.isNotEmpty) {
+      for (var day in _days.values) {
+        day.removeAll(fingerprints);
+      }
+    }
+  }
+
+  /// Drops the hashes which were added more than [days] days ago.
+  void removeOld() {
+    final oldest = _dayOf(DateTime.now()) - days;
+    _days.removeWhere((day, fingerprints) => day < oldest);
+  }
+
+  void clear() {
+    _days.clear();
+  }
+
+  _DayFingerprints _day(DateTime date) =>
+      _days.putIfAbsent(_dayOf(date), () => _DayFingerprints());
+
+  static int _dayOf(DateTime date) =>
+      date.millisecondsSinceEpoch ~/ _millisecondsPerDay;
+
+  static _Fingerprint? _fingerprintOf(String? hash) {
+    if (hash == null || hash.length < _hashSuffixLength) {
+      return null;
+    }
+    return _fingerprint(hash.substring(hash.length - _hashSuffixLength));
+  }
+
+  /// 64-bit FNV-1a on the high and low 32 bits of the hash, so that it stays
+  /// exact on the web. The multiplication by the prime 2^40 + 435 is split
+  /// into products below 2^53.
+  static _Fingerprint _fingerprint(String suffix) {
+    var high = 0xcbf29ce4;
+    var low = 0x84222325;
+    for (var unit in suffix.codeUnits) {
+      low ^= unit;
+      final lowProduct = low * 435;
+      final lowBits = lowProduct & 0xffffffff;
+      high = (high * 435 +
+              (lowProduct - lowBits) ~/ 0x100000000 +
+              ((low << 8) & 0xffffffff)) &
+          0xffffffff;
+      low = lowBits;
+    }
+    return (high, low);
+  }
+}
+
+/// A 64-bit fingerprint as its high and low 32 bits.
+typedef _Fingerprint = (int high, int low);
+
+/// The fingerprints of a day: a sorted list for binary search, and the ones
+/// added since it was sorted last.
+class _DayFingerprints {
+  /// The number of added fingerprints which are sorted in at once.
+  static const _maxAdded = 256;
+
+  /// The high and low 32 bits of each fingerprint after each other.
+  Uint32List _sorted;
+  final List<_Fingerprint> _added = [];
+
+  _DayFingerprints() : _sorted = Uint32List(0);
+
+  _DayFingerprints.sorted(List<_Fingerprint> fingerprints)
+      : _sorted = _pack(fingerprints..sort(_compare));
+
+  int get length => (_sorted.length >> 1) + _added.length;
+
+  bool contains(_Fingerprint fingerprint) {
+    final count = _sorted.length >> 1;
+    var start = 0;
+    var end = count;
+    while (start < end) {
+      final middle = (start + end) >> 1;
+      if (_compare(_at(middle), fingerprint) < 0) {
+        start = middle + 1;
+      } else {
+        end = middle;
+      }
+    }
+    return (start < count && _at(start) == fingerprint) ||
+        _added.contains(fingerprint);
+  }
+
+  void add(_Fingerprint fingerprint) {
+    _added.add(fingerprint);
+    if (_added.length >= _maxAdded) {
+      _sort();
+    }
+  }
+
+  void removeAll(Set<_Fingerprint> fingerprints) {
+    _added.removeWhere(fingerprints.contains);
+    final sorted = _unpack();
+    if (sorted.any(fingerprints.contains)) {
+      _sorted = _pack(sorted
+          .where((fingerprint) => !fingerprints.contains(fingerprint))
+          .toList());
+    }
+  }
+
+  /// Returns all fingerprints, sorted.
+  List<_Fingerprint> fingerprints() {
+    _sort();
+    return _unpack();
+  }
+
+  _Fingerprint _at(int i) => (_sorted[2 * i], _sorted[2 * i + 1]);
+
+  List<_Fingerprint> _unpack() =>
+      [for (var i = 0; i < _sorted.length >> 1; i++) _at(i)];
+
+  /// Sorts the added fingerprints and merges them into the sorted ones.
+  void _sort() {
+    if (_added.isEmpty) {
+      return;
+    }
+    _added.sort(_compare);
+    final count = _sorted.length >> 1;
+    final merged = Uint32List(_sorted.length + 2 * _added.length);
+    var i = 0;
+    var j = 0;
+    for (var k = 0; k < merged.length; k += 2) {
+      final _Fingerprint next;
+      if (j >= _added.length ||
+          (i < count && _compare(_at(i), _added[j]) <= 0)) {
+        next = _at(i++);
+      } else {
+        next = _added[j++];
+      }
+      merged[k] = next.$1;
+      merged[k + 1] = next.$2;
+    }
+    _sorted = merged;
+    _added.clear();
+  }
+
+  static int _compare(_Fingerprint a, _Fingerprint b) {
+    final byHigh = a.$1.compareTo(b.$1);
+    return byHigh != 0 ? byHigh : a.$2.compareTo(b.$2);
+  }
+
+  static Uint32List _pack(List<_Fingerprint> fingerprints) {
+    final packed = Uint32List(2 * fingerprints.length);
+    for (var i = 0; i < fingerprints.length; i++) {
+      packed[2 * i] = fingerprints[i].$1;
+      packed[2 * i + 1] = fingerprints[i].$2;
+    }
+    return packed;
+  }
+}
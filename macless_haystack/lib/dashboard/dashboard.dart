@@ -54,9 +54,13 @@ class _DashboardState extends State<Dashboard> {
     },
   ];
 
+  /// The registry, kept to cancel its decryption when the dashboard is left.
+  late final AccessoryRegistry _accessoryRegistry;
+
   @override
   void initState() {
     super.initState();
+    _accessoryRegistry = Provider.of<AccessoryRegistry>(context, listen: false);
 
     // Initialize models and preferences
     var userPreferences = Provider.of<UserPreferences>(context, listen: false);
@@ -67,10 +71,15 @@ class _DashboardState extends State<Dashboard> {
     if (!locationPreferenceKnown || locationAccessWanted) {
       locationModel.requestLocationUpdates();
     }
-    // Load new location reports on app start
+    // Load new location reports on app start. The latest locations are shown
+    // first, the history follows.
     if (Settings.getValue<bool>(fetchLocationOnStartupKey,
         defaultValue: true)!) {
-      loadLocationUpdates(null);
+      loadLatestLocations().then((_) {
+        if (mounted) {
+          loadLocationUpdates(null);
+        }
+      });
     }
   }
 
@@ -78,6 +87,28 @@ class _DashboardState extends State<Dashboard> {
     printer: PrettyPrinter(),
   );
 
+  @override
+  void dispose() {
+    // Reports which are not decrypted yet are decrypted by the next refresh
+    _accessoryRegistry.cancelDecryption();
+    super.dispose();
+  }
+
+  /// Fetch only the latest location of all active accessories, which is much
+  /// less to transfer and decrypt than their history.
+  Future<void> loadLatestLocations() async {
+    var accessoryRegistry =
+        Provider.of<AccessoryRegistry>(context, listen: false);
+    try {
+      await accessoryRegistry.loadLocationReports(
+          accessoryRegistry.accessories.where((a) => a.isActive),
+          latestOnly: true);
+    } catch (e, stacktrace) {
+      logger.e('Error on fetching the latest locations',
+          error: e, stackTrace: stacktrace);
+    }
+  }
+
   /// Fetch location updates for all accessories.
   Future<void> loadLocationUpdates(Accessory? accessory) async {
     var accessoryRegistry =
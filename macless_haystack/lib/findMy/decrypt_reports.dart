@@ -5,27 +5,130 @@ import 'package:pointycastle/export.dart';
 // ignore: implementation_imports
 import 'package:pointycastle/src/utils.dart' as pc_utils;
 import 'package:macless_haystack/findMy/models.dart';
+import 'package:macless_haystack/findMy/decryption_pool.dart';
+import 'package:macless_haystack/findMy/native_decryption.dart';
 import 'package:macless_haystack/accessory/accessory_battery.dart';
 
 class DecryptReports {
+  /// Layout of the records returned by the native library
+  /// (see haystack_native.h).
+  static const _recordSize = 16;
+  static const _recordPlaintextOffset = 5;
+  static const _recordStatusOffset = 15;
+  static const _recordStatusMalformed = 1;
+  static const _recordStatusTagMismatch = 4;
+
+  /// Decrypts the given [FindMyReport]s in one batch. Report i is decrypted
+  /// with the private key `keys[keyIndices[i]]`. The native library is used
+  /// if it is available, otherwise every report is decrypted on its own.
+  /// Returns the decrypted reports, null for reports that could not be
+  /// decrypted or failed authentication.
+  static Future<List<FindMyLocationReport?>> decryptReports(
+      List<FindMyReport> reports,
+      List<Uint8List> keys,
+      List<int> keyIndices) async {
+    final records = decryptReportsNative(
+        reports.map((report) => report.payload).toList(), keys, keyIndices);
+    if (records == null) {
+      List<FindMyLocationReport?> results = [];
+      for (var i = 0; i < reports.length; i++) {
+        try {
+          results.add(await decryptReport(reports[i], keys[keyIndices[i]]));
+        } catch (e) {
+          results.add(null);
+        }
+      }
+      return results;
+    }
+
+    return List.generate(
+        reports.length,
+        (i) => _decodeRecord(
+            Uint8List.sublistView(
+                records, i * _recordSize, (i + 1) * _recordSize),
+            reports[i]));
+  }
+
+  /// Decrypts the given [FindMyReport]s like [decryptReports], but emits the
+  /// results as soon as they are ready, by index into [reports]. The native
+  /// library decrypts on a pool of [workers] threads (0: one per core),
+  /// without it a pool of as many isolates decrypts them. Only on the web all
+  /// results are emitted at once.
+  static Stream<Map<int, FindMyLocationReport?>> decryptReportsInBatches(
+      List<FindMyReport> reports, List<Uint8List> keys, List<int> keyIndices,
+      {int workers = 0}) {
+    final payloads = reports.map((report) => report.payload).toList();
+    final batches = decryptReportsNativeStream(payloads, keys, keyIndices,
+            workers: workers) ??
+        decryptReportsPooled(payloads, keys, keyIndices, workers: workers);
+    if (batches == null) {
+      return Stream.fromFuture(decryptReports(reports, keys, keyIndices))
+          .map((results) => results.asMap());
+    }
+    return batches.map((records) => records.map(
+        (i, record) => MapEntry(i, _decodeRecord(record, reports[i]))));
+  }
+
+  /// Decodes a record of the native library. The record starts with the
+  /// unencrypted time and confidence exactly as in the payload, followed by
+  /// the decrypted location.
+  static FindMyLocationReport? _decodeRecord(
+      Uint8List record, FindMyReport report) {
+    if (record[_recordStatusOffset] != 0) {
+      return null;
+    }
+    _decodeTimeAndConfidence(record, report);
+    return _decodePayload(
+        record.sublist(_recordPlaintextOffset, _recordStatusOffset), report);
+  }
+
   /// Decrypts a given [FindMyReport] with the given private key.
+  /// Throws an [InvalidCipherTextException] if the authentication tag of the
+  /// report does not match.
   static Future<FindMyLocationReport> decryptReport(
       FindMyReport report, Uint8List key) async {
-    final curveDomainParam = ECCurve_secp224r1();
-    var payloadData = report.payload;
+    final payloadData = _normalizePayload(report.payload);
+    _decodeTimeAndConfidence(payloadData, report);
+    return _decodePayload(_decryptLocation(payloadData, key), report);
+  }
+
+  /// Decrypts [payload] with [key] into a record in the layout of the native
+  /// library, so that the decryption isolates return no objects.
+  static Uint8List decryptToRecord(Uint8List payload, Uint8List key) {
+    final record = Uint8List(_recordSize);
+    try {
+      final payloadData = _normalizePayload(payload);
+      record.setRange(0, _recordPlaintextOffset, payloadData);
+      record.setRange(_recordPlaintextOffset, _recordStatusOffset,
+          _decryptLocation(payloadData, key));
+    } on InvalidCipherTextException {
+      record.fillRange(_recordPlaintextOffset, _recordStatusOffset, 0);
+      record[_recordStatusOffset] = _recordStatusTagMismatch;
+    } catch (e) {
+      record.fillRange(_recordPlaintextOffset, _recordStatusOffset, 0);
+      record[_recordStatusOffset] = _recordStatusMalformed;
+    }
+    return record;
+  }
+
+  /// Drops the extra byte 4 of 89 byte payloads.
+  static Uint8List _normalizePayload(Uint8List payloadData) {
     if (payloadData.length > 88) {
       final modifiedData = Uint8List(payloadData.length - 1);
       modifiedData.setRange(0, 4, payloadData);
       modifiedData.setRange(4, modifiedData.length, payloadData, 5);
       payloadData = modifiedData;
     }
+    return payloadData;
+  }
 
+  /// Decrypts the location of a normalized payload with the private [key].
+  static Uint8List _decryptLocation(Uint8List payloadData, Uint8List key) {
+    final curveDomainParam = ECCurve_secp224r1();
     final ephemeralKeyBytes = payloadData.sublist(5, 62);
     final encData = payloadData.sublist(62, 72);
     final tag = payloadData.sublist(72, payloadData.length);
 
-    _decodeTimeAndConfidence(payloadData, report);
-
     final privateKey =
         ECPrivateKey(pc_utils.decodeBigIntWithSign(1, key), curveDomainParam);
 
@@ -35,10 +138,7 @@ class DecryptReports {
     final Uint8List sharedKeyBytes = _ecdh(ephemeralPublicKey, privateKey);
     final Uint8List derivedKey = _kdf(sharedKeyBytes, ephemeralKeyBytes);
 
-    final decryptedPayload = _decryptPayload(encData, derivedKey, tag);
-    final locationReport = _decodePayload(decryptedPayload, report);
-
-    return locationReport;
+    return _decryptPayload(encData, derivedKey, tag);
   }
 
   /// Decodes the unencrypted timestamp and confidence
@@ -112,6 +212,7 @@ class DecryptReports {
   }
 
   /// Decrypts the given cipher text with the key data using an AES-GCM block cipher.
+  /// The tag is verified before any data is returned.
   /// Returns the decrypted raw data.
   static Uint8List _decryptPayload(
       Uint8List cipherText, Uint8List symmetricKey, Uint8List tag) {
@@ -121,16 +222,15 @@ class DecryptReports {
     final aesGcm = GCMBlockCipher(AESEngine())
       ..init(
           false,
-          AEADParameters(
-              KeyParameter(decryptionKey), tag.lengthInBytes * 8, iv, tag));
+          AEADParameters(KeyParameter(decryptionKey), tag.lengthInBytes * 8,
+              iv, Uint8List(0)));
 
-    final plainText = Uint8List(cipherText.length);
-    var offset = 0;
-    while (offset < cipherText.length) {
-      offset += aesGcm.processBlock(cipherText, offset, plainText, offset);
-    }
+    final input = Uint8List(cipherText.length + tag.length)
+      ..setAll(0, cipherText)
+      ..setAll(cipherText.length, tag);
+    final plainText = aesGcm.process(input);
 
-    assert(offset == cipherText.length);
+    assert(plainText.length == cipherText.length);
     return plainText;
   }
 
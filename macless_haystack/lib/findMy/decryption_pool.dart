@@ -0,0 +1,2 @@
+export 'decryption_pool_stub.dart'
+    if (dart.library.isolate) 'decryption_pool_isolate.dart';
@@ -0,0 +1,152 @@
+import 'dart:async';
+import 'dart:io';
+import 'dart:isolate';
+import 'dart:math';
+import 'dart:typed_data';
+
+import 'package:macless_haystack/findMy/decrypt_reports.dart';
+
+/// Size of a result record, the same as of the native library
+/// (see haystack_native.h).
+const _recordSize = 16;
+
+/// Number of reports sent to an isolate at once.
+const _chunkSize = 32;
+
+/// Decrypts the given payloads on a persistent pool of [workers] isolates
+/// (0: one per core) without the native library. Emits the result records by
+/// report index whenever an isolate finished a chunk of reports. The records
+/// have the layout of the native library, so only bytes are passed between
+/// the isolates.
+Stream<Map<int, Uint8List>>? decryptReportsPooled(List<Uint8List> payloads,
+    List<Uint8List> privateKeys, List<int> keyIndices,
+    {int workers = 0}) {
+  if (workers <= 0) {
+    workers = Platform.numberOfProcessors;
+  }
+  final controller = StreamController<Map<int, Uint8List>>();
+  var cancelled = false;
+  controller.onCancel = () {
+    cancelled = true;
+  };
+  var next = 0;
+
+  // Every isolate takes the next chunk as soon as it is done with its last one
+  Future<void> run(_DecryptionIsolate isolate) async {
+    while (next < payloads.length && !cancelled) {
+      final start = next;
+      final end = min(start + _chunkSize, payloads.length);
+      next = end;
+      final records = await isolate.decrypt(payloads.sublist(start, end),
+          privateKeys, keyIndices.sublist(start, end));
+      controller.add({
+        for (var i = start; i < end; i++)
+          i: Uint8List.sublistView(
+              records, (i - start) * _recordSize, (i - start + 1) * _recordSize)
+      });
+    }
+  }
+
+  final size = max(1, min(workers, (payloads.length / _chunkSize).ceil()));
+  _DecryptionIsolate.pool(size)
+      .then((pool) => Future.wait(pool.map(run)))
+      .then((_) => controller.close(), onError: (Object e, StackTrace s) {
+    controller.addError(e, s);
+    controller.close();
+  });
+  return controller.stream;
+}
+
+/// An isolate decrypting chunks of reports into records.
+class _DecryptionIsolate {
+  /// The isolates of the pool. They are started on first use and kept for
+  /// the next reports.
+  static final List<Future<_DecryptionIsolate>> _pool = [];
+
+  final ReceivePort _responses = ReceivePort();
+  late final SendPort _requests;
+  final Map<int, Completer<Uint8List>> _pending = {};
+  int _nextId = 0;
+
+  /// Returns the first [size] isolates of the pool, starting missing ones.
+  static Future<List<_DecryptionIsolate>> pool(int size) {
+    while (_pool.length < size) {
+      _pool.add(_spawn());
+    }
+    return Future.wait(_pool.take(size));
+  }
+
+  static Future<_DecryptionIsolate> _spawn() async {
+    final isolate = _DecryptionIsolate();
+    final ready = Completer<SendPort>();
+    isolate._responses.listen((message) {
+      if (message is SendPort) {
+        ready.complete(message);
+        return;
+      }
+      final id = message[0] as int;
+      final records = message[1] as TransferableTypedData;
+      isolate._pending
+          .remove(id)!
+          .complete(records.materialize().asUint8List());
+    });
+    await Isolate.spawn(_main, isolate._responses.sendPort,
+        debugName: 'decryption');
+    isolate._requests = await ready.future;
+    return isolate;
+  }
+
+  /// Decrypts report i of [payloads] with `privateKeys[keyIndices[i]]`.
+  /// Returns [_recordSize] bytes per report.
+  Future<Uint8List> decrypt(List<Uint8List> payloads,
+      List<Uint8List> privateKeys, List<int> keyIndices) {
+    final id = _nextId++;
+    final completer = Completer<Uint8List>();
+    _pending[id] = completer;
+    // The bytes are moved instead of copied into the isolate
+    _requests.send([
+      id,
+      TransferableTypedData.fromList(payloads),
+      payloads.map((payload) => payload.length).toList(),
+      TransferableTypedData.fromList(privateKeys),
+      privateKeys.map((key) => key.length).toList(),
+      keyIndices,
+    ]);
+    return completer.future;
+  }
+
+  static void _main(SendPort responses) {
+    final requests = ReceivePort();
+    responses.send(requests.sendPort);
+    requests.listen((message) {
+      final id = message[0] as int;
+      final payloads = _split(message[1], message[2]);
+      final privateKeys = _split(message[3], message[4]);
+      final keyIndices = message[5] as List<int>;
+      final records = Uint8List(payloads.length * _recordSize);
+      for (var i = 0; i < payloads.length; i++) {
+        records.setAll(
+            i * _recordSize,
+            DecryptReports.decryptToRecord(
+                payloads[i], privateKeys[keyIndices[i]]));
+      }
+      responses.send([
+        id,
+        TransferableTypedData.fromList([records])
+      ]);
+    });
+  }
+
+  /// Splits the concatenated [bytes] into parts of the given [lengths].
+  static List<Uint8List> _split(
+      TransferableTypedData bytes, List<int> lengths) {
+    final all = bytes.materialize().asUint8List();
+    List<Uint8List> parts = [];
+    var offset = 0;
+    for (var length in lengths) {
+      parts.add(Uint8List.sublistView(all, offset, offset + length));
+      offset += length;
+    }
+    return parts;
+  }
+}
@@ -0,0 +1,7 @@
+import 'dart:typed_data';
+
+/// Isolates are not available on this platform (e.g. web).
+Stream<Map<int, Uint8List>>? decryptReportsPooled(List<Uint8List> payloads,
+        List<Uint8List> privateKeys, List<int> keyIndices,
+        {int workers = 0}) =>
+    null;
@@ -0,0 +1,98 @@
+import 'dart:math';
+
+import 'package:macless_haystack/findMy/models.dart';
+
+/// Decrypts the reports of several accessories newest first, so that the
+/// latest locations are known right away.
+class DecryptionScheduler {
+  /// Size of the first chunk after the newest reports. Every further chunk is
+  /// twice as large up to [_maxChunkSize], so that the first results are
+  /// published early but not too often.
+  static const _firstChunkSize = 64;
+  static const _maxChunkSize = 1024;
+
+  _DecryptionTask? _task;
+
+  /// Cancels the running decryption, if any. The results of the chunk being
+  /// decrypted are not published anymore.
+  void cancel() {
+    _task?.cancelled = true;
+    _task = null;
+  }
+
+  /// Decrypts the encrypted reports of [reportsByAccessory] and cancels the
+  /// previous decryption. First the newest report of every accessory is
+  /// decrypted, then all others from the newest to the oldest in chunks.
+  /// After each chunk [onDecrypted] gets its reports by the index of their
+  /// accessory. Reports which could not be decrypted stay encrypted.
+  /// The native library or the isolates decrypt on [workers] threads (0: one
+  /// per core).
+  /// Returns false if the decryption was cancelled.
+  Future<bool> run(List<List<FindMyLocationReport>> reportsByAccessory,
+      void Function(Map<int, List<FindMyLocationReport>> decrypted) onDecrypted,
+      {int workers = 0}) async {
+    cancel();
+    final task = _task = _DecryptionTask();
+
+    List<_ScheduledReport> newest = [];
+    List<_ScheduledReport> older = [];
+    for (var i = 0; i < reportsByAccessory.length; i++) {
+      var encrypted = reportsByAccessory[i]
+          .where((report) => report.isEncrypted())
+          .map((report) => _ScheduledReport(i, report.seenTime(), report))
+          .toList()
+        ..sort(_newestFirst);
+      if (encrypted.isNotEmpty) {
+        newest.add(encrypted.first);
+        older.addAll(encrypted.skip(1));
+      }
+    }
+    older.sort(_newestFirst);
+
+    List<List<_ScheduledReport>> chunks = [if (newest.isNotEmpty) newest];
+    var size = _firstChunkSize;
+    for (var start = 0; start < older.length;) {
+      var end = min(start + size, older.length);
+      chunks.add(older.sublist(start, end));
+      start = end;
+      size = min(size * 2, _maxChunkSize);
+    }
+
+    for (var chunk in chunks) {
+      await FindMyLocationReport.decryptInBatches(
+              chunk.map((scheduled) => scheduled.report).toList(),
+              workers: workers)
+          .drain<void>();
+      if (task.cancelled) {
+        return false;
+      }
+      Map<int, List<FindMyLocationReport>> decrypted = {};
+      for (var scheduled in chunk) {
+        decrypted
+            .putIfAbsent(scheduled.accessory, () => [])
+            .add(scheduled.report);
+      }
+      onDecrypted(decrypted);
+    }
+    if (_task == task) {
+      _task = null;
+    }
+    return !task.cancelled;
+  }
+
+  static int _newestFirst(_ScheduledReport a, _ScheduledReport b) =>
+      b.seen.compareTo(a.seen);
+}
+
+class _DecryptionTask {
+  bool cancelled = false;
+}
+
+/// A report with the index of its accessory and its (unencrypted) seen time.
+class _ScheduledReport {
+  final int accessory;
+  final DateTime seen;
+  final FindMyLocationReport report;
+
+  _ScheduledReport(this.accessory, this.seen, this.report);
+}
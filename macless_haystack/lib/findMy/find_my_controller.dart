@@ -5,6 +5,7 @@ import 'package:flutter/foundation.dart';
 import 'package:flutter_secure_storage/flutter_secure_storage.dart';
 import 'package:flutter_settings_screens/flutter_settings_screens.dart';
 import 'package:macless_haystack/findMy/models.dart';
+import 'package:macless_haystack/findMy/native_decryption.dart';
 import 'package:macless_haystack/findMy/reports_fetcher.dart';
 import 'package:logger/logger.dart';
 import 'package:pointycastle/export.dart';
@@ -22,26 +23,60 @@ class FindMyController {
   static final ECCurve_secp224r1 _curveParams = ECCurve_secp224r1();
   static final HashMap _keyCache = HashMap();
 
+  /// Key pairs by hashed public key. Deriving the public key is expensive
+  /// and never changes for a key, so it is done once per key.
+  static final HashMap<String, FindMyKeyPair> _keyPairCache = HashMap();
+
   static final logger = Logger(
     printer: PrettyPrinter(methodCount: 0),
   );
 
   /// Starts a new, fetches and decrypts all location reports
   /// for the given [FindMyKeyPair].
+  /// With [since] only reports published after the given time (milliseconds
+  /// since epoch) of their hashed advertisement key are fetched.
   /// Returns a list of [FindMyLocationReport]'s.
   static Future<List<FindMyLocationReport>> computeResults(
-      List<FindMyKeyPair> keyPairs, String? url) async {
-    for (var kp in keyPairs) {
-      await _loadPrivateKey(kp);
+      List<FindMyKeyPair> keyPairs, String? url,
+      {Map<String, int> since = const {}}) async {
+    return (await computeResultsBatched([keyPairs], url, since: since)).first;
+  }
+
+  /// Fetches the location reports of the key pairs of several accessories in
+  /// one request and one isolate. The latest report of each accessory is
+  /// decrypted. With [limit] only the newest reports of each key are fetched.
+  /// Returns the reports of each list of [keyPairsByAccessory] in its order.
+  static Future<List<List<FindMyLocationReport>>> computeResultsBatched(
+      List<List<FindMyKeyPair>> keyPairsByAccessory, String? url,
+      {Map<String, int> since = const {},
+      int? limit}) async {
+    List<FindMyKeyPair> keyPairs = [];
+    List<int> accessoryIndices = [];
+    for (var i = 0; i < keyPairsByAccessory.length; i++) {
+      for (var kp in keyPairsByAccessory[i]) {
+        await _loadPrivateKey(kp);
+        keyPairs.add(kp);
+        accessoryIndices.add(i);
+      }
+    }
+    if (keyPairs.isEmpty) {
+      return List.generate(keyPairsByAccessory.length, (_) => []);
     }
+    FindMyKeyPair.hashAdvertisementKeys(keyPairs);
 
     Map map = <String, Object>{};
     map['keyPair'] = keyPairs;
+    map['accessoryIndex'] = accessoryIndices;
+    map['accessoryCount'] = keyPairsByAccessory.length;
     if (url?.isEmpty ?? true) {
       url = 'http://localhost:6176';
     }
 
     map['url'] = url;
+    map['since'] = since;
+    if (limit != null) {
+      map['limit'] = limit;
+    }
     map['daysToFetch'] =
         Settings.getValue<int>(numberOfDaysToFetch, defaultValue: 7)!;
     map['user'] = Settings.getValue<String>(endpointUser, defaultValue: '')!;
@@ -50,41 +85,61 @@ class FindMyController {
   }
 
   /// Fetches and decrypts the location reports for the given
-  /// [FindMyKeyPair] from apples FindMy Network.
-  /// Returns a list of [FindMyLocationReport].
-  static Future<List<FindMyLocationReport>> _getListedReportResults(
+  /// [FindMyKeyPair] from apples FindMy Network and assigns them to the
+  /// accessories of their keys.
+  /// Returns a list of [FindMyLocationReport] per accessory.
+  static Future<List<List<FindMyLocationReport>>> _getListedReportResults(
       Map map) async {
-    List<FindMyLocationReport> results = <FindMyLocationReport>[];
     List<FindMyKeyPair> keyPairs = map['keyPair'];
+    List<int> accessoryIndices = map['accessoryIndex'];
+    List<List<FindMyLocationReport>> results =
+        List.generate(map['accessoryCount'], (_) => []);
     var url = map['url'];
     int daysToFetch = map['daysToFetch'];
-    Map<String, FindMyKeyPair> hashedKeyKeyPairsMap = {
-      for (var e in keyPairs) e.getHashedAdvertisementKey(): e
-    };
-
-    List jsonResults = await ReportsFetcher.fetchLocationReports(
-        hashedKeyKeyPairsMap.keys, daysToFetch, url, map['user'], map['pass']);
-    FindMyLocationReport? latest;
-    DateTime latestDate = DateTime.fromMicrosecondsSinceEpoch(0);
-    for (var result in jsonResults) {
-      DateTime currentDate =
-          DateTime.fromMillisecondsSinceEpoch(result['datePublished']);
-      FindMyKeyPair keyPair =
-          hashedKeyKeyPairsMap[result['id']] as FindMyKeyPair;
-      var currentReport = FindMyLocationReport.decrypted(
-        result,
-        keyPair.getBase64PrivateKey(),
-        keyPair.getHashedAdvertisementKey(),
-      );
-      if (currentDate.isAfter(latestDate)) {
-        latest = currentReport;
-        latestDate = currentDate;
-      }
-      results.add(currentReport);
+    Map<String, FindMyKeyPair> hashedKeyKeyPairsMap = {};
+    Map<String, List<int>> hashedKeyAccessoriesMap = {};
+    for (var i = 0; i < keyPairs.length; i++) {
+      var hashedKey = keyPairs[i].getHashedAdvertisementKey();
+      hashedKeyKeyPairsMap[hashedKey] = keyPairs[i];
+      hashedKeyAccessoriesMap
+          .putIfAbsent(hashedKey, () => [])
+          .add(accessoryIndices[i]);
     }
-    if (latest != null) {
-      await latest.decrypt();
+
+    Map<String, int> since = map['since'];
+    List<FindMyReport> fetchedReports =
+        await ReportsFetcher.fetchLocationReports(hashedKeyKeyPairsMap.keys,
+            daysToFetch, url, map['user'], map['pass'],
+            since: {
+              for (var key in hashedKeyKeyPairsMap.keys)
+                if (since.containsKey(key)) key: since[key]!
+            },
+            limit: map['limit']);
+    List<FindMyLocationReport?> latest = List.filled(results.length, null);
+    List<DateTime> latestDate =
+        List.filled(results.length, DateTime.fromMicrosecondsSinceEpoch(0));
+    for (var report in fetchedReports) {
+      DateTime currentDate = report.datePublished;
+      FindMyKeyPair? keyPair = hashedKeyKeyPairsMap[report.id];
+      if (keyPair == null) {
+        continue;
+      }
+      for (var i in hashedKeyAccessoriesMap[report.id]!) {
+        var currentReport = FindMyLocationReport.encrypted(
+          report.payload,
+          currentDate,
+          keyPair.getBase64PrivateKey(),
+          keyPair.getHashedAdvertisementKey(),
+        );
+        if (currentDate.isAfter(latestDate[i])) {
+          latest[i] = currentReport;
+          latestDate[i] = currentDate;
+        }
+        results[i].add(currentReport);
+      }
     }
+    await FindMyLocationReport.decryptAll(
+        latest.whereType<FindMyLocationReport>().toList());
     return results;
   }
 
@@ -104,15 +159,35 @@ class FindMyController {
   }
 
   /// Derives an [ECPublicKey] from a given [ECPrivateKey] on the given curve.
+  /// Uses the precomputed base point tables of the native library if it is
+  /// available.
   static ECPublicKey _derivePublicKey(ECPrivateKey privateKey) {
-    final pk = _curveParams.G * privateKey.d;
-    final publicKey = ECPublicKey(pk, _curveParams);
-    return publicKey;
+    return _derivePublicKeys([privateKey]).first;
+  }
+
+  /// Derives the [ECPublicKey]s of all [privateKeys] in one native call.
+  static List<ECPublicKey> _derivePublicKeys(List<ECPrivateKey> privateKeys) {
+    final nativeKeys = derivePublicKeysNative(privateKeys
+        .map((privateKey) => pc_utils.encodeBigIntAsUnsigned(privateKey.d!))
+        .toList());
+    return List.generate(privateKeys.length, (i) {
+      final nativeKey = nativeKeys?[i];
+      final pk = nativeKey != null
+          ? _curveParams.curve.decodePoint(nativeKey)
+          : _curveParams.G * privateKeys[i].d;
+      return ECPublicKey(pk, _curveParams);
+    });
   }
 
   /// Returns the to the base64 encoded given hashed public key
   /// corresponding [FindMyKeyPair] from the local [FlutterSecureStorage].
+  /// The key pair is cached, so the public key and the derived advertisement
+  /// keys are only computed once per key.
   static Future<FindMyKeyPair> getKeyPair(String base64HashedPublicKey) async {
+    final cached = _keyPairCache[base64HashedPublicKey];
+    if (cached != null) {
+      return cached;
+    }
     final privateKeyBase64 = await _storage.read(key: base64HashedPublicKey);
 
     ECPrivateKey privateKey = ECPrivateKey(
@@ -120,25 +195,49 @@ class FindMyController {
         _curveParams);
     ECPublicKey publicKey = _derivePublicKey(privateKey);
 
-    return FindMyKeyPair(
-        publicKey, base64HashedPublicKey, privateKey, DateTime.now(), -1);
+    return _keyPairCache.putIfAbsent(
+        base64HashedPublicKey,
+        () => FindMyKeyPair(
+            publicKey, base64HashedPublicKey, privateKey, DateTime.now(), -1));
+  }
+
+  /// Removes the key pair of the given hashed public key from the cache,
+  /// e.g. after its private key was deleted.
+  static void forgetKeyPair(String base64HashedPublicKey) {
+    _keyPairCache.remove(base64HashedPublicKey);
+    _keyCache.remove(base64HashedPublicKey);
   }
 
   /// Imports a base64 encoded private key to the local [FlutterSecureStorage].
   /// Returns a [FindMyKeyPair] containing the corresponding [ECPublicKey].
   static Future<FindMyKeyPair> importKeyPair(String privateKeyBase64) async {
-    final privateKeyBytes = base64Decode(privateKeyBase64);
-    final ECPrivateKey privateKey = ECPrivateKey(
-        pc_utils.decodeBigIntWithSign(1, privateKeyBytes), _curveParams);
-    final ECPublicKey publicKey = _derivePublicKey(privateKey);
-    final hashedPublicKey = getHashedPublicKey(publicKey: publicKey);
-    final keyPair = FindMyKeyPair(
-        publicKey, hashedPublicKey, privateKey, DateTime.now(), -1);
+    return (await importKeyPairs([privateKeyBase64])).first;
+  }
 
-    await _storage.write(
-        key: hashedPublicKey, value: keyPair.getBase64PrivateKey());
+  /// Imports all base64 encoded private keys to the local
+  /// [FlutterSecureStorage]. The public keys are derived and hashed in one
+  /// batch. Returns the [FindMyKeyPair]s in the order of [privateKeysBase64].
+  static Future<List<FindMyKeyPair>> importKeyPairs(
+      List<String> privateKeysBase64) async {
+    final privateKeys = privateKeysBase64
+        .map((privateKeyBase64) => ECPrivateKey(
+            pc_utils.decodeBigIntWithSign(1, base64Decode(privateKeyBase64)),
+            _curveParams))
+        .toList();
+    final publicKeys = _derivePublicKeys(privateKeys);
+    final hashedPublicKeys = getHashedPublicKeys(publicKeys
+        .map((publicKey) => publicKey.Q!.getEncoded(false))
+        .toList());
 
-    return keyPair;
+    List<FindMyKeyPair> keyPairs = [];
+    for (var i = 0; i < privateKeys.length; i++) {
+      final keyPair = FindMyKeyPair(publicKeys[i], hashedPublicKeys[i],
+          privateKeys[i], DateTime.now(), -1);
+      await _storage.write(
+          key: hashedPublicKeys[i], value: keyPair.getBase64PrivateKey());
+      keyPairs.add(keyPair);
+    }
+    return keyPairs;
   }
 
   /// Generates a [ECCurve_secp224r1] keypair.
@@ -169,10 +268,20 @@ class FindMyController {
   static String getHashedPublicKey(
       {Uint8List? publicKeyBytes, ECPublicKey? publicKey}) {
     var pkBytes = publicKeyBytes ?? publicKey!.Q!.getEncoded(false);
-    final shaDigest = SHA256Digest();
-    shaDigest.update(pkBytes, 0, pkBytes.lengthInBytes);
-    Uint8List out = Uint8List(shaDigest.digestSize);
-    shaDigest.doFinal(out, 0);
-    return base64Encode(out);
+    return getHashedPublicKeys([pkBytes]).first;
+  }
+
+  /// Returns the hashed, base64 encoded keys for all [keyBytes], hashed in
+  /// one native call if the library is available.
+  static List<String> getHashedPublicKeys(List<Uint8List> keyBytes) {
+    final digests = sha256Native(keyBytes) ??
+        keyBytes.map((bytes) {
+          final shaDigest = SHA256Digest();
+          shaDigest.update(bytes, 0, bytes.lengthInBytes);
+          Uint8List out = Uint8List(shaDigest.digestSize);
+          shaDigest.doFinal(out, 0);
+          return out;
+        }).toList();
+    return digests.map((digest) => base64Encode(digest)).toList();
   }
 }
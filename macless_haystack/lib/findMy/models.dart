@@ -26,25 +26,42 @@ class FindMyLocationReport {
   DateTime? timestamp;
   int? confidence;
   AccessoryBatteryStatus? batteryStatus;
-  dynamic result;
+
+  /// The encrypted payload, until the report is decrypted.
+  Uint8List? payload;
 
   String? base64privateKey;
 
   String? id;
-  String? hash;
+  String? _hash;
 
   FindMyLocationReport(this.latitude, this.longitude, this.accuracy,
       this.published, this.timestamp, this.confidence, this.batteryStatus);
 
   FindMyLocationReport.withHash(
-      this.latitude, this.longitude, this.timestamp, this.hash) {
+      this.latitude, this.longitude, this.timestamp, String? hash)
+      : _hash = hash {
     accuracy = 50;
   }
 
-  FindMyLocationReport.decrypted(this.result, this.base64privateKey, this.id) {
-    hash = result['payload'];
+  /// An encrypted report from a result of the fetch service.
+  FindMyLocationReport.decrypted(
+      dynamic result, this.base64privateKey, this.id) {
+    _hash = result['payload'];
+    payload = base64Decode(result['payload']);
+    if (result['datePublished'] != null) {
+      published = DateTime.fromMillisecondsSinceEpoch(result['datePublished']);
+    }
   }
 
+  /// An encrypted report with the fetched [payload], which is kept as is.
+  FindMyLocationReport.encrypted(
+      this.payload, this.published, this.base64privateKey, this.id);
+
+  /// The base64 of the encrypted payload, which identifies the report.
+  String? get hash =>
+      _hash ??= payload != null ? base64Encode(payload!) : null;
+
   Location get location => Location(latitude!, longitude!);
 
   bool isEncrypted() {
@@ -55,30 +72,98 @@ class FindMyLocationReport {
     return id;
   }
 
-  Future<void> decrypt() async {
-    {
-      await Future.delayed(const Duration(
-          milliseconds: 1)); //Is needed otherwise is executed synchron
-      if (isEncrypted()) {
-        final unixTimestampInMillis = result["datePublished"];
-        final datePublished =
-            DateTime.fromMillisecondsSinceEpoch(unixTimestampInMillis);
-        FindMyReport report = FindMyReport(datePublished,
-            base64Decode(result["payload"]), id!, result["statusCode"]);
-
-        FindMyLocationReport decryptedReport =
-            await DecryptReports.decryptReport(
-                report, base64Decode(base64privateKey!));
-        latitude = correctCoordinate(decryptedReport.latitude!, 90);
-        longitude = correctCoordinate(decryptedReport.longitude!, 180);
-        accuracy = decryptedReport.accuracy;
-        timestamp = decryptedReport.timestamp;
-        confidence = decryptedReport.confidence;
-        result = null;
-        base64privateKey = null;
-        batteryStatus = decryptedReport.batteryStatus;
-      }
+  Future<void> decrypt() {
+    return decryptAll([this]);
+  }
+
+  /// Decrypts all encrypted [reports] in one batch. Reports which could not
+  /// be decrypted stay encrypted.
+  static Future<void> decryptAll(List<FindMyLocationReport> reports) {
+    return decryptInBatches(reports, streamed: false).drain<void>();
+  }
+
+  /// Decrypts all encrypted [reports] and emits them in batches as soon as
+  /// they are done. With [streamed] the native library decrypts them on a
+  /// pool of [workers] threads (0: one per core) and a batch is emitted per
+  /// shard of reports. Reports which could not be decrypted stay encrypted.
+  static Stream<List<FindMyLocationReport>> decryptInBatches(
+      List<FindMyLocationReport> reports,
+      {bool streamed = true,
+      int workers = 0}) async* {
+    var encrypted = reports.where((report) => report.isEncrypted()).toList();
+    if (encrypted.isEmpty) {
+      return;
+    }
+
+    Map<String, int> keyIndexByPrivateKey = {};
+    List<Uint8List> keys = [];
+    List<int> keyIndices = [];
+    List<FindMyReport> findMyReports = [];
+    for (var report in encrypted) {
+      keyIndices.add(
+          keyIndexByPrivateKey.putIfAbsent(report.base64privateKey!, () {
+        keys.add(base64Decode(report.base64privateKey!));
+        return keys.length - 1;
+      }));
+      findMyReports
+          .add(FindMyReport(report.published!, report.payload!, report.id!, 0));
+    }
+
+    var batches = streamed
+        ? DecryptReports.decryptReportsInBatches(
+            findMyReports, keys, keyIndices,
+            workers: workers)
+        : Stream.fromFuture(DecryptReports.decryptReports(
+                findMyReports, keys, keyIndices))
+            .map((results) => results.asMap());
+    // Reports of this run which could not be decrypted or failed
+    // authentication, by key
+    Map<String, int> rejected = {};
+    await for (var batch in batches) {
+      batch.forEach((i, decryptedReport) {
+        if (decryptedReport == null) {
+          rejected.update(encrypted[i].id!, (count) => count + 1,
+              ifAbsent: () => 1);
+        } else {
+          encrypted[i]._applyDecrypted(decryptedReport);
+        }
+      });
+      yield batch.keys.map((i) => encrypted[i]).toList();
+    }
+    if (rejected.isNotEmpty) {
+      var failed = rejected.values.reduce((a, b) => a + b);
+      logger.w(
+          '$failed of ${encrypted.length} reports could not be decrypted.');
+      rejected.forEach((id, count) {
+        logger.d('$count reports rejected for key $id.');
+      });
+    }
+  }
+
+  /// Returns the unencrypted time the report was seen at, which is also the
+  /// [timestamp] once it is decrypted.
+  DateTime seenTime() {
+    if (!isEncrypted()) {
+      return timestamp!;
+    }
+    if (payload!.length < 4) {
+      return DateTime(1970);
     }
+    final seconds = ByteData.sublistView(payload!).getInt32(0, Endian.big);
+    return DateTime.utc(2001).add(Duration(seconds: seconds)).toLocal();
+  }
+
+  void _applyDecrypted(FindMyLocationReport decryptedReport) {
+    latitude = correctCoordinate(decryptedReport.latitude!, 90);
+    longitude = correctCoordinate(decryptedReport.longitude!, 180);
+    accuracy = decryptedReport.accuracy;
+    timestamp = decryptedReport.timestamp;
+    confidence = decryptedReport.confidence;
+    // The hash still identifies the report once the payload is dropped
+    _hash = hash;
+    payload = null;
+    base64privateKey = null;
+    batteryStatus = decryptedReport.batteryStatus;
   }
 
   /// Correction caused by overflow, when point is outside range
@@ -128,6 +213,10 @@ class FindMyKeyPair {
   /// Duration from start time how long the key was used to send BLE advertisements
   double duration;
 
+  /// Derived keys, computed on first use.
+  String? _base64AdvertisementKey;
+  String? _hashedAdvertisementKey;
+
   FindMyKeyPair(this._publicKey, this.hashedPublicKey, this._privateKey,
       this.startTime, this.duration);
 
@@ -140,7 +229,7 @@ class FindMyKeyPair {
   }
 
   String getBase64AdvertisementKey() {
-    return base64Encode(_getAdvertisementKey());
+    return _base64AdvertisementKey ??= base64Encode(_getAdvertisementKey());
   }
 
   Uint8List _getAdvertisementKey() {
@@ -151,7 +240,23 @@ class FindMyKeyPair {
   }
 
   String getHashedAdvertisementKey() {
-    var key = _getAdvertisementKey();
-    return FindMyController.getHashedPublicKey(publicKeyBytes: key);
+    return _hashedAdvertisementKey ??= FindMyController.getHashedPublicKey(
+        publicKeyBytes: _getAdvertisementKey());
+  }
+
+  /// Computes the missing hashed advertisement keys of all [keyPairs] in
+  /// one batch.
+  static void hashAdvertisementKeys(List<FindMyKeyPair> keyPairs) {
+    final missing = keyPairs
+        .where((keyPair) => keyPair._hashedAdvertisementKey == null)
+        .toList();
+    if (missing.isEmpty) {
+      return;
+    }
+    final hashes = FindMyController.getHashedPublicKeys(
+        missing.map((keyPair) => keyPair._getAdvertisementKey()).toList());
+    for (var i = 0; i < missing.length; i++) {
+      missing[i]._hashedAdvertisementKey = hashes[i];
+    }
   }
 }
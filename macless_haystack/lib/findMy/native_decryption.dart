@@ -0,0 +1,2 @@
+export 'native_decryption_stub.dart'
+    if (dart.library.ffi) 'native_decryption_ffi.dart';
@@ -0,0 +1,36 @@
+import 'dart:typed_data';
+
+import 'package:haystack_native/haystack_native.dart';
+
+/// Decrypts the given payloads with the native library.
+/// Returns the raw result records or null, if the library is not available.
+Uint8List? decryptReportsNative(List<Uint8List> payloads,
+        List<Uint8List> privateKeys, List<int> keyIndices) =>
+    HaystackNative.instance
+        ?.decryptReports(payloads, privateKeys, keyIndices);
+
+/// Decrypts the given payloads on the native worker pool with [workers]
+/// threads (0: one per core). Emits the result records by report index as
+/// they become ready, or returns null, if the library is not available.
+Stream<Map<int, Uint8List>>? decryptReportsNativeStream(
+    List<Uint8List> payloads, List<Uint8List> privateKeys, List<int> keyIndices,
+    {int workers = 0}) {
+  return HaystackNative.instance
+      ?.decryptReportsStream(payloads, privateKeys, keyIndices,
+          workers: workers)
+      .map((batch) => {
+            for (var i = 0; i < batch.indices.length; i++)
+              batch.indices[i]: Uint8List.sublistView(
+                  batch.records, i * recordSize, (i + 1) * recordSize)
+          });
+}
+
+/// Derives the uncompressed public keys of the raw [privateKeys] with the
+/// native library. Returns null, if the library is not available.
+List<Uint8List?>? derivePublicKeysNative(List<Uint8List> privateKeys) =>
+    HaystackNative.instance?.derivePublicKeys(privateKeys);
+
+/// Hashes all [messages] with SHA-256 in one native call.
+/// Returns null, if the library is not available.
+List<Uint8List>? sha256Native(List<Uint8List> messages) =>
+    HaystackNative.instance?.sha256(messages);
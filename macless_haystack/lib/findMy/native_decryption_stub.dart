@@ -0,0 +1,21 @@
+import 'dart:typed_data';
+
+/// Native decryption is not available on this platform (e.g. web).
+Uint8List? decryptReportsNative(List<Uint8List> payloads,
+        List<Uint8List> privateKeys, List<int> keyIndices) =>
+    null;
+
+/// Native decryption is not available on this platform (e.g. web).
+Stream<Map<int, Uint8List>>? decryptReportsNativeStream(
+        List<Uint8List> payloads,
+        List<Uint8List> privateKeys,
+        List<int> keyIndices,
+        {int workers = 0}) =>
+    null;
+
+/// Native key derivation is not available on this platform (e.g. web).
+List<Uint8List?>? derivePublicKeysNative(List<Uint8List> privateKeys) =>
+    null;
+
+/// Native hashing is not available on this platform (e.g. web).
+List<Uint8List>? sha256Native(List<Uint8List> messages) => null;
@@ -1,25 +1,47 @@
 import 'dart:convert';
 import 'dart:io';
+import 'dart:math';
+import 'dart:typed_data';
 
 import 'package:http/http.dart' as http;
 import 'package:logger/logger.dart';
 import 'package:flutter/foundation.dart' show kIsWeb;
+import 'package:macless_haystack/findMy/models.dart';
 
 class ReportsFetcher {
+  static const _ndjson = 'application/x-ndjson';
+  static const _binary = 'application/x-haystack-reports';
+
+  /// Layout of the binary format of the endpoint (see mh_endpoint.py).
+  static const _binaryMagic = 'HSR1';
+  static const _recordSize = 100;
+  static const _recordPublishedOffset = 2;
+  static const _recordPayloadLengthOffset = 10;
+  static const _recordPayloadOffset = 11;
+  static const _maxPayloadLength = 89;
+
   /// Fetches the location reports corresponding to the given hashed advertisement
   /// key.
+  /// With [since] only reports published after the given time (milliseconds
+  /// since epoch) of their key are fetched. With [limit] only the newest
+  /// reports by seen time of each key are fetched.
+  /// The reports are requested in the binary format, outside the web also as
+  /// newline delimited JSON. Outside the web both are parsed while they
+  /// arrive. Endpoints without them answer with the complete JSON as before.
   /// Throws [Exception] if no answer was received.
   ///
   static var logger = Logger(
     printer: PrettyPrinter(methodCount: 0),
   );
 
-  static Future<List> fetchLocationReports(
+  static Future<List<FindMyReport>> fetchLocationReports(
       Iterable<String> hashedAdvertisementKeys,
       int daysToFetch,
       String url,
       String user,
-      String pass) async {
+      String pass,
+      {Map<String, int> since = const {},
+      int? limit}) async {
     var keys = hashedAdvertisementKeys.toList(growable: false);
     logger.i('Using ${keys.length} key(s) to ask webservice');
 
@@ -31,6 +53,7 @@ class ReportsFetcher {
     if (kIsWeb) {
       Map<String, String> requestHeaders = {
         "Content-Type": "application/json",
+        "Accept": "$_binary, application/json;q=0.9",
       };
       if (credentials != null) {
         requestHeaders['Authorization'] = credentials;
@@ -41,12 +64,22 @@ class ReportsFetcher {
           body: jsonEncode(<String, dynamic>{
             "ids": keys,
             "days": daysToFetch,
+            if (since.isNotEmpty) "since": since,
+            if (limit != null) "limit": limit,
           }));
       if (response.statusCode == 401) {
         throw Exception("Authentication failure. User/password wrong");
       }
       if (response.statusCode == 200) {
-        var out = await jsonDecode(response.body)["results"];
+        List<FindMyReport> out;
+        var mimeType = response.headers['content-type']?.split(';').first;
+        if (mimeType?.trim() == _binary) {
+          out = parseBinaryReports(response.bodyBytes);
+        } else {
+          out = (jsonDecode(response.body)["results"] as List)
+              .map(_fromJson)
+              .toList();
+        }
         logger.i('Found ${out.length} reports');
         return out;
       } else {
@@ -63,8 +96,12 @@ class ReportsFetcher {
       var body = jsonEncode(<String, dynamic>{
         "ids": keys,
         "days": daysToFetch,
+        if (since.isNotEmpty) "since": since,
+        if (limit != null) "limit": limit,
       });
       request.headers.set(HttpHeaders.contentTypeHeader, "application/json");
+      request.headers.set(HttpHeaders.acceptHeader,
+          "$_binary, $_ndjson;q=0.9, application/json;q=0.8");
       if (credentials != null) {
         request.headers.set(HttpHeaders.authorizationHeader, credentials);
       }
@@ -77,13 +114,166 @@ class ReportsFetcher {
         throw Exception("Authentication failure. User/password wrong");
       }
       if (response.statusCode == 200) {
+        // A stream without its end throws, so incomplete results are never
+        // returned
+        var mimeType = response.headers.contentType?.mimeType;
+        if (mimeType == _binary) {
+          final parser = BinaryReportParser();
+          await response.forEach(parser.add);
+          var out = parser.close();
+          logger.i('Found ${out.length} reports');
+          return out;
+        }
+        if (mimeType == _ndjson) {
+          List<FindMyReport> out = [];
+          await for (var line in response
+              .transform(utf8.decoder)
+              .transform(const LineSplitter())) {
+            if (line.isNotEmpty) {
+              out.add(_fromJson(jsonDecode(line)));
+            }
+          }
+          logger.i('Found ${out.length} reports');
+          return out;
+        }
         String body = await response.transform(utf8.decoder).join();
-        var out = await jsonDecode(body)["results"];
-        return out;
+        return (jsonDecode(body)["results"] as List).map(_fromJson).toList();
       } else {
         throw Exception(
             "Failed to fetch location reports with statusCode:${response.statusCode}\n\n Response:\n$response");
       }
     }
   }
+
+  static FindMyReport _fromJson(dynamic result) {
+    return FindMyReport(
+        DateTime.fromMillisecondsSinceEpoch(result['datePublished']),
+        base64Decode(result['payload']),
+        result['id'],
+        result['statusCode'] ?? 0);
+  }
+
+  /// Parses the binary format of the endpoint: the ids of the response
+  /// followed by records of a fixed size. The payloads of the returned
+  /// reports are views into [bytes], which are not copied.
+  /// Throws [FormatException] if [bytes] are no complete response.
+  static List<FindMyReport> parseBinaryReports(Uint8List bytes) =>
+      (BinaryReportParser()..add(bytes)).close();
+}
+
+/// Parses the binary format of the endpoint (see
+/// [ReportsFetcher.parseBinaryReports]) chunk by chunk, while it arrives.
+/// Only a record split between two chunks is copied, the payloads of the
+/// others are views into their chunk.
+class BinaryReportParser {
+  final List<FindMyReport> _reports = [];
+  List<String>? _ids;
+
+  /// The start of the response until all ids arrived, afterwards the start
+  /// of a record split between chunks.
+  Uint8List _pending = Uint8List(0);
+
+  /// Number of reports parsed so far.
+  int get length => _reports.length;
+
+  /// Parses the complete records of [chunk].
+  /// Throws [FormatException] if it is no binary report response.
+  void add(List<int> chunk) {
+    var bytes = chunk is Uint8List ? chunk : Uint8List.fromList(chunk);
+    if (_ids == null) {
+      bytes = _concat(_pending, bytes);
+      final offset = _parseIds(bytes);
+      if (offset < 0) {
+        _pending = bytes;
+        return;
+      }
+      _pending = Uint8List(0);
+      bytes = Uint8List.sublistView(bytes, offset);
+    }
+    if (_pending.isNotEmpty) {
+      final missing = ReportsFetcher._recordSize - _pending.length;
+      if (bytes.length < missing) {
+        _pending = _concat(_pending, bytes);
+        return;
+      }
+      final record =
+          _concat(_pending, Uint8List.sublistView(bytes, 0, missing));
+      _parseRecord(record, 0);
+      bytes = Uint8List.sublistView(bytes, missing);
+    }
+    final end = bytes.length - bytes.length % ReportsFetcher._recordSize;
+    for (var offset = 0; offset < end; offset += ReportsFetcher._recordSize) {
+      _parseRecord(bytes, offset);
+    }
+    _pending = Uint8List.fromList(Uint8List.sublistView(bytes, end));
+  }
+
+  /// Returns all reports once the response is complete.
+  /// Throws [FormatException] if the response ended early.
+  List<FindMyReport> close() {
+    if (_ids == null) {
+      throw _pending.length < 6
+          ? const FormatException('No binary report response')
+          : const FormatException('Truncated ids');
+    }
+    if (_pending.isNotEmpty) {
+      throw const FormatException('Truncated report');
+    }
+    return _reports;
+  }
+
+  /// Parses the magic and the ids at the start of [bytes]. Returns the
+  /// offset of the first record, or -1 if not all ids arrived yet.
+  int _parseIds(Uint8List bytes) {
+    final magic = ReportsFetcher._binaryMagic;
+    final prefix = min(bytes.length, magic.length);
+    if (String.fromCharCodes(bytes, 0, prefix) != magic.substring(0, prefix)) {
+      throw const FormatException('No binary report response');
+    }
+    if (bytes.length < 6) {
+      return -1;
+    }
+    var offset = 6;
+    List<String> ids = [];
+    for (var i = ByteData.sublistView(bytes).getUint16(4); i > 0; i--) {
+      if (offset >= bytes.length || offset + 1 + bytes[offset] > bytes.length) {
+        return -1;
+      }
+      final length = bytes[offset];
+      ids.add(String.fromCharCodes(bytes, offset + 1, offset + 1 + length));
+      offset += 1 + length;
+    }
+    _ids = ids;
+    return offset;
+  }
+
+  void _parseRecord(Uint8List bytes, int offset) {
+    final ids = _ids!;
+    final data = ByteData.sublistView(bytes);
+    final index = data.getUint16(offset);
+    final length = bytes[offset + ReportsFetcher._recordPayloadLengthOffset];
+    if (index >= ids.length || length > ReportsFetcher._maxPayloadLength) {
+      throw const FormatException('Invalid report');
+    }
+    // getUint64 is not available on the web
+    const publishedOffset = ReportsFetcher._recordPublishedOffset;
+    final published = data.getUint32(offset + publishedOffset) * 0x100000000 +
+        data.getUint32(offset + publishedOffset + 4);
+    const payloadOffset = ReportsFetcher._recordPayloadOffset;
+    _reports.add(FindMyReport(
+        DateTime.fromMillisecondsSinceEpoch(published),
+        Uint8List.sublistView(
+            bytes, offset + payloadOffset, offset + payloadOffset + length),
+        ids[index],
+        0));
+  }
+
+  static Uint8List _concat(Uint8List a, Uint8List b) {
+    if (a.isEmpty) {
+      return b;
+    }
+    return Uint8List(a.length + b.length)
+      ..setAll(0, a)
+      ..setAll(a.length, b);
+  }
 }
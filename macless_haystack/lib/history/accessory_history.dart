@@ -3,9 +3,11 @@ import 'package:flutter_map/flutter_map.dart';
 import 'package:flutter_map_cancellable_tile_provider/flutter_map_cancellable_tile_provider.dart';
 import 'package:logger/logger.dart';
 import 'package:macless_haystack/accessory/accessory_model.dart';
+import 'package:macless_haystack/accessory/accessory_registry.dart';
 import 'package:latlong2/latlong.dart';
 import 'package:macless_haystack/history/days_selection_slider.dart';
 import 'package:macless_haystack/history/location_popup.dart';
+import 'package:provider/provider.dart';
 
 import 'dart:math';
 
@@ -35,15 +37,28 @@ class _AccessoryHistoryState extends State<AccessoryHistory> {
   int numberOfDays = 7;
   bool isLineLayerVisible = true;
   bool isPointLayerVisible = true;
+  bool _mapIsReady = false;
 
   @override
   void initState() {
     super.initState();
     _mapController = MapController();
 
-    DateTime latest = widget.accessory.latestHistoryEntry();
-    numberOfDays =
-        min(DateTime.now().difference(latest).inDays + 1, numberOfDays);
+    Provider.of<AccessoryRegistry>(context, listen: false)
+        .loadHistory(widget.accessory)
+        .then((_) {
+      if (!mounted) {
+        return;
+      }
+      setState(() {
+        DateTime latest = widget.accessory.latestHistoryEntry();
+        numberOfDays =
+            min(DateTime.now().difference(latest).inDays + 1, numberOfDays);
+      });
+      if (_mapIsReady) {
+        mapReadyInit();
+      }
+    });
   }
 
   @override
@@ -252,6 +267,7 @@ class _AccessoryHistoryState extends State<AccessoryHistory> {
   }
 
   mapReadyInit() {
+    _mapIsReady = true;
     WidgetsBinding.instance.addPostFrameCallback((_) {
       mapReady();
     });
@@ -26,7 +26,6 @@ class _AccessoryGenerationState extends State<AccessoryGeneration> {
       name: '',
       hashedPublicKey: '',
       datePublished: DateTime.now(),
-      hashesWithTS: {},
       locationHistory: [],
       lastBatteryStatus: null,
       additionalKeys: List.empty());
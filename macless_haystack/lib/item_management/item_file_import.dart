@@ -133,9 +133,8 @@ class _ItemFileImportState extends State<ItemFileImport> {
       icon = accessoryDTO.icon;
     }
 
-    List<String> additionalPublicKeys = await Stream.fromIterable(
-            accessoryDTO.additionalKeys as List)
-        .asyncMap((addPrivKey) => FindMyController.importKeyPair(addPrivKey))
+    List<String> additionalPublicKeys = (await FindMyController.importKeyPairs(
+            List<String>.from(accessoryDTO.additionalKeys as List)))
         .map((event) => event.hashedPublicKey)
         .toList();
 
@@ -150,7 +149,6 @@ class _ItemFileImportState extends State<ItemFileImport> {
         icon: icon,
         isActive: accessoryDTO.isActive,
         lastLocation: null,
-        hashesWithTS: {},
         locationHistory: [],
         lastBatteryStatus: null,
         additionalKeys: additionalPublicKeys);
@@ -24,7 +24,6 @@ class _AccessoryImportState extends State<AccessoryImport> {
       name: '',
       hashedPublicKey: '',
       datePublished: DateTime.now(),
-      hashesWithTS: {},
       locationHistory: [],
       lastBatteryStatus: null,
       additionalKeys: List.empty());
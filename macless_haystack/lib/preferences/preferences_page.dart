@@ -30,6 +30,7 @@ class _PreferencesPageState extends State<PreferencesPage> {
             getUserTile(),
             getPassTile(),
             getNumberofDaysTile(),
+            getDecryptionWorkersTile(),
             ListTile(
               title: getAbout(),
             ),
@@ -72,6 +73,21 @@ class _PreferencesPageState extends State<PreferencesPage> {
     );
   }
 
+  getDecryptionWorkersTile() {
+    return const DropDownSettingsTile<int>(
+      title: 'Threads used to decrypt reports',
+      settingKey: decryptionWorkers,
+      values: <int, String>{
+        0: "all cores",
+        1: "1",
+        2: "2",
+        4: "4",
+        8: "8",
+      },
+      selected: 0,
+    );
+  }
+
   getUrlTile() {
     return TextInputSettingsTile(
       initialValue: 'http://localhost:6176',
@@ -9,6 +9,7 @@ const endpointUrl = 'HAYSTACK_URL';
 const String endpointUser = 'HAYSTACK_USER';
 const String endpointPass = 'HAYSTACK_PASS';
 const String numberOfDaysToFetch = 'NUMBER_OF_DAYS';
+const String decryptionWorkers = 'DECRYPTION_WORKERS';
 
 class UserPreferences extends ChangeNotifier {
   /// If these settings are initialized.
@@ -0,0 +1,166 @@
+import 'dart:convert';
+import 'dart:typed_data';
+
+import 'package:latlong2/latlong.dart';
+import 'package:macless_haystack/accessory/accessory_history_store.dart';
+import 'package:macless_haystack/accessory/accessory_model.dart';
+import 'package:macless_haystack/accessory/history_segments.dart';
+import 'package:macless_haystack/accessory/history_segments_encrypted.dart';
+import 'package:mockito/mockito.dart';
+import 'package:test/test.dart';
+
+import 'accessory_registry_test.mocks.dart';
+
+void main() {
+  var today = DateTime.now();
+  today = DateTime(today.year, today.month, today.day);
+  late MemorySegments segments;
+  late MockFlutterSecureStorage storage;
+
+  AccessoryHistoryStore newStore() =>
+      AccessoryHistoryStore(storage, segments: segments);
+
+  AccessoryHistoryStore newEncryptedStore(int key) {
+    when(storage.read(key: historyKeyStorageKey))
+        .thenAnswer((_) async => base64Encode(List.filled(32, key)));
+    return AccessoryHistoryStore(storage,
+        segments: EncryptedHistorySegments(segments, storage));
+  }
+
+  Pair<LatLng, DateTime> entry(double lat, int startHour, int endHour) =>
+      Pair(LatLng(lat, 2), today.add(Duration(hours: startHour)),
+          today.add(Duration(hours: endHour)));
+
+  void expectHistory(List<Pair<dynamic, dynamic>> actual,
+      List<Pair<dynamic, dynamic>> expected) {
+    expect(actual.map((e) => [e.location, e.start, e.end]).toList(),
+        expected.map((e) => [e.location, e.start, e.end]).toList());
+  }
+
+  setUp(() {
+    segments = MemorySegments();
+    storage = MockFlutterSecureStorage();
+  });
+
+  test('Stored history is loaded again', () async {
+    var history = [entry(1, 8, 9), entry(2, 10, 10)];
+    await newStore().store('a', history);
+
+    expectHistory(await newStore().load('a'), history);
+    expect(await newStore().load('b'), isEmpty);
+  });
+
+  test('Only new and changed entries are appended', () async {
+    var store = newStore();
+    var history = [entry(1, 8, 9), entry(2, 10, 10)];
+    await store.store('a', history);
+    expect(segments.size('a'), 2 * AccessoryHistoryStore.recordSize);
+
+    history[1].end = today.add(const Duration(hours: 11));
+    history.add(entry(1, 12, 12));
+    await store.store('a', history);
+    expect(segments.size('a'), 4 * AccessoryHistoryStore.recordSize);
+
+    expectHistory(await newStore().load('a'), history);
+  });
+
+  test('Removed entries compact the log', () async {
+    var store = newStore();
+    await store.store('a', [entry(1, 8, 9), entry(2, 10, 10)]);
+    await store.store('a', [entry(1, 8, 9)]);
+    expect(segments.size('a'), AccessoryHistoryStore.recordSize);
+
+    expectHistory(await newStore().load('a'), [entry(1, 8, 9)]);
+  });
+
+  test('Expired entries are not stored', () async {
+    var old = Pair<LatLng, DateTime>(const LatLng(3, 2),
+        today.subtract(const Duration(days: 9)),
+        today.subtract(const Duration(days: 8)));
+    await newStore().store('a', [old, entry(1, 8, 9)]);
+
+    expectHistory(await newStore().load('a'), [entry(1, 8, 9)]);
+  });
+
+  test('An incomplete record at the end is ignored', () async {
+    await newStore().store('a', [entry(1, 8, 9)]);
+    await segments.append('a', 0, Uint8List(10));
+
+    var store = newStore();
+    expectHistory(await store.load('a'), [entry(1, 8, 9)]);
+    await store.store('a', [entry(1, 8, 9), entry(2, 10, 10)]);
+    expect(await segments.list('a'), [0, 1]);
+
+    expectHistory(
+        await newStore().load('a'), [entry(1, 8, 9), entry(2, 10, 10)]);
+  });
+
+  test('Encrypted history is loaded again', () async {
+    var history = [entry(1, 8, 9), entry(2, 10, 10)];
+    await newEncryptedStore(1).store('a', history);
+    history[1].end = today.add(const Duration(hours: 11));
+    history.add(entry(3, 12, 12));
+    await newEncryptedStore(1).store('a', history);
+
+    expectHistory(await newEncryptedStore(1).load('a'), history);
+    var start = ByteData(8)
+      ..setFloat64(
+          0,
+          today.add(const Duration(hours: 8)).microsecondsSinceEpoch.toDouble(),
+          Endian.little);
+    var stored = String.fromCharCodes(await segments.read('a', 0));
+    expect(stored.contains(String.fromCharCodes(start.buffer.asUint8List())),
+        isFalse);
+  });
+
+  test('History encrypted with another key is skipped', () async {
+    await newEncryptedStore(1).store('a', [entry(1, 8, 9)]);
+
+    var store = newEncryptedStore(2);
+    expect(await store.load('a'), isEmpty);
+    await store.store('a', [entry(2, 10, 10)]);
+    expect(await segments.list('a'), [0, 1]);
+
+    expectHistory(await newEncryptedStore(2).load('a'), [entry(2, 10, 10)]);
+  });
+
+  test('Deleted history is empty', () async {
+    await newStore().store('a', [entry(1, 8, 9)]);
+    await newStore().delete('a');
+
+    expect(await newStore().load('a'), isEmpty);
+  });
+}
+
+/// Keeps the segments in memory.
+class MemorySegments implements HistorySegments {
+  final Map<String, Map<int, Uint8List>> _segments = {};
+
+  /// The number of bytes in all segments of [id].
+  int size(String id) => (_segments[id]?.values ?? <Uint8List>[])
+      .fold(0, (size, bytes) => size + bytes.length);
+
+  @override
+  Future<List<int>> list(String id) async =>
+      (_segments[id]?.keys.toList() ?? <int>[])..sort();
+
+  @override
+  Future<Uint8List> read(String id, int segment) async =>
+      _segments[id]![segment]!;
+
+  @override
+  Future<void> append(String id, int segment, Uint8List bytes) async {
+    final old = _segments.putIfAbsent(id, () => {})[segment] ?? Uint8List(0);
+    _segments[id]![segment] = Uint8List.fromList([...old, ...bytes]);
+  }
+
+  @override
+  Future<void> delete(String id, int segment) async {
+    _segments[id]?.remove(segment);
+  }
+
+  @override
+  Future<void> deleteAll(String id) async {
+    _segments.remove(id);
+  }
+}
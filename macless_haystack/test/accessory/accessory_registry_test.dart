@@ -22,7 +22,6 @@ void main() {
       name: '',
       hashedPublicKey: '',
       datePublished: null,
-      hashesWithTS: {},
       locationHistory: [],
       lastBatteryStatus: null,
       additionalKeys: List.empty());
@@ -31,7 +30,7 @@ void main() {
         .thenAnswer((_) async => const Placemark());
     registry.setStorage = MockFlutterSecureStorage();
     accessory.locationModel = locationModel;
-    accessory.locationHistory.clear();
+    accessory.clearLocationHistory();
     accessory.datePublished = null;
   });
 
@@ -258,6 +257,69 @@ void main() {
     expect(locationHistory.elementAt(3).start, DateTime(2024, 1, 2, 8, 0, 0));
     expect(locationHistory.elementAt(3).end, DateTime(2024, 1, 2, 8, 0, 0));
   });
+
+  test('Split entries should keep the history ordered by time', () async {
+    List<FindMyLocationReport> reports =
+        await fillDefaultLocations(registry, accessory);
+    reports.clear();
+    reports.add(FindMyLocationReport.withHash(
+        4,
+        5,
+        DateTime(2024, 1, 1, 8, 30, 0),
+        DateTime.now().microsecondsSinceEpoch.toString()));
+    reports.add(FindMyLocationReport.withHash(
+        2,
+        2,
+        DateTime(2024, 1, 1, 10, 30, 0),
+        DateTime.now().microsecondsSinceEpoch.toString()));
+    await registry.fillLocationHistory(reports, accessory);
+    var locationHistory = accessory.locationHistory;
+    expect(locationHistory.length, 5);
+    expect(locationHistory.map((entry) => entry.start), [
+      DateTime(2024, 1, 1, 8, 0, 0),
+      DateTime(2024, 1, 1, 8, 30, 0),
+      DateTime(2024, 1, 1, 9, 0, 0),
+      DateTime(2024, 1, 1, 10, 0, 0),
+      DateTime(2024, 1, 1, 12, 0, 0),
+    ]);
+    // The second location is extended, although the split entry was added
+    // after it
+    expect(locationHistory.elementAt(3).end, DateTime(2024, 1, 1, 10, 30, 0));
+  });
+
+  test('Reports added to a clone should not change the original', () async {
+    await fillDefaultLocations(registry, accessory);
+    var clone = accessory.clone();
+    await registry.fillLocationHistory([
+      FindMyLocationReport.withHash(1, 2, DateTime(2024, 1, 1, 9, 30, 0),
+          DateTime.now().microsecondsSinceEpoch.toString()),
+      FindMyLocationReport.withHash(3, 3, DateTime(2024, 1, 1, 14, 0, 0),
+          DateTime.now().microsecondsSinceEpoch.toString())
+    ], clone);
+
+    expect(clone.locationHistory.length, 4);
+    expect(clone.locationHistory.first.end, DateTime(2024, 1, 1, 9, 30, 0));
+    expect(accessory.locationHistory.length, 3);
+    expect(accessory.locationHistory.first.end, DateTime(2024, 1, 1, 9, 0, 0));
+  });
+
+  test('Known reports should advance the publication time of their key',
+      () async {
+    accessory.publishedUntil.clear();
+    var payload = 'AAAAAAAAAAAAAAAAAAAAAAAAAAAAAA==';
+    accessory.addDecryptedHash(payload);
+    List<FindMyLocationReport> reports = [
+      FindMyLocationReport.decrypted(
+          {'payload': payload, 'datePublished': 1704096000000}, null, 'key'),
+      FindMyLocationReport.withHash(1, 2, DateTime(2024, 1, 1, 8, 0, 0),
+          DateTime.now().microsecondsSinceEpoch.toString())
+    ];
+    await registry.fillLocationHistory(reports, accessory);
+    expect(accessory.publishedUntil, {'key': 1704096000000});
+
+    accessory.addPublished('key', DateTime.fromMillisecondsSinceEpoch(1000));
+    expect(accessory.publishedUntil['key'], 1704096000000);
+  });
 }
 
 ///
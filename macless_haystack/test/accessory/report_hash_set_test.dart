@@ -0,0 +1,103 @@
+import 'dart:convert';
+import 'dart:math';
+
+import 'package:macless_haystack/accessory/report_hash_set.dart';
+import 'package:test/test.dart';
+
+void main() {
+  List<String> hashes(int count) => [
+        for (var i = 0; i < count; i++)
+          'AAAAAAAAAAAAAAAAAAAA${i.toString().padLeft(8, '0')}=='
+      ];
+
+  test('Added hashes are contained, also after sorting', () {
+    var set = ReportHashSet();
+    var added = hashes(1000);
+    added.forEach(set.add);
+
+    expect(set.length, 1000);
+    expect(added.every(set.contains), isTrue);
+    expect(set.contains('AAAAAAAAAAAAAAAAAAAA00001000=='), isFalse);
+  });
+
+  test('Short hashes are ignored', () {
+    var set = ReportHashSet();
+    set.add('AAAA==');
+    set.add(null);
+
+    expect(set.length, 0);
+    expect(set.contains('AAAA=='), isFalse);
+    expect(set.contains(null), isFalse);
+  });
+
+  test('Hashes are identified by their last characters', () {
+    var set = ReportHashSet();
+    set.add('AAAAAAAAAAAAAAAAAAAA00000001==');
+
+    expect(set.contains('BBBBBBBBBBBBBBBBBBBB00000001=='), isTrue);
+  });
+
+  test('Removed hashes are not contained anymore', () {
+    var set = ReportHashSet();
+    var added = hashes(300);
+    added.forEach(set.add);
+    set.removeAll(added.take(10));
+
+    expect(set.length, 290);
+    expect(added.take(10).any(set.contains), isFalse);
+    expect(added.skip(10).every(set.contains), isTrue);
+  });
+
+  test('Hashes are read from their bytes', () {
+    var set = ReportHashSet();
+    var added = hashes(300);
+    added.forEach(set.add);
+
+    var read = ReportHashSet.fromBytes(set.toBytes());
+    expect(read.length, 300);
+    expect(added.every(read.contains), isTrue);
+    expect(() => ReportHashSet.fromBytes(set.toBytes().sublist(0, 20)),
+        throwsFormatException);
+  });
+
+  test('Random hashes are rarely mistaken and stored in 8 bytes', () {
+    var random = Random(1);
+    String randomHash() =>
+        base64Encode(List.generate(88, (_) => random.nextInt(256)));
+    var set = ReportHashSet();
+    const count = 100000;
+    for (var i = 0; i < count; i++) {
+      set.add(randomHash());
+    }
+
+    const probes = 200000;
+    var falsePositives = 0;
+    for (var i = 0; i < probes; i++) {
+      if (set.contains(randomHash())) {
+        falsePositives++;
+      }
+    }
+    // 32-bit fingerprints would mistake n / 2^32 = 2.3e-5 of them, the 44
+    // bits of the suffix n / 2^44 = 5.7e-9
+    expect(falsePositives / probes, lessThan(1e-5));
+    var bytes = set.toBytes();
+    expect(bytes.length / count, lessThan(8.001));
+    expect(base64Encode(bytes).length / count, lessThan(10.7));
+  });
+
+  test('Hashes with timestamps older than seven days are removed', () {
+    var now = DateTime.now().millisecondsSinceEpoch;
+    var set = ReportHashSet.fromTimestamps({
+      '00000001==': now,
+      '00000002==': now - 2 * 24 * 60 * 60 * 1000,
+      '00000003==': now - 9 * 24 * 60 * 60 * 1000,
+    });
+    expect(set.length, 3);
+
+    set.removeOld();
+    expect(set.length, 2);
+    expect(set.contains('AAAAAAAAAAAAAAAAAAAA00000001=='), isTrue);
+    expect(set.contains('AAAAAAAAAAAAAAAAAAAA00000002=='), isTrue);
+    expect(set.contains('AAAAAAAAAAAAAAAAAAAA00000003=='), isFalse);
+  });
+}
@@ -0,0 +1,113 @@
+import 'dart:io';
+import 'dart:typed_data';
+
+import 'package:macless_haystack/findMy/reports_fetcher.dart';
+import 'package:test/test.dart';
+
+void main() {
+  const ids = ['first', 'second'];
+
+  /// A response in the binary format of the endpoint with [count] reports.
+  Uint8List response(int count) {
+    final bytes = BytesBuilder()
+      ..add('HSR1'.codeUnits)
+      ..add([0, ids.length]);
+    for (final id in ids) {
+      bytes
+        ..addByte(id.length)
+        ..add(id.codeUnits);
+    }
+    for (var i = 0; i < count; i++) {
+      final record = ByteData(100)
+        ..setUint16(0, i % ids.length)
+        ..setUint32(2, 0x18b)
+        ..setUint32(6, i * 1000)
+        ..setUint8(10, 88);
+      final payload = Uint8List.sublistView(record, 11)
+        ..fillRange(0, 88, i % 256);
+      payload[0] = i;
+      bytes.add(record.buffer.asUint8List());
+    }
+    return bytes.takeBytes();
+  }
+
+  void expectReports(List reports, int count) {
+    expect(reports.length, count);
+    for (var i = 0; i < count; i++) {
+      expect(reports[i].id, ids[i % ids.length]);
+      expect(reports[i].datePublished.millisecondsSinceEpoch,
+          0x18b * 0x100000000 + i * 1000);
+      expect(reports[i].payload.length, 88);
+      expect(reports[i].payload[0], i % 256);
+    }
+  }
+
+  test('Binary reports are parsed alike, however they are split', () {
+    final bytes = response(5);
+    expectReports(ReportsFetcher.parseBinaryReports(bytes), 5);
+    for (var split = 0; split <= bytes.length; split++) {
+      final parser = BinaryReportParser()
+        ..add(Uint8List.sublistView(bytes, 0, split))
+        ..add(Uint8List.sublistView(bytes, split));
+      expectReports(parser.close(), 5);
+    }
+    final parser = BinaryReportParser();
+    for (final byte in bytes) {
+      parser.add([byte]);
+    }
+    expectReports(parser.close(), 5);
+  });
+
+  test('Records are parsed as soon as they arrived', () {
+    final bytes = response(3);
+    final header = bytes.length - 300;
+    final parser = BinaryReportParser()
+      ..add(Uint8List.sublistView(bytes, 0, header + 150));
+    expect(parser.length, 1);
+    parser.add(Uint8List.sublistView(bytes, header + 150, header + 200));
+    expect(parser.length, 2);
+    parser.add(Uint8List.sublistView(bytes, header + 200));
+    expectReports(parser.close(), 3);
+  });
+
+  test('Incomplete or foreign responses are rejected', () {
+    final bytes = response(2);
+    expect(() => BinaryReportParser().add('{"results"'.codeUnits),
+        throwsFormatException);
+    expect(() => BinaryReportParser().close(), throwsFormatException);
+    expect(
+        () => (BinaryReportParser()..add(Uint8List.sublistView(bytes, 0, 9)))
+            .close(),
+        throwsFormatException);
+    expect(
+        () => (BinaryReportParser()
+              ..add(Uint8List.sublistView(bytes, 0, bytes.length - 1)))
+            .close(),
+        throwsFormatException);
+  });
+
+  test('Binary responses are parsed while they are received', () async {
+    final bytes = response(50);
+    final server = await HttpServer.bind(InternetAddress.loopbackIPv4, 0);
+    addTearDown(() => server.close(force: true));
+    server.listen((request) async {
+      await request.drain();
+      expect(request.headers.value(HttpHeaders.acceptHeader),
+          startsWith('application/x-haystack-reports'));
+      request.response.headers.contentType =
+          ContentType('application', 'x-haystack-reports');
+      // Chunks which end within records and within the ids.
+      for (var offset = 0; offset < bytes.length; offset += 333) {
+        request.response.add(Uint8List.sublistView(
+            bytes, offset, offset + 333 > bytes.length ? null : offset + 333));
+        await request.response.flush();
+      }
+      await request.response.close();
+    });
+
+    final reports = await ReportsFetcher.fetchLocationReports(
+        ids, 7, 'http://127.0.0.1:${server.port}/', '', '');
+
+    expectReports(reports, 50);
+  });
+}